@@ -0,0 +1,9 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+// Number of heap allocations (every form of operator new) made by the program so far.
+// alloc_counter.cpp replaces the global allocation functions to keep count; take the
+// difference of two readings to see what a piece of code allocates.
+unsigned long long allocationCount();
+
+#endif
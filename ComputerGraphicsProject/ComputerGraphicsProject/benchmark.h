@@ -0,0 +1,957 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "camera.h"
+#include "render_stats.h"
+#include "alloc_counter.h"
+#include "scene_graph.h"
+#include "particle_pool.h"
+#include "particle_system.h"
+#include "thread_pool.h"
+#include "radix_sort.h"
+#include "collision.h"
+#include "model.h"
+#include "lod_selector.h"
+#include "frame_data.h"
+#include "random.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+using namespace std;
+
+// Command line options of the headless benchmark mode, e.g.
+//   ComputerGraphicsProject --benchmark --frames 600 --scene 2 --output scene2.csv
+// Without --scene all three scenes are run one after another. The output format is
+// picked from the file extension (.json, anything else is written as CSV).
+// --chests N puts N chests into scene 2 (default 6) to stress the instanced draw path,
+// it works without --benchmark as well.
+// --scene-graph N only times SceneGraph::Update() on N orbiting bodies for --frames frames,
+// on one thread and with a thread pool, and exits, no context is created. It fails when
+// neither stays within 1 ms a frame.
+// --particles N does the same for ParticlePool::Update() with a pool of N particles,
+// compares its allocator with the linear slot scan ParticleGenerator used before and times
+// the depth sort of N particles.
+// --emitters N times ParticleSystem::Update() and Pack() on N full emitters, on the calling
+// thread and then on thread pools of growing size, and exits.
+// --colliders N moves N boxes around for --frames frames, keeping them in an AABBTree, and
+// times the tree update, a batch of box queries and the search for all overlapping pairs;
+// exits afterwards.
+// --mesh-queries N loads the models of scene 2, then times N chest-against-aircraft triangle
+// tests and N rays against the aircraft on their BVHs, and exits.
+// --lod-sweep N loads the models, then draws the aircraft and the earth alone at N distances from
+// 1 to 80 units and back again, --frames frames each at the level LodSelector picks and at full
+// detail, prints the triangles and GPU time per frame of both, and exits. Fails if a level
+// pops back and forth while the model wobbles around one of the distances.
+// --gpu-particles N simulates N particles on the GPU with transform feedback instead of the
+// CPU emitters, with or without --benchmark.
+// --packed-vertices uploads the meshes in the 20-byte PackedVertex layout instead of the full
+// 56-byte Vertex; with --benchmark the uploaded geometry size is printed after loading.
+// With --benchmark the system and GPU memory of every model is printed after loading as well.
+// --particle-blend additive|sorted|oit picks how particles are blended: additive (default),
+// alpha blended after a depth sort, or weighted blended order-independent transparency.
+struct BenchmarkOptions
+{
+	bool Enabled;
+	unsigned int Frames;
+	vector<unsigned int> Scenes;
+	string Output;
+	unsigned int Chests;
+	unsigned int SceneGraphBodies;
+	unsigned int Particles;
+	unsigned int Emitters;
+	unsigned int Colliders;
+	unsigned int MeshQueries;
+	unsigned int LodSweep;
+	unsigned int GpuParticles;
+	string ParticleBlend;
+	bool PackedVertices;
+
+	BenchmarkOptions() : Enabled(false), Frames(300), Output("benchmark.csv"), Chests(6), SceneGraphBodies(0), Particles(0), Emitters(0), Colliders(0), MeshQueries(0), LodSweep(0), GpuParticles(0), ParticleBlend("additive"), PackedVertices(false) {}
+};
+
+inline BenchmarkOptions parseBenchmarkOptions(int argc, char *argv[])
+{
+	BenchmarkOptions options;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--benchmark")
+			options.Enabled = true;
+		else if (arg == "--frames" && hasValue)
+			options.Frames = (unsigned int)atoi(argv[++i]);
+		else if (arg == "--scene" && hasValue)
+			options.Scenes.push_back((unsigned int)atoi(argv[++i]));
+		else if (arg == "--output" && hasValue)
+			options.Output = argv[++i];
+		else if (arg == "--chests" && hasValue)
+			options.Chests = (unsigned int)atoi(argv[++i]);
+		else if (arg == "--scene-graph" && hasValue)
+			options.SceneGraphBodies = (unsigned int)atoi(argv[++i]);
+		else if (arg == "--gpu-particles" && hasValue)
+			options.GpuParticles = (unsigned int)atoi(argv[++i]);
+		else if (arg == "--particles" && hasValue)
+			options.Particles = (unsigned int)atoi(argv[++i]);
+		else if (arg == "--emitters" && hasValue)
+			options.Emitters = (unsigned int)atoi(argv[++i]);
+		else if (arg == "--colliders" && hasValue)
+			options.Colliders = (unsigned int)atoi(argv[++i]);
+		else if (arg == "--mesh-queries" && hasValue)
+			options.MeshQueries = (unsigned int)atoi(argv[++i]);
+		else if (arg == "--lod-sweep" && hasValue)
+			options.LodSweep = (unsigned int)atoi(argv[++i]);
+		else if (arg == "--packed-vertices")
+			options.PackedVertices = true;
+		else if (arg == "--particle-blend" && hasValue)
+			options.ParticleBlend = argv[++i];
+		else
+			cout << "WARNING::BENCHMARK:: ignoring unknown argument " << arg << endl;
+	}
+	if (options.Scenes.empty())
+		options.Scenes = { 1, 2, 3 };
+	return options;
+}
+
+// Scripted camera path so every run sees exactly the same frames. t is the scene-local time in seconds.
+inline void applyCameraPath(Camera &camera, unsigned int scene, float t)
+{
+	glm::vec3 position, target;
+	switch (scene)
+	{
+	case 1:
+		// circle the aircraft and its shadow
+		position = glm::vec3(6.0f * cos(t * 0.3f), 2.0f, 6.0f * sin(t * 0.3f));
+		target = glm::vec3(0.0f);
+		break;
+	case 2:
+		// fly along the ring of chests so the aircraft runs into them
+		position = glm::vec3(5.0f * cos(t * 0.5f), 0.5f, 5.0f * sin(t * 0.5f));
+		target = glm::vec3(5.0f * cos(t * 0.5f + 0.3f), 0.5f, 5.0f * sin(t * 0.5f + 0.3f));
+		break;
+	default:
+		// pull back over the orbit plane of the solar system
+		position = glm::vec3(40.0f * cos(t * 0.1f), 15.0f, 40.0f * sin(t * 0.1f));
+		target = glm::vec3(0.0f);
+		break;
+	}
+	glm::vec3 front = glm::normalize(target - position);
+	float yaw = glm::degrees(atan2(front.z, front.x));
+	float pitch = glm::degrees(asin(front.y));
+	camera.SetPose(position, yaw, pitch);
+}
+
+// Runs draw() once and checks that it made no heap allocation, e.g. to keep the model draw path allocation free.
+template <typename DrawFunction>
+inline bool checkNoAllocations(const char *what, DrawFunction draw)
+{
+	unsigned long long before = allocationCount();
+	draw();
+	unsigned long long allocations = allocationCount() - before;
+	if (allocations > 0)
+	{
+		cout << "ERROR::BENCHMARK:: " << what << " made " << allocations << " heap allocations" << endl;
+		return false;
+	}
+	cout << what << " made no heap allocations" << endl;
+	return true;
+}
+
+// Average and largest ms of SceneGraph::Update() over frames frames on a made-up hierarchy of
+// bodies bodies: every body orbits the one (i - 1) / 8 before it, like moons around planets
+// around suns. checksum keeps the result alive so the updates can't be optimized away.
+inline double timeSceneGraph(ThreadPool *pool, unsigned int bodies, unsigned int frames, double &maxMs, float &checksum)
+{
+	SceneGraph graph;
+	graph.Reserve(bodies);
+	for (unsigned int i = 0; i < bodies; i++)
+	{
+		float f = (float)i;
+		OrbitMotion motion(glm::vec3(sin(f), 1.0f, cos(f)), 0.1f + 0.01f * (i % 50), glm::vec3(0.0f, 0.0f, -2.0f - (i % 7)),
+			glm::vec3(0.0f, 1.0f, 0.1f * (i % 10)), 0.5f + 0.1f * (i % 20));
+		graph.AddNode(i == 0 ? SceneGraph::NO_PARENT : (int)((i - 1) / 8), motion);
+	}
+	// the first update sorts the nodes into their levels, which only happens after adding nodes
+	graph.Update(0.0f, pool);
+
+	double totalMs = 0.0;
+	maxMs = 0.0;
+	for (unsigned int frame = 0; frame < frames; frame++)
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		graph.Update(frame / 60.0f, pool);
+		double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+		totalMs += ms;
+		maxMs = max(maxMs, ms);
+	}
+	checksum = bodies > 0 ? graph.World(bodies - 1)[3][0] : 0.0f;
+	return frames > 0 ? totalMs / frames : 0.0;
+}
+
+// Times SceneGraph::Update() on the calling thread and, on machines with more than one hardware
+// thread, with the levels split over a pool of all of them. Returns whether the faster average
+// update stays within the 1 ms budget.
+inline bool runSceneGraphBenchmark(unsigned int bodies, unsigned int frames)
+{
+	const double BUDGET_MS = 1.0;
+	double maxMs;
+	float checksum;
+	double bestMs = timeSceneGraph(NULL, bodies, frames, maxMs, checksum);
+	cout << "scene graph: " << bodies << " bodies, " << frames << " frames, 1 thread avg " << bestMs << " ms, max " << maxMs
+		<< " ms (checksum " << checksum << ")" << endl;
+	unsigned int hardwareThreads = thread::hardware_concurrency();
+	if (hardwareThreads > 1)
+	{
+		ThreadPool pool(hardwareThreads - 1);
+		double averageMs = timeSceneGraph(&pool, bodies, frames, maxMs, checksum);
+		cout << "scene graph: " << hardwareThreads << " threads avg " << averageMs << " ms, max " << maxMs << " ms (checksum " << checksum << ")" << endl;
+		bestMs = min(bestMs, averageMs);
+	}
+	if (bestMs > BUDGET_MS)
+	{
+		cout << "ERROR::BENCHMARK:: scene graph update takes longer than " << BUDGET_MS << " ms" << endl;
+		return false;
+	}
+	return true;
+}
+
+// Times ParticlePool::Update() on a full pool of the given size. Lifetimes are spread over one
+// to two seconds, so particles keep dying and are respawned at the end of every frame like in
+// the render loop.
+inline void runParticleBenchmark(unsigned int count, unsigned int frames)
+{
+	const float TIME_STEP = 1.0f / 60.0f;
+	ParticlePool pool(count);
+	pool.Acceleration = glm::vec3(0.0f, -0.2f, 0.0f);
+	RandomGenerator rng(1);
+	double totalMs = 0.0, maxMs = 0.0;
+	unsigned long long spawned = 0;
+	for (unsigned int frame = 0; frame < frames; frame++)
+	{
+		while (pool.Live() < pool.Capacity())
+		{
+			float r = rng.Float();
+			pool.Spawn(glm::vec3(r, 0.0f, -r), glm::vec3(r - 0.5f, 1.0f, 0.5f - r), glm::vec4(r, r, r, 1.0f), 0.05f, 1.0f + r);
+			spawned++;
+		}
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		pool.Update(TIME_STEP);
+		double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+		totalMs += ms;
+		maxMs = max(maxMs, ms);
+	}
+	double averageMs = frames > 0 ? totalMs / frames : 0.0;
+	float checksum = pool.Live() > 0 ? pool.Position(0).y : 0.0f;
+	cout << "particles: " << count << " particles, " << frames << " frames, " << spawned << " spawned, avg " << averageMs
+		<< " ms, max " << maxMs << " ms (checksum " << checksum << ")" << endl;
+}
+
+// Times the random numbers of count particle spawns (position, velocity and colour, nine numbers
+// each): nine rand() calls per particle as ParticleGenerator did before, against the batch
+// functions of RandomGenerator.
+inline void runParticleRandomBenchmark(unsigned int count)
+{
+	vector<glm::vec3> positions(count), velocities(count), colors(count);
+	srand(1);
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	for (unsigned int i = 0; i < count; i++)
+	{
+		positions[i] = glm::vec3((float)rand() / (float)(RAND_MAX / 2) - 1.0f, (float)rand() / (float)(RAND_MAX / 2) - 1.0f, (float)rand() / (float)(RAND_MAX / 2) - 1.0f);
+		velocities[i] = glm::vec3((float)rand() / (float)(RAND_MAX / 2) - 1.0f, (float)rand() / (float)(RAND_MAX / 2) - 1.0f, (float)rand() / (float)(RAND_MAX / 2) - 1.0f);
+		colors[i] = glm::vec3((float)rand() / (float)RAND_MAX, (float)rand() / (float)RAND_MAX, (float)rand() / (float)RAND_MAX);
+	}
+	chrono::high_resolution_clock::time_point middle = chrono::high_resolution_clock::now();
+	RandomGenerator rng(1);
+	if (count > 0)
+	{
+		rng.Fill(&positions[0], count, -1.0f, 1.0f);
+		rng.Fill(&velocities[0], count, -1.0f, 1.0f);
+		rng.Fill(&colors[0], count, 0.0f, 1.0f);
+	}
+	chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+	float checksum = count > 0 ? positions[count - 1].x + colors[count - 1].z : 0.0f;
+	cout << "particle random numbers, " << count << " spawns: rand() " << chrono::duration<double, milli>(middle - start).count()
+		<< " ms, RandomGenerator " << chrono::duration<double, milli>(end - middle).count() << " ms (checksum " << checksum << ")" << endl;
+}
+
+// The slot allocator ParticleGenerator had before ParticlePool, kept to compare against: dead
+// particles stay in place and a spawn scans for one from where the last spawn stopped. A full
+// pool hands out slot 0 and overwrites a live particle, which is counted here.
+struct LegacyParticleSlots
+{
+	vector<float> Life;
+	unsigned int LastUsed;
+	unsigned long long Overwritten;
+
+	LegacyParticleSlots(unsigned int count) : Life(count, 0.0f), LastUsed(0), Overwritten(0) {}
+
+	unsigned int FirstUnused()
+	{
+		unsigned int count = (unsigned int)Life.size();
+		for (unsigned int i = LastUsed; i < count; i++)
+			if (Life[i] <= 0.0f)
+				return LastUsed = i;
+		for (unsigned int i = 0; i < LastUsed; i++)
+			if (Life[i] <= 0.0f)
+				return LastUsed = i;
+		Overwritten++;
+		return LastUsed = 0;
+	}
+
+	void Spawn(float lifetime)
+	{
+		Life[FirstUnused()] = lifetime;
+	}
+
+	void Update(float dt)
+	{
+		for (size_t i = 0; i < Life.size(); i++)
+			Life[i] -= dt;
+	}
+};
+
+// Times the spawns alone, with the legacy scan and with ParticlePool, for the same requests:
+// first in a steady state where as many particles are spawned as die, then on a pool that is
+// full of long-lived particles, where the scan runs over every slot for each spawn.
+inline void runParticleAllocatorBenchmark(unsigned int count, unsigned int frames)
+{
+	const float TIME_STEP = 1.0f / 60.0f;
+	const unsigned int FULL_FRAMES = 10, FULL_SPAWNS = 64;
+	LegacyParticleSlots legacy(count);
+	ParticlePool pool(count);
+	// lifetimes between one and two seconds, so this many die per frame on average
+	unsigned int spawnsPerFrame = (unsigned int)(count * TIME_STEP / 1.5f) + 1;
+	vector<float> lifetimes(spawnsPerFrame);
+
+	double legacyMs = 0.0, poolMs = 0.0;
+	RandomGenerator rng(1);
+	for (unsigned int frame = 0; frame < frames; frame++)
+	{
+		rng.Fill(&lifetimes[0], spawnsPerFrame, 1.0f, 2.0f);
+		legacy.Update(TIME_STEP);
+		pool.Update(TIME_STEP);
+
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		for (unsigned int i = 0; i < spawnsPerFrame; i++)
+			legacy.Spawn(lifetimes[i]);
+		chrono::high_resolution_clock::time_point middle = chrono::high_resolution_clock::now();
+		for (unsigned int i = 0; i < spawnsPerFrame; i++)
+			pool.Spawn(glm::vec3(0.0f), glm::vec3(0.0f), glm::vec4(1.0f), 0.05f, lifetimes[i]);
+		chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+		legacyMs += chrono::duration<double, milli>(middle - start).count();
+		poolMs += chrono::duration<double, milli>(end - middle).count();
+	}
+	cout << "particle allocator, " << spawnsPerFrame << " spawns per frame: scan " << (frames > 0 ? legacyMs / frames : 0.0)
+		<< " ms, pool " << (frames > 0 ? poolMs / frames : 0.0) << " ms per frame" << endl;
+
+	// fill both up with particles that outlive the test
+	while (pool.Spawn(glm::vec3(0.0f), glm::vec3(0.0f), glm::vec4(1.0f), 0.05f, 1000.0f))
+		;
+	for (size_t i = 0; i < legacy.Life.size(); i++)
+		legacy.Life[i] = 1000.0f;
+	unsigned long long overwrittenBefore = legacy.Overwritten, overflowsBefore = pool.Overflows();
+	legacyMs = poolMs = 0.0;
+	for (unsigned int frame = 0; frame < FULL_FRAMES; frame++)
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		for (unsigned int i = 0; i < FULL_SPAWNS; i++)
+			legacy.Spawn(1.0f);
+		chrono::high_resolution_clock::time_point middle = chrono::high_resolution_clock::now();
+		for (unsigned int i = 0; i < FULL_SPAWNS; i++)
+			pool.Spawn(glm::vec3(0.0f), glm::vec3(0.0f), glm::vec4(1.0f), 0.05f, 1.0f);
+		chrono::high_resolution_clock::time_point end = chrono::high_resolution_clock::now();
+		legacyMs += chrono::duration<double, milli>(middle - start).count();
+		poolMs += chrono::duration<double, milli>(end - middle).count();
+	}
+	cout << "particle allocator, full pool, " << FULL_SPAWNS << " spawns per frame: scan " << legacyMs / FULL_FRAMES << " ms ("
+		<< legacy.Overwritten - overwrittenBefore << " live particles overwritten), pool " << poolMs / FULL_FRAMES << " ms ("
+		<< pool.Overflows() - overflowsBefore << " overflows reported)" << endl;
+}
+
+// Times the depth sort of PARTICLE_SORTED on count random depths: std::sort of key/index pairs
+// against RadixSorter on the calling thread and on a pool of all hardware threads.
+inline void runParticleSortBenchmark(unsigned int count, unsigned int frames)
+{
+	vector<float> depths(count);
+	RandomGenerator rng(1);
+	rng.Fill(count > 0 ? &depths[0] : NULL, count, -1.0f, 1.0f);
+	vector<pair<uint32_t, uint32_t> > pairs(count);
+	vector<uint32_t> keys(count), order(count);
+	RadixSorter sorter;
+	ThreadPool pool;
+	double comparisonMs = 0.0, serialMs = 0.0, parallelMs = 0.0;
+	bool sorted = true;
+	for (unsigned int frame = 0; frame < frames; frame++)
+	{
+		// the particles move a little between frames, the previous order is no help to either sort
+		for (unsigned int i = 0; i < count; i++)
+			pairs[i] = make_pair(~RadixSorter::FloatKey(depths[(i + frame) % count]), i);
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		sort(pairs.begin(), pairs.end());
+		comparisonMs += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+		for (int run = 0; run < 2; run++)
+		{
+			for (unsigned int i = 0; i < count; i++)
+			{
+				keys[i] = ~RadixSorter::FloatKey(depths[(i + frame) % count]);
+				order[i] = i;
+			}
+			start = chrono::high_resolution_clock::now();
+			sorter.Sort(count > 0 ? &keys[0] : NULL, count > 0 ? &order[0] : NULL, count, run == 0 ? NULL : &pool);
+			(run == 0 ? serialMs : parallelMs) += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+			for (unsigned int i = 0; i < count; i++)
+				sorted = sorted && keys[i] == pairs[i].first && order[i] == pairs[i].second;
+		}
+	}
+	if (!sorted)
+		cout << "ERROR::BENCHMARK:: radix sort disagrees with std::sort" << endl;
+	cout << "particle depth sort: " << count << " particles, std::sort " << (frames > 0 ? comparisonMs / frames : 0.0) << " ms, radix "
+		<< (frames > 0 ? serialMs / frames : 0.0) << " ms, radix on " << pool.Size() + 1 << " threads " << (frames > 0 ? parallelMs / frames : 0.0)
+		<< " ms per frame" << endl;
+}
+
+// Average ms of ParticleSystem::Update() plus Pack() over frames frames on emitters default
+// emitters that spawn faster than their particles die, so every one of them stays full.
+inline double timeParticleSystem(ThreadPool *pool, unsigned int emitters, unsigned int frames)
+{
+	const float TIME_STEP = 1.0f / 60.0f;
+	const unsigned int CAPACITY = 4096;
+	EmitterSettings settings;
+	settings.Rate = CAPACITY * 1.5f;
+	ParticleSystem system(pool);
+	for (unsigned int i = 0; i < emitters; i++)
+		system.AddEmitter(settings, CAPACITY, i + 1);
+	vector<ParticleInstance> instances(system.Capacity());
+	// one second to fill up before the clock starts
+	for (unsigned int frame = 0; frame < 60; frame++)
+		system.Update(TIME_STEP);
+
+	chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+	for (unsigned int frame = 0; frame < frames; frame++)
+	{
+		system.Update(TIME_STEP);
+		system.Pack(&instances[0]);
+	}
+	double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	return frames > 0 ? ms / frames : 0.0;
+}
+
+// Scaling of the multi-emitter update: the serial run against pools of 2, 4, ... threads (the
+// calling thread counts as one) up to the hardware thread count.
+inline void runParticleSystemBenchmark(unsigned int emitters, unsigned int frames)
+{
+	double serialMs = timeParticleSystem(NULL, emitters, frames);
+	cout << "particle system: " << emitters << " emitters, " << frames << " frames, 1 thread " << serialMs << " ms" << endl;
+	unsigned int hardwareThreads = max(1u, thread::hardware_concurrency());
+	for (unsigned int threads = 2; threads <= hardwareThreads; threads *= 2)
+	{
+		ThreadPool pool(threads - 1);
+		double ms = timeParticleSystem(&pool, emitters, frames);
+		cout << "particle system: " << threads << " threads " << ms << " ms, speedup " << (ms > 0.0 ? serialMs / ms : 0.0) << endl;
+	}
+}
+
+// Stress test of the broad phase: count boxes of 0.2 to 1 units fly around a cube sized for about
+// one box per 8 cubic units, bouncing off its walls. Every frame all of them are moved in the
+// tree, count / 10 random boxes are queried as one batch and all overlapping pairs are found. The
+// pairs of the first frame are checked against the brute-force O(n^2) test for up to 10000 boxes.
+// Returns whether the update plus the batch query stayed within the budget.
+inline bool runCollisionBenchmark(unsigned int count, unsigned int frames)
+{
+	const float TIME_STEP = 1.0f / 60.0f;
+	const double BUDGET_MS = 1.0;
+	const unsigned int BRUTE_FORCE_LIMIT = 10000;
+	float side = 2.0f * pow((float)count, 1.0f / 3.0f);
+	RandomGenerator rng(1);
+	vector<glm::vec3> positions(count), velocities(count), halfSizes(count);
+	rng.Fill(count > 0 ? &positions[0] : NULL, count, 0.0f, side);
+	rng.Fill(count > 0 ? &velocities[0] : NULL, count, -2.0f, 2.0f);
+	rng.Fill(count > 0 ? &halfSizes[0] : NULL, count, 0.1f, 0.5f);
+
+	AABBTree tree;
+	vector<int> proxies(count);
+	for (unsigned int i = 0; i < count; i++)
+		proxies[i] = tree.CreateProxy(AABB::FromCenter(positions[i], halfSizes[i]), i);
+
+	unsigned int queryCount = max(1u, count / 10);
+	vector<AABB> queries(queryCount);
+	vector<QueryHit> hits;
+	vector<CollisionPair> pairs;
+	ThreadPool pool;
+	double updateMs = 0.0, queryMs = 0.0, parallelQueryMs = 0.0, pairsMs = 0.0, worstMs = 0.0;
+	unsigned long long reinserted = 0, hitCount = 0, pairCount = 0;
+	bool correct = true;
+	for (unsigned int frame = 0; frame < frames; frame++)
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		for (unsigned int i = 0; i < count; i++)
+		{
+			glm::vec3 displacement = velocities[i] * TIME_STEP;
+			positions[i] += displacement;
+			for (int axis = 0; axis < 3; axis++)
+				if (positions[i][axis] < 0.0f || positions[i][axis] > side)
+					velocities[i][axis] = -velocities[i][axis];
+			if (tree.MoveProxy(proxies[i], AABB::FromCenter(positions[i], halfSizes[i]), displacement))
+				reinserted++;
+		}
+		chrono::high_resolution_clock::time_point moved = chrono::high_resolution_clock::now();
+
+		for (unsigned int i = 0; i < queryCount; i++)
+			queries[i] = AABB::FromCenter(glm::vec3(rng.Range(0.0f, side), rng.Range(0.0f, side), rng.Range(0.0f, side)), glm::vec3(0.5f));
+		chrono::high_resolution_clock::time_point queryStart = chrono::high_resolution_clock::now();
+		tree.QueryBatch(&queries[0], queryCount, hits);
+		chrono::high_resolution_clock::time_point queried = chrono::high_resolution_clock::now();
+		hitCount += hits.size();
+		tree.QueryBatch(&queries[0], queryCount, hits, &pool);
+		chrono::high_resolution_clock::time_point parallelQueried = chrono::high_resolution_clock::now();
+
+		tree.FindPairs(pairs);
+		chrono::high_resolution_clock::time_point paired = chrono::high_resolution_clock::now();
+		pairCount += pairs.size();
+
+		double frameMs = chrono::duration<double, milli>(moved - start).count() + chrono::duration<double, milli>(queried - queryStart).count();
+		updateMs += chrono::duration<double, milli>(moved - start).count();
+		queryMs += chrono::duration<double, milli>(queried - queryStart).count();
+		parallelQueryMs += chrono::duration<double, milli>(parallelQueried - queried).count();
+		pairsMs += chrono::duration<double, milli>(paired - parallelQueried).count();
+		worstMs = max(worstMs, frameMs);
+
+		if (frame == 0 && count <= BRUTE_FORCE_LIMIT)
+		{
+			size_t expected = 0;
+			for (unsigned int a = 0; a < count; a++)
+				for (unsigned int b = a + 1; b < count; b++)
+					if (tree.Collider(proxies[a]).Overlaps(tree.Collider(proxies[b])))
+						expected++;
+			correct = expected == pairs.size();
+		}
+	}
+	if (!correct)
+		cout << "ERROR::BENCHMARK:: the AABB tree and the brute-force test find different pairs" << endl;
+	double averageFrames = frames > 0 ? (double)frames : 1.0;
+	cout << "collision: " << count << " colliders, tree height " << tree.Height() << ", " << reinserted / averageFrames << " reinserted, update "
+		<< updateMs / averageFrames << " ms, " << queryCount << " queries " << queryMs / averageFrames << " ms (" << hitCount / averageFrames
+		<< " hits, " << pool.Size() + 1 << " threads " << parallelQueryMs / averageFrames << " ms), all pairs " << pairsMs / averageFrames
+		<< " ms (" << pairCount / averageFrames << " pairs), worst update + query " << worstMs << " ms per frame" << endl;
+	if (updateMs + queryMs > BUDGET_MS * frames)
+	{
+		cout << "ERROR::BENCHMARK:: collision update and query take longer than " << BUDGET_MS << " ms" << endl;
+		return false;
+	}
+	return correct;
+}
+
+// system memory each model kept after uploading its meshes, what it dropped, and its GPU buffers
+inline void printModelMemory(const char *const *names, const Model *const *models, unsigned int count)
+{
+	ModelMemory total = ModelMemory();
+	for (unsigned int i = 0; i < count; i++)
+	{
+		ModelMemory memory = models[i]->Memory();
+		cout << "memory: " << names[i] << ": resident " << memory.ResidentBytes / 1024 << " KiB, released " << memory.ReleasedBytes / 1024
+			<< " KiB, gpu " << memory.GpuBytes / 1024 << " KiB" << endl;
+		total.ResidentBytes += memory.ResidentBytes;
+		total.ReleasedBytes += memory.ReleasedBytes;
+		total.GpuBytes += memory.GpuBytes;
+	}
+	cout << "memory: total: resident " << total.ResidentBytes / 1024 << " KiB, released " << total.ReleasedBytes / 1024
+		<< " KiB, gpu " << total.GpuBytes / 1024 << " KiB" << endl;
+}
+
+// GPU time per frame of drawing model, placed by transform, frames times at level
+inline double timeModelDraws(Model &model, unsigned int level, const glm::mat4 &transform, const Shader &shader, unsigned int frames, size_t &triangles)
+{
+	GLuint query;
+	glGenQueries(1, &query);
+	shader.use();
+	shader.setMat4("model", transform);
+	renderStats().Reset();
+	glBeginQuery(GL_TIME_ELAPSED, query);
+	for (unsigned int i = 0; i < frames; i++)
+	{
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		model.Draw(shader, level);
+	}
+	glEndQuery(GL_TIME_ELAPSED);
+	GLuint64 elapsed = 0;
+	glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+	glDeleteQueries(1, &query);
+	triangles = frames > 0 ? renderStats().Triangles / frames : 0;
+	return frames > 0 ? elapsed / 1.0e6 / frames : 0.0;
+}
+
+// Triangles and GPU time against distance for the levels of detail of model, drawn with shader
+// into the bound framebuffer of width x height pixels. The model is scaled by scale, moved away
+// from a fixed camera along a geometric series of steps distances and back, and drawn at every
+// one once at the level one LodSelector picks and once at full detail. At every distance the
+// model also wobbles a little to either side, as it would resting near a switching distance.
+// Returns false if the selector went finer on the way out, coarser on the way in, or changed the
+// level more than once at one distance.
+inline bool runLodSweepBenchmark(const char *name, Model &model, float scale, const Shader &shader, FrameDataBuffer &frameUniforms, unsigned int width, unsigned int height, unsigned int steps, unsigned int frames)
+{
+	const float NEAREST = 1.0f, FARTHEST = 80.0f;
+	const float FOV = glm::radians(45.0f);
+	FrameData frameData;
+	frameData.View = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	frameData.Projection = glm::perspective(FOV, (float)width / (float)height, 0.1f, 100.0f);
+	frameData.ViewProjection = frameData.Projection * frameData.View;
+	frameData.LightSpaceMatrix = glm::mat4(1.0f);
+	frameData.CameraPos = glm::vec3(0.0f);
+	frameData.Time = 0.0f;
+	frameData.LightPos = glm::vec3(5.0f, 5.0f, 0.0f);
+	frameData.padding = 0.0f;
+	frameUniforms.Update(frameData);
+	glViewport(0, 0, width, height);
+
+	cout << "lod sweep: " << name << ": levels of";
+	for (unsigned int level = 0; level < model.LodCount(); level++)
+		cout << (level > 0 ? " /" : "") << " " << model.LodTriangles(level);
+	cout << " triangles" << endl;
+	// the wobble stays well inside the band LodSelector::Hysteresis keeps between two levels
+	const unsigned int WOBBLES = 8;
+	const float WOBBLE = 0.02f;
+	LodSelector selector;
+	float projectionScale = lodProjectionScale(FOV, (float)height);
+	bool stable = true;
+	unsigned int lastLevel = 0;
+	for (unsigned int visit = 0; visit + 1 < 2 * max(steps, 1u); visit++)
+	{
+		// out to the farthest distance, then back in over the same ones
+		bool outward = visit < steps;
+		unsigned int step = outward ? visit : 2 * steps - 2 - visit;
+		float distance = steps > 1 ? NEAREST * pow(FARTHEST / NEAREST, (float)step / (steps - 1)) : NEAREST;
+		unsigned int level = lastLevel, changes = 0;
+		glm::mat4 transform;
+		for (unsigned int wobble = 0; wobble <= WOBBLES; wobble++)
+		{
+			// the last pick is at the distance itself
+			float offset = wobble == WOBBLES ? 0.0f : (wobble % 2 == 0 ? WOBBLE : -WOBBLE);
+			transform = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -distance * (1.0f + offset)));
+			transform = glm::rotate(transform, glm::radians(30.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+			transform = glm::scale(transform, glm::vec3(scale));
+			unsigned int picked = selector.Select(model, LodSelector::PixelsPerUnit(model, transform, frameData.CameraPos, projectionScale));
+			changes += picked != level ? 1 : 0;
+			level = picked;
+		}
+		if (outward ? level < lastLevel : level > lastLevel)
+		{
+			cout << "ERROR::BENCHMARK:: " << name << " went " << (outward ? "finer while moving away" : "coarser while coming closer")
+				<< " at distance " << distance << endl;
+			stable = false;
+		}
+		if (changes > 1)
+		{
+			cout << "ERROR::BENCHMARK:: " << name << " changed its level of detail " << changes << " times at distance " << distance << endl;
+			stable = false;
+		}
+		lastLevel = level;
+		size_t triangles, fullTriangles;
+		double gpu = timeModelDraws(model, level, transform, shader, frames, triangles);
+		double fullGpu = timeModelDraws(model, 0, transform, shader, frames, fullTriangles);
+		cout << "lod sweep: " << name << ": " << (outward ? "out" : "in") << ", distance " << distance << ": level " << level << ", " << triangles
+			<< " triangles, gpu " << gpu << " ms (full detail " << fullTriangles << " triangles, " << fullGpu << " ms)" << endl;
+	}
+	return stable;
+}
+
+// Narrow phase timings on real models: rebuilds the BVHs of target to time the build, then places
+// other count times at a random spot and rotation around target, scaled to a quarter of its
+// size, and casts count rays from a sphere around target at random points of its box. The first
+// rays are checked against testing every triangle. Returns whether both kinds of query stayed
+// within the budget and the rays agreed.
+inline bool runMeshQueryBenchmark(const Model &target, const Model &other, unsigned int count)
+{
+	const double BUDGET_US = 100.0;
+	const unsigned int BRUTE_FORCE_RAYS = 200;
+	size_t triangles = 0, nodes = 0;
+	chrono::high_resolution_clock::time_point buildStart = chrono::high_resolution_clock::now();
+	for (unsigned int i = 0; i < target.meshes.size(); i++)
+	{
+		// the coarser levels of detail follow the full mesh in the index buffer, the BVH only covers the full one
+		const Mesh &mesh = target.meshes[i];
+		const MeshLod &full = mesh.Lod(0);
+		MeshBVH bvh;
+		if (full.IndexCount > 0)
+			bvh.Build(&mesh.vertices[0].Position, sizeof(Vertex), &mesh.indices[full.IndexOffset], full.IndexCount);
+		triangles += bvh.TriangleCount();
+		nodes += bvh.NodeCount();
+	}
+	double buildMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - buildStart).count();
+
+	AABB bounds = target.Bounds(), otherBounds = other.Bounds();
+	if (bounds.IsEmpty() || otherBounds.IsEmpty())
+	{
+		cout << "ERROR::BENCHMARK:: the models for the mesh queries have no triangles" << endl;
+		return false;
+	}
+	glm::vec3 extent = bounds.Extent(), otherExtent = otherBounds.Extent();
+	float radius = glm::length(extent);
+	float otherScale = 0.25f * max(max(extent.x, extent.y), extent.z) / max(max(otherExtent.x, otherExtent.y), otherExtent.z);
+	RandomGenerator rng(1);
+	glm::mat4 identity(1.0f);
+
+	double meshUs = 0.0, rayUs = 0.0;
+	unsigned int meshHits = 0, rayHits = 0, wrongRays = 0;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		glm::vec3 position = bounds.Center() + glm::vec3(rng.Range(-1.2f, 1.2f), rng.Range(-1.2f, 1.2f), rng.Range(-1.2f, 1.2f)) * extent;
+		glm::vec3 axis = glm::normalize(glm::vec3(rng.Range(-1.0f, 1.0f), rng.Range(-1.0f, 1.0f), rng.Range(0.1f, 1.0f)));
+		glm::mat4 otherModel = glm::translate(identity, position);
+		otherModel = glm::rotate(otherModel, rng.Range(0.0f, 6.2832f), axis);
+		otherModel = glm::scale(otherModel, glm::vec3(otherScale));
+		otherModel = glm::translate(otherModel, -otherBounds.Center());
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		if (target.Intersects(other, identity, otherModel))
+			meshHits++;
+		meshUs += chrono::duration<double, micro>(chrono::high_resolution_clock::now() - start).count();
+
+		glm::vec3 origin = bounds.Center() + glm::normalize(glm::vec3(rng.Range(-1.0f, 1.0f), rng.Range(-1.0f, 1.0f), rng.Range(-1.0f, 1.0f))) * 2.0f * radius;
+		glm::vec3 aim = bounds.Center() + glm::vec3(rng.Range(-1.0f, 1.0f), rng.Range(-1.0f, 1.0f), rng.Range(-1.0f, 1.0f)) * extent;
+		glm::vec3 direction = glm::normalize(aim - origin);
+		RayHit hit;
+		start = chrono::high_resolution_clock::now();
+		bool found = target.Raycast(origin, direction, identity, 4.0f * radius, hit);
+		rayUs += chrono::duration<double, micro>(chrono::high_resolution_clock::now() - start).count();
+		if (found)
+			rayHits++;
+
+		if (i < BRUTE_FORCE_RAYS)
+		{
+			float closest = 4.0f * radius;
+			for (unsigned int m = 0; m < target.meshes.size(); m++)
+			{
+				const Mesh &mesh = target.meshes[m];
+				const MeshLod &full = mesh.Lod(0);
+				for (size_t j = full.IndexOffset; j + 2 < full.IndexOffset + full.IndexCount; j += 3)
+				{
+					glm::vec3 triangle[3] = { mesh.vertices[mesh.indices[j]].Position, mesh.vertices[mesh.indices[j + 1]].Position, mesh.vertices[mesh.indices[j + 2]].Position };
+					float t;
+					if (MeshBVH::RayTriangle(origin, direction, triangle, closest, t))
+						closest = t;
+				}
+			}
+			bool expected = closest < 4.0f * radius;
+			if (expected != found || (found && fabs(closest - hit.Distance) > 1e-4f * radius))
+				wrongRays++;
+		}
+	}
+	double averageCount = count > 0 ? (double)count : 1.0;
+	cout << "mesh queries: " << triangles << " triangles in " << nodes << " BVH nodes, built in " << buildMs << " ms; mesh against mesh "
+		<< meshUs / averageCount << " us (" << meshHits << " of " << count << " touching), ray " << rayUs / averageCount << " us ("
+		<< rayHits << " of " << count << " hits)" << endl;
+	if (wrongRays > 0)
+		cout << "ERROR::BENCHMARK:: " << wrongRays << " rays hit something else than testing every triangle does" << endl;
+	if (meshUs > BUDGET_US * count || rayUs > BUDGET_US * count)
+	{
+		cout << "ERROR::BENCHMARK:: mesh queries take longer than " << BUDGET_US << " us" << endl;
+		return false;
+	}
+	return wrongRays == 0;
+}
+
+struct FrameRecord
+{
+	unsigned int Scene;
+	unsigned int Frame;
+	double CpuMs;
+	double GpuMs;
+	unsigned long long Allocations;
+	RenderStats Stats;
+};
+
+// Drives the render loop in benchmark mode: steps through the requested scenes with a fixed
+// time step, times every frame on the CPU and (through GL_TIME_ELAPSED queries) on the GPU
+// and writes one record per frame once the run is over.
+class BenchmarkRunner
+{
+public:
+	BenchmarkRunner(const BenchmarkOptions &options) : options(options), sceneIndex(0), frame(0), started(false), allocationStart(0)
+	{
+		memset(queries, 0, sizeof(queries));
+	}
+
+	~BenchmarkRunner()
+	{
+		if (queries[0])
+			glDeleteQueries(QUERY_COUNT, queries);
+	}
+
+	// advances to the next frame, returns false once every scene has been run for the requested number of frames
+	bool Advance()
+	{
+		if (!started)
+		{
+			started = true;
+			glGenQueries(QUERY_COUNT, queries);
+			records.reserve(options.Frames * options.Scenes.size());
+		}
+		else if (++frame >= options.Frames)
+		{
+			frame = 0;
+			sceneIndex++;
+		}
+		return sceneIndex < options.Scenes.size();
+	}
+
+	// true on the first frame of every scene, the caller resets its per-scene state then
+	bool SceneStarted() const
+	{
+		return frame == 0;
+	}
+
+	unsigned int Scene() const
+	{
+		return options.Scenes[sceneIndex];
+	}
+
+	float DeltaTime() const
+	{
+		return TIME_STEP;
+	}
+
+	float Time() const
+	{
+		return frame * TIME_STEP;
+	}
+
+	void BeginFrame()
+	{
+		renderStats().Reset();
+		allocationStart = allocationCount();
+		cpuStart = chrono::high_resolution_clock::now();
+		glBeginQuery(GL_TIME_ELAPSED, queries[records.size() % QUERY_COUNT]);
+	}
+
+	void EndFrame()
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		chrono::duration<double, milli> cpu = chrono::high_resolution_clock::now() - cpuStart;
+		unsigned long long allocations = allocationCount() - allocationStart;
+
+		FrameRecord record;
+		record.Scene = Scene();
+		record.Frame = frame;
+		record.CpuMs = cpu.count();
+		record.GpuMs = 0.0;
+		record.Allocations = allocations;
+		record.Stats = renderStats();
+		records.push_back(record);
+
+		// the query ring lets the GPU run a few frames behind before we block on a result
+		if (records.size() >= QUERY_COUNT)
+			resolveQuery(records.size() - QUERY_COUNT);
+	}
+
+	// collects the outstanding GPU timings and writes the results, returns false if the output could not be written
+	bool Finish()
+	{
+		size_t first = records.size() >= QUERY_COUNT ? records.size() - QUERY_COUNT + 1 : 0;
+		for (size_t i = first; i < records.size(); i++)
+			resolveQuery(i);
+
+		printSummary();
+
+		ofstream file(options.Output);
+		if (!file)
+		{
+			cout << "ERROR::BENCHMARK:: could not write " << options.Output << endl;
+			return false;
+		}
+		size_t dot = options.Output.find_last_of('.');
+		if (dot != string::npos && options.Output.substr(dot) == ".json")
+			writeJson(file);
+		else
+			writeCsv(file);
+		cout << "Benchmark results written to " << options.Output << endl;
+		return true;
+	}
+
+private:
+	static const unsigned int QUERY_COUNT = 4;
+	static constexpr float TIME_STEP = 1.0f / 60.0f;
+
+	BenchmarkOptions options;
+	size_t sceneIndex;
+	unsigned int frame;
+	bool started;
+	GLuint queries[QUERY_COUNT];
+	chrono::high_resolution_clock::time_point cpuStart;
+	unsigned long long allocationStart;
+	vector<FrameRecord> records;
+
+	void resolveQuery(size_t recordIndex)
+	{
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(queries[recordIndex % QUERY_COUNT], GL_QUERY_RESULT, &elapsed);
+		records[recordIndex].GpuMs = elapsed / 1.0e6;
+	}
+
+	void printSummary() const
+	{
+		for (size_t s = 0; s < options.Scenes.size(); s++)
+		{
+			double cpu = 0.0, gpu = 0.0, draws = 0.0, triangles = 0.0, allocations = 0.0;
+			unsigned int count = 0;
+			for (size_t i = 0; i < records.size(); i++)
+			{
+				if (records[i].Scene != options.Scenes[s])
+					continue;
+				cpu += records[i].CpuMs;
+				gpu += records[i].GpuMs;
+				draws += records[i].Stats.DrawCalls;
+				triangles += records[i].Stats.Triangles;
+				allocations += records[i].Allocations;
+				count++;
+			}
+			if (count == 0)
+				continue;
+			cout << "scene " << options.Scenes[s] << ": " << count << " frames, cpu " << cpu / count << " ms, gpu "
+				<< gpu / count << " ms, " << draws / count << " draw calls, " << triangles / count << " mesh triangles, " << allocations / count << " allocations per frame" << endl;
+		}
+	}
+
+	void writeCsv(ofstream &file) const
+	{
+		file << "scene,frame,cpu_ms,gpu_ms,allocations,draw_calls,triangles,uniform_lookups_avoided,state_changes_issued,state_changes_skipped,particle_overflows,particle_simulate_ms,particle_pack_ms,particle_sort_ms,particle_upload_ms\n";
+		for (size_t i = 0; i < records.size(); i++)
+		{
+			const FrameRecord &r = records[i];
+			file << r.Scene << ',' << r.Frame << ',' << r.CpuMs << ',' << r.GpuMs << ',' << r.Allocations << ',' << r.Stats.DrawCalls << ',' << r.Stats.Triangles
+				<< ',' << r.Stats.UniformLookupsAvoided << ',' << r.Stats.StateChangesIssued << ',' << r.Stats.StateChangesSkipped << ',' << r.Stats.ParticleOverflows
+				<< ',' << r.Stats.ParticleSimulateMs << ',' << r.Stats.ParticlePackMs << ',' << r.Stats.ParticleSortMs << ',' << r.Stats.ParticleUploadMs << '\n';
+		}
+	}
+
+	void writeJson(ofstream &file) const
+	{
+		file << "{\n  \"frames\": [\n";
+		for (size_t i = 0; i < records.size(); i++)
+		{
+			const FrameRecord &r = records[i];
+			file << "    { \"scene\": " << r.Scene << ", \"frame\": " << r.Frame << ", \"cpu_ms\": " << r.CpuMs
+				<< ", \"gpu_ms\": " << r.GpuMs << ", \"allocations\": " << r.Allocations << ", \"draw_calls\": " << r.Stats.DrawCalls
+				<< ", \"triangles\": " << r.Stats.Triangles
+				<< ", \"uniform_lookups_avoided\": " << r.Stats.UniformLookupsAvoided
+				<< ", \"state_changes_issued\": " << r.Stats.StateChangesIssued
+				<< ", \"state_changes_skipped\": " << r.Stats.StateChangesSkipped
+				<< ", \"particle_overflows\": " << r.Stats.ParticleOverflows
+				<< ", \"particle_simulate_ms\": " << r.Stats.ParticleSimulateMs
+				<< ", \"particle_pack_ms\": " << r.Stats.ParticlePackMs
+				<< ", \"particle_sort_ms\": " << r.Stats.ParticleSortMs
+				<< ", \"particle_upload_ms\": " << r.Stats.ParticleUploadMs << " }"
+				<< (i + 1 < records.size() ? ",\n" : "\n");
+		}
+		file << "  ]\n}\n";
+	}
+};
+#endif
@@ -0,0 +1,184 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <glm/glm.hpp>
+
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define BOUNDS_SSE
+#endif
+
+// Axis-aligned bounding box. A default constructed box is empty (Min above Max), so growing it
+// with Expand() starts from the first point instead of from the origin.
+struct AABB
+{
+	glm::vec3 Min;
+	glm::vec3 Max;
+
+	AABB() : Min(FLT_MAX), Max(-FLT_MAX) {}
+	AABB(const glm::vec3 &min, const glm::vec3 &max) : Min(min), Max(max) {}
+
+	static AABB FromCenter(const glm::vec3 &center, const glm::vec3 &halfExtent)
+	{
+		return AABB(center - halfExtent, center + halfExtent);
+	}
+
+	bool IsEmpty() const
+	{
+		return Min.x > Max.x || Min.y > Max.y || Min.z > Max.z;
+	}
+
+	glm::vec3 Center() const
+	{
+		return (Min + Max) * 0.5f;
+	}
+
+	// half the size along every axis
+	glm::vec3 Extent() const
+	{
+		return (Max - Min) * 0.5f;
+	}
+
+	float SurfaceArea() const
+	{
+		glm::vec3 size = Max - Min;
+		return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+	}
+
+	void Expand(const glm::vec3 &point)
+	{
+		Min = glm::min(Min, point);
+		Max = glm::max(Max, point);
+	}
+
+	void Expand(const AABB &box)
+	{
+		Min = glm::min(Min, box.Min);
+		Max = glm::max(Max, box.Max);
+	}
+
+	// touching boxes overlap
+	bool Overlaps(const AABB &box) const
+	{
+		return Min.x <= box.Max.x && Max.x >= box.Min.x &&
+			Min.y <= box.Max.y && Max.y >= box.Min.y &&
+			Min.z <= box.Max.z && Max.z >= box.Min.z;
+	}
+
+	// box around this one moved by m (Arvo's method); it holds everything the box held, but may be
+	// larger than the moved contents
+	AABB Transformed(const glm::mat4 &m) const
+	{
+		glm::vec3 center = glm::vec3(m * glm::vec4(Center(), 1.0f));
+		glm::vec3 extent = Extent();
+		glm::vec3 moved(
+			fabs(m[0][0]) * extent.x + fabs(m[1][0]) * extent.y + fabs(m[2][0]) * extent.z,
+			fabs(m[0][1]) * extent.x + fabs(m[1][1]) * extent.y + fabs(m[2][1]) * extent.z,
+			fabs(m[0][2]) * extent.x + fabs(m[1][2]) * extent.y + fabs(m[2][2]) * extent.z);
+		return AABB(center - moved, center + moved);
+	}
+
+	bool Contains(const AABB &box) const
+	{
+		return Min.x <= box.Min.x && Min.y <= box.Min.y && Min.z <= box.Min.z &&
+			Max.x >= box.Max.x && Max.y >= box.Max.y && Max.z >= box.Max.z;
+	}
+};
+
+inline AABB Merge(const AABB &a, const AABB &b)
+{
+	AABB merged = a;
+	merged.Expand(b);
+	return merged;
+}
+
+// Sphere around a set of points, for quick tests that do not care about orientation. A radius
+// below zero marks an empty sphere.
+struct BoundingSphere
+{
+	glm::vec3 Center;
+	float Radius;
+
+	BoundingSphere() : Center(0.0f), Radius(-1.0f) {}
+	BoundingSphere(const glm::vec3 &center, float radius) : Center(center), Radius(radius) {}
+
+	bool IsEmpty() const
+	{
+		return Radius < 0.0f;
+	}
+
+	bool Overlaps(const BoundingSphere &sphere) const
+	{
+		float distance = Radius + sphere.Radius;
+		glm::vec3 offset = sphere.Center - Center;
+		return !IsEmpty() && !sphere.IsEmpty() && glm::dot(offset, offset) <= distance * distance;
+	}
+
+	bool Overlaps(const AABB &box) const
+	{
+		glm::vec3 offset = glm::clamp(Center, box.Min, box.Max) - Center;
+		return !IsEmpty() && !box.IsEmpty() && glm::dot(offset, offset) <= Radius * Radius;
+	}
+
+	// sphere around this one moved by m, the radius grows with the largest scale of m
+	BoundingSphere Transformed(const glm::mat4 &m) const
+	{
+		if (IsEmpty())
+			return *this;
+		float scale = sqrt(std::max(std::max(glm::dot(glm::vec3(m[0]), glm::vec3(m[0])), glm::dot(glm::vec3(m[1]), glm::vec3(m[1]))), glm::dot(glm::vec3(m[2]), glm::vec3(m[2]))));
+		return BoundingSphere(glm::vec3(m * glm::vec4(Center, 1.0f)), Radius * scale);
+	}
+};
+
+// Box around count points that are stride bytes apart, e.g. &vertices[0].Position and
+// sizeof(Vertex), in one pass without copying them. With SSE every point is loaded as four
+// floats and the min/max of all of them is kept in two registers; the fourth float belongs to
+// whatever follows the point, so the last point, after which there may be nothing, is added
+// on its own.
+inline AABB BoundsOf(const void *points, size_t count, size_t stride)
+{
+	const char *bytes = (const char *)points;
+	AABB box;
+	size_t first = 0;
+#ifdef BOUNDS_SSE
+	if (count > 1)
+	{
+		__m128 low = _mm_loadu_ps((const float *)bytes), high = low;
+		for (size_t i = 1; i < count - 1; i++)
+		{
+			__m128 point = _mm_loadu_ps((const float *)(bytes + i * stride));
+			low = _mm_min_ps(low, point);
+			high = _mm_max_ps(high, point);
+		}
+		float lowLanes[4], highLanes[4];
+		_mm_storeu_ps(lowLanes, low);
+		_mm_storeu_ps(highLanes, high);
+		box = AABB(glm::vec3(lowLanes[0], lowLanes[1], lowLanes[2]), glm::vec3(highLanes[0], highLanes[1], highLanes[2]));
+		first = count - 1;
+	}
+#endif
+	for (size_t i = first; i < count; i++)
+		box.Expand(*(const glm::vec3 *)(bytes + i * stride));
+	return box;
+}
+
+// sphere centred on the box around the same points, just big enough to hold all of them
+inline BoundingSphere SphereAround(const AABB &box, const void *points, size_t count, size_t stride)
+{
+	if (box.IsEmpty())
+		return BoundingSphere();
+	const char *bytes = (const char *)points;
+	glm::vec3 center = box.Center();
+	float radius = 0.0f;
+	for (size_t i = 0; i < count; i++)
+	{
+		glm::vec3 offset = *(const glm::vec3 *)(bytes + i * stride) - center;
+		radius = std::max(radius, glm::dot(offset, offset));
+	}
+	return BoundingSphere(center, sqrt(radius));
+}
+#endif
@@ -0,0 +1,453 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include "bounds.h"
+
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+using namespace std;
+
+// closest triangle a ray ran into
+struct RayHit
+{
+	// ray parameter of the hit: position = origin + Distance * direction
+	float Distance;
+	// index of the triangle in the index buffer the BVH was built from (first index / 3)
+	unsigned int Triangle;
+};
+
+// One node of a flattened BVH, 32 bytes. The nodes are stored depth first, so the left child of
+// an inner node always follows it directly and only the right child needs an index.
+struct BVHNode
+{
+	AABB Box;
+	// inner node: index of the right child; leaf: first of its triangles
+	unsigned int Offset;
+	// 0 for inner nodes, number of triangles for leaves
+	unsigned int Count;
+
+	bool IsLeaf() const
+	{
+		return Count > 0;
+	}
+};
+
+// Bounding volume hierarchy over the triangles of one mesh, in the mesh's own space. Built once
+// with binned surface area heuristic splits; the triangles are copied in leaf order, so a leaf
+// reads its corners from one contiguous block. Answers ray casts and mesh-vs-mesh overlap tests
+// without touching the vertex data of the mesh.
+class MeshBVH
+{
+public:
+	// leaves hold at most this many triangles (unless MAX_DEPTH is reached), fewer when splitting is cheaper
+	static const unsigned int MAX_LEAF_SIZE = 4;
+	// deepest a node can be, which bounds the traversal stacks
+	static const unsigned int MAX_DEPTH = 48;
+
+	MeshBVH() {}
+
+	// positions are read with the given stride in bytes (sizeof(Vertex) for interleaved vertices)
+	void Build(const void *positions, size_t stride, const unsigned int *indices, size_t indexCount)
+	{
+		nodes.clear();
+		corners.clear();
+		triangleIds.clear();
+		size_t triangleCount = indexCount / 3;
+		if (triangleCount == 0)
+			return;
+
+		vector<glm::vec3> triangleCorners(triangleCount * 3);
+		buildBoxes.resize(triangleCount);
+		buildCentroids.resize(triangleCount);
+		buildOrder.resize(triangleCount);
+		for (size_t i = 0; i < triangleCount; i++)
+		{
+			AABB box;
+			for (int corner = 0; corner < 3; corner++)
+			{
+				const glm::vec3 &position = *(const glm::vec3 *)((const char *)positions + indices[3 * i + corner] * stride);
+				triangleCorners[3 * i + corner] = position;
+				box.Expand(position);
+			}
+			buildBoxes[i] = box;
+			buildCentroids[i] = box.Center();
+			buildOrder[i] = (unsigned int)i;
+		}
+
+		nodes.reserve(2 * triangleCount);
+		buildNode(0, (unsigned int)triangleCount, 0);
+		// leaves hold several triangles, so far fewer nodes than reserved are used; the tree may
+		// outlive the vertices, give the rest back
+		nodes.shrink_to_fit();
+
+		corners.resize(triangleCount * 3);
+		triangleIds.resize(triangleCount);
+		for (size_t i = 0; i < triangleCount; i++)
+		{
+			unsigned int triangle = buildOrder[i];
+			corners[3 * i] = triangleCorners[3 * triangle];
+			corners[3 * i + 1] = triangleCorners[3 * triangle + 1];
+			corners[3 * i + 2] = triangleCorners[3 * triangle + 2];
+			triangleIds[i] = triangle;
+		}
+		vector<AABB>().swap(buildBoxes);
+		vector<glm::vec3>().swap(buildCentroids);
+		vector<unsigned int>().swap(buildOrder);
+	}
+
+	bool Empty() const
+	{
+		return nodes.empty();
+	}
+
+	// box around all triangles
+	AABB Bounds() const
+	{
+		return nodes.empty() ? AABB() : nodes[0].Box;
+	}
+
+	size_t NodeCount() const
+	{
+		return nodes.size();
+	}
+
+	size_t TriangleCount() const
+	{
+		return triangleIds.size();
+	}
+
+	// system memory held by the tree and its copy of the triangles
+	size_t MemoryBytes() const
+	{
+		return nodes.capacity() * sizeof(BVHNode) + corners.capacity() * sizeof(glm::vec3) + triangleIds.capacity() * sizeof(unsigned int);
+	}
+
+	// closest hit of origin + t * direction with t in [0, maxDistance]; direction need not be unit length
+	bool Raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance, RayHit &hit) const
+	{
+		if (nodes.empty())
+			return false;
+		glm::vec3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+		float closest = maxDistance;
+		unsigned int closestTriangle = 0;
+		bool found = false;
+
+		unsigned int stack[MAX_DEPTH + 1];
+		unsigned int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			unsigned int index = stack[--top];
+			const BVHNode &node = nodes[index];
+			if (!slab(node.Box, origin, inverse, closest))
+				continue;
+			if (node.IsLeaf())
+			{
+				for (unsigned int i = node.Offset; i < node.Offset + node.Count; i++)
+				{
+					float t;
+					if (RayTriangle(origin, direction, &corners[3 * i], closest, t))
+					{
+						closest = t;
+						closestTriangle = triangleIds[i];
+						found = true;
+					}
+				}
+				continue;
+			}
+			// visit the nearer child first, the other one is often culled by the hits found there
+			unsigned int nearChild = index + 1, farChild = node.Offset;
+			if (glm::dot(nodes[nearChild].Box.Center() - nodes[farChild].Box.Center(), direction) > 0.0f)
+				swap(nearChild, farChild);
+			stack[top++] = farChild;
+			stack[top++] = nearChild;
+		}
+		if (found)
+		{
+			hit.Distance = closest;
+			hit.Triangle = closestTriangle;
+		}
+		return found;
+	}
+
+	// whether any triangle of other, moved into this mesh's space by otherToThis, touches one of ours.
+	// Both trees are walked together, always opening the bigger of two overlapping nodes, and only
+	// leaf pairs whose boxes overlap get their triangles tested.
+	bool Intersects(const MeshBVH &other, const glm::mat4 &otherToThis) const
+	{
+		if (nodes.empty() || other.nodes.empty())
+			return false;
+		unsigned int stack[2 * MAX_DEPTH + 2][2];
+		unsigned int top = 0;
+		stack[top][0] = 0;
+		stack[top][1] = 0;
+		top++;
+		while (top > 0)
+		{
+			top--;
+			unsigned int a = stack[top][0], b = stack[top][1];
+			const BVHNode &nodeA = nodes[a];
+			const BVHNode &nodeB = other.nodes[b];
+			AABB boxB = nodeB.Box.Transformed(otherToThis);
+			if (!nodeA.Box.Overlaps(boxB))
+				continue;
+			if (nodeA.IsLeaf() && nodeB.IsLeaf())
+			{
+				if (leavesIntersect(nodeA, other, nodeB, otherToThis))
+					return true;
+				continue;
+			}
+			bool openA = !nodeA.IsLeaf() && (nodeB.IsLeaf() || nodeA.Box.SurfaceArea() >= boxB.SurfaceArea());
+			if (openA)
+			{
+				stack[top][0] = a + 1;
+				stack[top][1] = b;
+				top++;
+				stack[top][0] = nodeA.Offset;
+				stack[top][1] = b;
+				top++;
+			}
+			else
+			{
+				stack[top][0] = a;
+				stack[top][1] = b + 1;
+				top++;
+				stack[top][0] = a;
+				stack[top][1] = nodeB.Offset;
+				top++;
+			}
+		}
+		return false;
+	}
+
+	// ray against one triangle (Moeller-Trumbore), accepts hits with t in [0, maxDistance)
+	static bool RayTriangle(const glm::vec3 &origin, const glm::vec3 &direction, const glm::vec3 *triangle, float maxDistance, float &t)
+	{
+		glm::vec3 edge1 = triangle[1] - triangle[0], edge2 = triangle[2] - triangle[0];
+		glm::vec3 p = glm::cross(direction, edge2);
+		float determinant = glm::dot(edge1, p);
+		if (fabs(determinant) < 1e-12f)
+			return false;
+		float inverse = 1.0f / determinant;
+		glm::vec3 s = origin - triangle[0];
+		float u = glm::dot(s, p) * inverse;
+		if (u < 0.0f || u > 1.0f)
+			return false;
+		glm::vec3 q = glm::cross(s, edge1);
+		float v = glm::dot(direction, q) * inverse;
+		if (v < 0.0f || u + v > 1.0f)
+			return false;
+		t = glm::dot(edge2, q) * inverse;
+		return t >= 0.0f && t < maxDistance;
+	}
+
+private:
+	static const unsigned int BINS = 12;
+
+	vector<BVHNode> nodes;
+	// three corners per triangle, in leaf order
+	vector<glm::vec3> corners;
+	// index of every triangle in the original index buffer, in leaf order
+	vector<unsigned int> triangleIds;
+	// only used while building
+	vector<AABB> buildBoxes;
+	vector<glm::vec3> buildCentroids;
+	vector<unsigned int> buildOrder;
+
+	struct Bin
+	{
+		AABB Box;
+		unsigned int Count;
+	};
+
+	// builds the node for buildOrder[begin, end) and its subtree, returns its index
+	unsigned int buildNode(unsigned int begin, unsigned int end, unsigned int depth)
+	{
+		unsigned int index = (unsigned int)nodes.size();
+		nodes.push_back(BVHNode());
+		AABB box, centroidBox;
+		for (unsigned int i = begin; i < end; i++)
+		{
+			box.Expand(buildBoxes[buildOrder[i]]);
+			centroidBox.Expand(buildCentroids[buildOrder[i]]);
+		}
+		nodes[index].Box = box;
+
+		// a leaf costs one intersection per triangle; small leaves are kept if no split is cheaper
+		unsigned int count = end - begin;
+		int axis = 0;
+		unsigned int splitBin = 0;
+		float splitCost = 0.0f;
+		bool split = count > 1 && depth < MAX_DEPTH && findSplit(begin, end, box, centroidBox, axis, splitBin, splitCost);
+		if (split && count <= MAX_LEAF_SIZE && splitCost >= count * box.SurfaceArea())
+			split = false;
+		if (!split && (count <= MAX_LEAF_SIZE || depth >= MAX_DEPTH))
+		{
+			nodes[index].Offset = begin;
+			nodes[index].Count = count;
+			return index;
+		}
+
+		unsigned int middle;
+		if (split)
+		{
+			float low = centroidBox.Min[axis], scale = BINS / (centroidBox.Max[axis] - centroidBox.Min[axis]);
+			unsigned int *first = &buildOrder[0] + begin, *last = &buildOrder[0] + end;
+			middle = (unsigned int)(std::partition(first, last, [this, axis, low, scale, splitBin](unsigned int triangle) {
+				return binOf(buildCentroids[triangle][axis], low, scale) < splitBin;
+			}) - &buildOrder[0]);
+		}
+		else
+		{
+			// too many triangles for a leaf but all centroids in one spot, halve the range
+			middle = begin + count / 2;
+		}
+
+		nodes[index].Count = 0;
+		buildNode(begin, middle, depth + 1);
+		unsigned int right = buildNode(middle, end, depth + 1);
+		nodes[index].Offset = right;
+		return index;
+	}
+
+	static unsigned int binOf(float centroid, float low, float scale)
+	{
+		return min(BINS - 1, (unsigned int)((centroid - low) * scale));
+	}
+
+	// the cheapest split by the surface area heuristic over BINS bins per axis, an inner node costs
+	// one traversal step plus its children; false if the centroids cannot be separated
+	bool findSplit(unsigned int begin, unsigned int end, const AABB &box, const AABB &centroidBox, int &bestAxis, unsigned int &bestBin, float &bestCost) const
+	{
+		float traversalCost = box.SurfaceArea();
+		bool found = false;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float extent = centroidBox.Max[axis] - centroidBox.Min[axis];
+			if (extent <= 0.0f)
+				continue;
+			float low = centroidBox.Min[axis], scale = BINS / extent;
+			Bin bins[BINS];
+			for (unsigned int i = 0; i < BINS; i++)
+				bins[i].Count = 0;
+			for (unsigned int i = begin; i < end; i++)
+			{
+				unsigned int triangle = buildOrder[i];
+				Bin &bin = bins[binOf(buildCentroids[triangle][axis], low, scale)];
+				bin.Box.Expand(buildBoxes[triangle]);
+				bin.Count++;
+			}
+
+			// sweep from the right to get the cost of every right side, then from the left
+			float rightCost[BINS];
+			AABB rightBox;
+			unsigned int rightCount = 0;
+			for (unsigned int i = BINS - 1; i > 0; i--)
+			{
+				rightBox.Expand(bins[i].Box);
+				rightCount += bins[i].Count;
+				rightCost[i] = rightCount > 0 ? rightCount * rightBox.SurfaceArea() : 0.0f;
+			}
+			AABB leftBox;
+			unsigned int leftCount = 0;
+			for (unsigned int i = 1; i < BINS; i++)
+			{
+				leftBox.Expand(bins[i - 1].Box);
+				leftCount += bins[i - 1].Count;
+				if (leftCount == 0 || leftCount == end - begin)
+					continue;
+				float cost = traversalCost + leftCount * leftBox.SurfaceArea() + rightCost[i];
+				if (!found || cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = i;
+					found = true;
+				}
+			}
+		}
+		return found;
+	}
+
+	// whether the ray enters box before maxDistance
+	static bool slab(const AABB &box, const glm::vec3 &origin, const glm::vec3 &inverse, float maxDistance)
+	{
+		float t0 = 0.0f, t1 = maxDistance;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float enter = (box.Min[axis] - origin[axis]) * inverse[axis];
+			float leave = (box.Max[axis] - origin[axis]) * inverse[axis];
+			if (enter > leave)
+				swap(enter, leave);
+			t0 = max(t0, enter);
+			t1 = min(t1, leave);
+			if (t0 > t1)
+				return false;
+		}
+		return true;
+	}
+
+	bool leavesIntersect(const BVHNode &leaf, const MeshBVH &other, const BVHNode &otherLeaf, const glm::mat4 &otherToThis) const
+	{
+		for (unsigned int j = otherLeaf.Offset; j < otherLeaf.Offset + otherLeaf.Count; j++)
+		{
+			glm::vec3 triangle[3];
+			AABB box;
+			for (int corner = 0; corner < 3; corner++)
+			{
+				triangle[corner] = glm::vec3(otherToThis * glm::vec4(other.corners[3 * j + corner], 1.0f));
+				box.Expand(triangle[corner]);
+			}
+			if (!leaf.Box.Overlaps(box))
+				continue;
+			for (unsigned int i = leaf.Offset; i < leaf.Offset + leaf.Count; i++)
+			{
+				if (trianglesIntersect(&corners[3 * i], triangle))
+					return true;
+			}
+		}
+		return false;
+	}
+
+	// separating axis test: the triangles are disjoint if their projections on one of the axes do
+	// not overlap. The two normals and the nine edge cross products decide the general case, the
+	// in-plane edge normals of both triangles the coplanar one.
+	static bool trianglesIntersect(const glm::vec3 *a, const glm::vec3 *b)
+	{
+		glm::vec3 edgesA[3] = { a[1] - a[0], a[2] - a[1], a[0] - a[2] };
+		glm::vec3 edgesB[3] = { b[1] - b[0], b[2] - b[1], b[0] - b[2] };
+		glm::vec3 normalA = glm::cross(edgesA[0], edgesA[1]);
+		glm::vec3 normalB = glm::cross(edgesB[0], edgesB[1]);
+		if (separates(normalA, a, b) || separates(normalB, a, b))
+			return false;
+		for (int i = 0; i < 3; i++)
+		{
+			for (int j = 0; j < 3; j++)
+			{
+				if (separates(glm::cross(edgesA[i], edgesB[j]), a, b))
+					return false;
+			}
+		}
+		for (int i = 0; i < 3; i++)
+		{
+			if (separates(glm::cross(normalA, edgesA[i]), a, b) || separates(glm::cross(normalB, edgesB[i]), a, b))
+				return false;
+		}
+		return true;
+	}
+
+	static bool separates(const glm::vec3 &axis, const glm::vec3 *a, const glm::vec3 *b)
+	{
+		// parallel edges give no axis
+		if (glm::dot(axis, axis) < 1e-20f)
+			return false;
+		float a0 = glm::dot(axis, a[0]), a1 = glm::dot(axis, a[1]), a2 = glm::dot(axis, a[2]);
+		float b0 = glm::dot(axis, b[0]), b1 = glm::dot(axis, b[1]), b2 = glm::dot(axis, b[2]);
+		return max(max(a0, a1), a2) < min(min(b0, b1), b2) || max(max(b0, b1), b2) < min(min(a0, a1), a2);
+	}
+};
+#endif
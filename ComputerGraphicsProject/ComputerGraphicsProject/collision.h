@@ -0,0 +1,438 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <glm/glm.hpp>
+
+#include "bounds.h"
+#include "thread_pool.h"
+
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+// user data of two colliders whose boxes overlap
+struct CollisionPair
+{
+	unsigned int A;
+	unsigned int B;
+};
+
+// a collider found by a batch query: the index of the query box and the user data of the collider
+struct QueryHit
+{
+	unsigned int Query;
+	unsigned int UserData;
+};
+
+// Broad phase over any number of moving colliders: a dynamic AABB tree. Every collider is a leaf
+// holding its box grown by Margin (the fat box); inner nodes hold the union of their children.
+// Moving a collider only touches the tree when its box leaves the fat box, so colliders that
+// jiggle in place cost a containment test per frame. Leaves are inserted next to the sibling that
+// grows the surface area of the tree the least, and AVL rotations keep the tree balanced, so
+// queries are O(log n) plus the hits.
+//
+// Nodes live in one array with a free list; proxies are node indices and stay valid until the
+// collider is destroyed. The actual boxes and user data sit in arrays of their own, so walking the
+// tree only pulls the nodes into the cache. Queries only report colliders whose actual box overlaps.
+class AABBTree
+{
+public:
+	static const int NULL_NODE = -1;
+
+	// how far fat boxes reach beyond their collider
+	float Margin;
+
+	AABBTree(float margin = 0.1f) : Margin(margin), root(NULL_NODE), freeList(NULL_NODE), colliders(0)
+	{
+	}
+
+	// adds a collider and returns its proxy; queries report it by userData
+	int CreateProxy(const AABB &box, unsigned int userData)
+	{
+		int proxy = allocateNode();
+		colliderBoxes[proxy] = box;
+		userDatas[proxy] = userData;
+		nodes[proxy].Box = fatten(box, glm::vec3(0.0f));
+		insertLeaf(proxy);
+		colliders++;
+		return proxy;
+	}
+
+	void DestroyProxy(int proxy)
+	{
+		removeLeaf(proxy);
+		freeNode(proxy);
+		colliders--;
+	}
+
+	// sets the new box of a collider that moved by displacement since the last call; returns
+	// whether it had to be reinserted. The fat box is stretched along the displacement, so a
+	// collider moving at a steady speed is not reinserted every frame.
+	bool MoveProxy(int proxy, const AABB &box, const glm::vec3 &displacement)
+	{
+		colliderBoxes[proxy] = box;
+		if (nodes[proxy].Box.Contains(box))
+			return false;
+		removeLeaf(proxy);
+		nodes[proxy].Box = fatten(box, displacement * 2.0f);
+		insertLeaf(proxy);
+		return true;
+	}
+
+	const AABB &Collider(int proxy) const
+	{
+		return colliderBoxes[proxy];
+	}
+
+	unsigned int UserData(int proxy) const
+	{
+		return userDatas[proxy];
+	}
+
+	unsigned int Size() const
+	{
+		return colliders;
+	}
+
+	// longest path from the root to a leaf, 0 for a single collider
+	int Height() const
+	{
+		return root == NULL_NODE ? 0 : nodes[root].Height;
+	}
+
+	// calls callback(userData) for every collider overlapping box; const and free of allocations,
+	// so any number of threads can query at the same time
+	template <typename Callback>
+	void Query(const AABB &box, Callback callback) const
+	{
+		traverse(box, [this, &box, &callback](int leaf) {
+			if (colliderBoxes[leaf].Overlaps(box))
+				callback(userDatas[leaf]);
+		});
+	}
+
+	// runs one query per box and collects the hits grouped by query, in query order; with a pool
+	// the queries are split over its threads
+	void QueryBatch(const AABB *boxes, size_t count, vector<QueryHit> &hits, ThreadPool *pool = NULL)
+	{
+		hits.clear();
+		size_t chunks = pool ? min(count, (size_t)pool->Size() + 1) : 1;
+		if (chunks <= 1)
+		{
+			queryRange(boxes, 0, count, hits);
+			return;
+		}
+		if (chunkHits.size() < chunks)
+			chunkHits.resize(chunks);
+		pool->ParallelFor(chunks, 1, [this, boxes, count, chunks](size_t begin, size_t end) {
+			for (size_t chunk = begin; chunk < end; chunk++)
+			{
+				chunkHits[chunk].clear();
+				queryRange(boxes, count * chunk / chunks, count * (chunk + 1) / chunks, chunkHits[chunk]);
+			}
+		});
+		for (size_t chunk = 0; chunk < chunks; chunk++)
+			hits.insert(hits.end(), chunkHits[chunk].begin(), chunkHits[chunk].end());
+	}
+
+	// every pair of colliders whose boxes overlap, each pair once. Walks the tree against itself:
+	// two subtrees are only opened if their boxes overlap, so every branch of the tree is ruled out
+	// at most once instead of once per collider.
+	void FindPairs(vector<CollisionPair> &pairs)
+	{
+		pairs.clear();
+		if (root == NULL_NODE || nodes[root].IsLeaf())
+			return;
+		pairStack.clear();
+		pairStack.push_back(make_pair(root, root));
+		while (!pairStack.empty())
+		{
+			int a = pairStack.back().first, b = pairStack.back().second;
+			pairStack.pop_back();
+			const TreeNode &nodeA = nodes[a];
+			if (a == b)
+			{
+				// pairs within one subtree: within each child and between the two
+				if (nodeA.IsLeaf())
+					continue;
+				pairStack.push_back(make_pair(nodeA.Left, nodeA.Left));
+				pairStack.push_back(make_pair(nodeA.Right, nodeA.Right));
+				pairStack.push_back(make_pair(nodeA.Left, nodeA.Right));
+				continue;
+			}
+			const TreeNode &nodeB = nodes[b];
+			if (!nodeA.Box.Overlaps(nodeB.Box))
+				continue;
+			if (nodeA.IsLeaf() && nodeB.IsLeaf())
+			{
+				if (colliderBoxes[a].Overlaps(colliderBoxes[b]))
+				{
+					CollisionPair pair = { userDatas[a], userDatas[b] };
+					pairs.push_back(pair);
+				}
+			}
+			// open the bigger of the two, a leaf is never opened
+			else if (nodeB.IsLeaf() || (!nodeA.IsLeaf() && nodeA.Height >= nodeB.Height))
+			{
+				pairStack.push_back(make_pair(nodeA.Left, b));
+				pairStack.push_back(make_pair(nodeA.Right, b));
+			}
+			else
+			{
+				pairStack.push_back(make_pair(a, nodeB.Left));
+				pairStack.push_back(make_pair(a, nodeB.Right));
+			}
+		}
+	}
+
+private:
+	// deep enough for any AVL balanced tree that fits in memory
+	static const int STACK_SIZE = 64;
+
+	struct TreeNode
+	{
+		// fat box of a leaf, union of the children of an inner node
+		AABB Box;
+		// next free node while the node is on the free list
+		int Parent;
+		int Left, Right;
+		// 0 for leaves, -1 for free nodes
+		int Height;
+
+		bool IsLeaf() const
+		{
+			return Left == NULL_NODE;
+		}
+	};
+
+	vector<TreeNode> nodes;
+	// actual box and user data of the leaves, by node index
+	vector<AABB> colliderBoxes;
+	vector<unsigned int> userDatas;
+	int root;
+	int freeList;
+	unsigned int colliders;
+	// hits of the chunks of a parallel QueryBatch()
+	vector<vector<QueryHit> > chunkHits;
+	// node pairs still to visit by FindPairs()
+	vector<pair<int, int> > pairStack;
+
+	AABB fatten(const AABB &box, const glm::vec3 &motion) const
+	{
+		AABB fat(box.Min - glm::vec3(Margin), box.Max + glm::vec3(Margin));
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (motion[axis] < 0.0f)
+				fat.Min[axis] += motion[axis];
+			else
+				fat.Max[axis] += motion[axis];
+		}
+		return fat;
+	}
+
+	// calls visit(leaf) for every leaf whose fat box overlaps box
+	template <typename Visit>
+	void traverse(const AABB &box, Visit visit) const
+	{
+		if (root == NULL_NODE)
+			return;
+		int stack[STACK_SIZE];
+		int top = 0;
+		stack[top++] = root;
+		while (top > 0)
+		{
+			int index = stack[--top];
+			const TreeNode &node = nodes[index];
+			if (!node.Box.Overlaps(box))
+				continue;
+			if (node.IsLeaf())
+				visit(index);
+			else
+			{
+				stack[top++] = node.Left;
+				stack[top++] = node.Right;
+			}
+		}
+	}
+
+	void queryRange(const AABB *boxes, size_t begin, size_t end, vector<QueryHit> &hits) const
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			Query(boxes[i], [i, &hits](unsigned int userData) {
+				QueryHit hit = { (unsigned int)i, userData };
+				hits.push_back(hit);
+			});
+		}
+	}
+
+	int allocateNode()
+	{
+		int index;
+		if (freeList != NULL_NODE)
+		{
+			index = freeList;
+			freeList = nodes[index].Parent;
+		}
+		else
+		{
+			index = (int)nodes.size();
+			nodes.push_back(TreeNode());
+			colliderBoxes.push_back(AABB());
+			userDatas.push_back(0);
+		}
+		TreeNode &node = nodes[index];
+		node.Parent = node.Left = node.Right = NULL_NODE;
+		node.Height = 0;
+		return index;
+	}
+
+	void freeNode(int index)
+	{
+		nodes[index].Parent = freeList;
+		nodes[index].Height = -1;
+		freeList = index;
+	}
+
+	void insertLeaf(int leaf)
+	{
+		if (root == NULL_NODE)
+		{
+			root = leaf;
+			nodes[leaf].Parent = NULL_NODE;
+			return;
+		}
+
+		// walk down towards the cheapest sibling: making a node the sibling costs the area of the
+		// new parent, and every ancestor on the way grows by the leaf as well
+		AABB leafBox = nodes[leaf].Box;
+		int index = root;
+		while (!nodes[index].IsLeaf())
+		{
+			float area = nodes[index].Box.SurfaceArea();
+			float combinedArea = Merge(nodes[index].Box, leafBox).SurfaceArea();
+			float cost = 2.0f * combinedArea;
+			float inheritedCost = 2.0f * (combinedArea - area);
+			float leftCost = descendCost(nodes[index].Left, leafBox) + inheritedCost;
+			float rightCost = descendCost(nodes[index].Right, leafBox) + inheritedCost;
+			if (cost < leftCost && cost < rightCost)
+				break;
+			index = leftCost < rightCost ? nodes[index].Left : nodes[index].Right;
+		}
+
+		int sibling = index;
+		int oldParent = nodes[sibling].Parent;
+		int newParent = allocateNode();
+		nodes[newParent].Parent = oldParent;
+		nodes[newParent].Box = Merge(leafBox, nodes[sibling].Box);
+		nodes[newParent].Height = nodes[sibling].Height + 1;
+		nodes[newParent].Left = sibling;
+		nodes[newParent].Right = leaf;
+		nodes[sibling].Parent = newParent;
+		nodes[leaf].Parent = newParent;
+		if (oldParent == NULL_NODE)
+			root = newParent;
+		else if (nodes[oldParent].Left == sibling)
+			nodes[oldParent].Left = newParent;
+		else
+			nodes[oldParent].Right = newParent;
+
+		refitUpwards(nodes[leaf].Parent);
+	}
+
+	// lower bound of the cost of putting the leaf somewhere below child
+	float descendCost(int child, const AABB &leafBox) const
+	{
+		float cost = Merge(leafBox, nodes[child].Box).SurfaceArea();
+		if (!nodes[child].IsLeaf())
+			cost -= nodes[child].Box.SurfaceArea();
+		return cost;
+	}
+
+	void removeLeaf(int leaf)
+	{
+		if (leaf == root)
+		{
+			root = NULL_NODE;
+			return;
+		}
+		int parent = nodes[leaf].Parent;
+		int grandParent = nodes[parent].Parent;
+		int sibling = nodes[parent].Left == leaf ? nodes[parent].Right : nodes[parent].Left;
+		freeNode(parent);
+		if (grandParent == NULL_NODE)
+		{
+			root = sibling;
+			nodes[sibling].Parent = NULL_NODE;
+			return;
+		}
+		// the sibling takes the place of the parent
+		if (nodes[grandParent].Left == parent)
+			nodes[grandParent].Left = sibling;
+		else
+			nodes[grandParent].Right = sibling;
+		nodes[sibling].Parent = grandParent;
+		refitUpwards(grandParent);
+	}
+
+	// rebalances and refits every node from index up to the root
+	void refitUpwards(int index)
+	{
+		while (index != NULL_NODE)
+		{
+			index = balance(index);
+			TreeNode &node = nodes[index];
+			node.Height = 1 + max(nodes[node.Left].Height, nodes[node.Right].Height);
+			node.Box = Merge(nodes[node.Left].Box, nodes[node.Right].Box);
+			index = node.Parent;
+		}
+	}
+
+	// if one subtree of a is more than one level taller than the other, rotates its root up into
+	// the place of a; returns the node that is now where a was
+	int balance(int a)
+	{
+		if (nodes[a].IsLeaf() || nodes[a].Height < 2)
+			return a;
+		int b = nodes[a].Left, c = nodes[a].Right;
+		int difference = nodes[c].Height - nodes[b].Height;
+		if (difference > 1)
+			return rotateUp(a, c, b, false);
+		if (difference < -1)
+			return rotateUp(a, b, c, true);
+		return a;
+	}
+
+	// lifts child, the taller child of a, above a; other is the other child of a and childIsLeft
+	// tells on which side of a child was. The shorter grandchild goes to a, the taller stays with child.
+	int rotateUp(int a, int child, int other, bool childIsLeft)
+	{
+		int f = nodes[child].Left, g = nodes[child].Right;
+
+		nodes[child].Left = a;
+		nodes[child].Parent = nodes[a].Parent;
+		nodes[a].Parent = child;
+		if (nodes[child].Parent == NULL_NODE)
+			root = child;
+		else if (nodes[nodes[child].Parent].Left == a)
+			nodes[nodes[child].Parent].Left = child;
+		else
+			nodes[nodes[child].Parent].Right = child;
+
+		int taller = nodes[f].Height > nodes[g].Height ? f : g;
+		int shorter = taller == f ? g : f;
+		nodes[child].Right = taller;
+		if (childIsLeft)
+			nodes[a].Left = shorter;
+		else
+			nodes[a].Right = shorter;
+		nodes[shorter].Parent = a;
+
+		nodes[a].Box = Merge(nodes[other].Box, nodes[shorter].Box);
+		nodes[a].Height = 1 + max(nodes[other].Height, nodes[shorter].Height);
+		nodes[child].Box = Merge(nodes[a].Box, nodes[taller].Box);
+		nodes[child].Height = 1 + max(nodes[a].Height, nodes[taller].Height);
+		return child;
+	}
+};
+#endif
@@ -0,0 +1,70 @@
+#ifndef FRAME_DATA_H
+#define FRAME_DATA_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// binding point of the FrameData uniform block, Shader connects the block to it after linking
+const GLuint FRAME_DATA_BINDING = 0;
+
+// Everything the shaders need to know about the current frame. Mirrors the std140 block
+//
+//   layout (std140) uniform FrameData
+//   {
+//       mat4 view;
+//       mat4 projection;
+//       mat4 viewProjection;
+//       mat4 lightSpaceMatrix;
+//       vec3 cameraPos;
+//       float time;
+//       vec3 lightPos;
+//   };
+//
+// declared in the GLSL files under shaders/, so the member order must not change.
+struct FrameData
+{
+	glm::mat4 View;
+	glm::mat4 Projection;
+	glm::mat4 ViewProjection;
+	glm::mat4 LightSpaceMatrix;
+	glm::vec3 CameraPos;
+	float Time;      // packed into the last component of cameraPos' 16-byte slot
+	glm::vec3 LightPos;
+	float padding;
+};
+
+// The uniform buffer holding FrameData, bound once to FRAME_DATA_BINDING and rewritten once per frame.
+class FrameDataBuffer
+{
+public:
+	FrameDataBuffer() : UBO(0)
+	{
+	}
+
+	void Create()
+	{
+		glGenBuffers(1, &UBO);
+		glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, UBO);
+	}
+
+	void Update(const FrameData &data)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameData), &data);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	void Destroy()
+	{
+		if (UBO)
+			glDeleteBuffers(1, &UBO);
+		UBO = 0;
+	}
+
+private:
+	unsigned int UBO;
+};
+#endif
@@ -0,0 +1,91 @@
+#ifndef GEOMETRY_REGISTRY_H
+#define GEOMETRY_REGISTRY_H
+
+#include <map>
+#include <cstddef>
+#include <cstdint>
+using namespace std;
+
+// 64-bit FNV-1a, used to identify asset files and mesh contents by their bytes
+inline uint64_t hashBytes(const void *data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// GPU buffers holding the vertices and indices of one mesh
+struct SharedGeometry {
+	unsigned int VAO, VBO, EBO;
+	size_t vertexCount, indexCount;
+	// size of the vertex and index buffers on the GPU
+	size_t bytes;
+};
+
+// Keeps track of the geometry that has been uploaded so far, keyed by a hash of its contents.
+// Meshes with byte-identical vertices and indices (e.g. the planet spheres, which are all the
+// same OBJ with a different texture) find the existing buffers here and share them.
+class GeometryRegistry
+{
+public:
+	GeometryRegistry() : shared(0), uploadedBytes(0)
+	{
+	}
+
+	static uint64_t Key(const void *vertexData, size_t vertexBytes, const void *indexData, size_t indexBytes)
+	{
+		return hashBytes(indexData, indexBytes, hashBytes(vertexData, vertexBytes));
+	}
+
+	// looks up geometry with the given key and size, counts a hit as one upload saved
+	bool Find(uint64_t key, size_t vertexCount, size_t indexCount, SharedGeometry &geometry)
+	{
+		map<uint64_t, SharedGeometry>::const_iterator it = geometries.find(key);
+		if (it == geometries.end() || it->second.vertexCount != vertexCount || it->second.indexCount != indexCount)
+			return false;
+		geometry = it->second;
+		shared++;
+		return true;
+	}
+
+	void Add(uint64_t key, const SharedGeometry &geometry)
+	{
+		geometries[key] = geometry;
+		uploadedBytes += geometry.bytes;
+	}
+
+	// number of distinct geometries uploaded
+	size_t UniqueCount() const
+	{
+		return geometries.size();
+	}
+
+	// number of meshes that reused buffers instead of uploading their own
+	size_t SharedCount() const
+	{
+		return shared;
+	}
+
+	// bytes of vertex and index data uploaded over all distinct geometries
+	size_t UploadedBytes() const
+	{
+		return uploadedBytes;
+	}
+
+private:
+	map<uint64_t, SharedGeometry> geometries;
+	size_t shared;
+	size_t uploadedBytes;
+};
+
+// the registry of the GL context
+inline GeometryRegistry &geometryRegistry()
+{
+	static GeometryRegistry registry;
+	return registry;
+}
+#endif
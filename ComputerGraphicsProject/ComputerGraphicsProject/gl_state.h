@@ -0,0 +1,193 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+#include "render_stats.h"
+
+// Shadow copy of the GL binding state the render loop touches. Every bind goes through here and
+// is only passed on to the driver when it changes something; RenderStats counts both outcomes.
+//
+// The cache only knows about state set through it. Code that binds directly (buffer setup while
+// loading, the texture loader, ...) has to be followed by Invalidate(), which makes the next call
+// of every kind go through again.
+class GLStateCache
+{
+public:
+	static const unsigned int MAX_TEXTURE_UNITS = 16;
+
+	GLStateCache()
+	{
+		Invalidate();
+	}
+
+	// forgets everything, the next call of each kind is issued unconditionally
+	void Invalidate()
+	{
+		program = UNKNOWN;
+		vertexArray = UNKNOWN;
+		framebuffer = UNKNOWN;
+		activeUnit = UNKNOWN;
+		for (unsigned int i = 0; i < MAX_TEXTURE_UNITS; i++)
+			for (unsigned int j = 0; j < TARGET_COUNT; j++)
+				textures[i][j] = UNKNOWN;
+		depthTest = blend = UNKNOWN;
+		depthFunc = UNKNOWN;
+		depthMask = UNKNOWN;
+		stencilMask = UNKNOWN;
+		blendSrcRGB = blendDstRGB = blendSrcAlpha = blendDstAlpha = UNKNOWN;
+	}
+
+	void UseProgram(GLuint id)
+	{
+		if (changed(program, id))
+			glUseProgram(id);
+	}
+
+	void BindVertexArray(GLuint id)
+	{
+		if (changed(vertexArray, id))
+			glBindVertexArray(id);
+	}
+
+	void BindFramebuffer(GLuint id)
+	{
+		if (changed(framebuffer, id))
+			glBindFramebuffer(GL_FRAMEBUFFER, id);
+	}
+
+	void ActiveTexture(unsigned int unit)
+	{
+		if (changed(activeUnit, unit))
+			glActiveTexture(GL_TEXTURE0 + unit);
+	}
+
+	// binds a texture to the given unit, only switching the active unit if the binding changes
+	void BindTexture(unsigned int unit, GLenum target, GLuint id)
+	{
+		if (unit >= MAX_TEXTURE_UNITS || targetIndex(target) == TARGET_COUNT)
+		{
+			// not tracked, always pass it on
+			ActiveTexture(unit);
+			glBindTexture(target, id);
+			renderStats().StateChangesIssued++;
+			return;
+		}
+		if (!changed(textures[unit][targetIndex(target)], id))
+			return;
+		ActiveTexture(unit);
+		glBindTexture(target, id);
+	}
+
+	void SetDepthTest(bool enabled)
+	{
+		if (!changed(depthTest, enabled ? 1u : 0u))
+			return;
+		if (enabled)
+			glEnable(GL_DEPTH_TEST);
+		else
+			glDisable(GL_DEPTH_TEST);
+	}
+
+	void DepthFunc(GLenum func)
+	{
+		if (changed(depthFunc, func))
+			glDepthFunc(func);
+	}
+
+	void DepthMask(bool write)
+	{
+		if (changed(depthMask, write ? 1u : 0u))
+			glDepthMask(write ? GL_TRUE : GL_FALSE);
+	}
+
+	void StencilMask(GLuint mask)
+	{
+		if (changed(stencilMask, mask))
+			glStencilMask(mask);
+	}
+
+	void SetBlend(bool enabled)
+	{
+		if (!changed(blend, enabled ? 1u : 0u))
+			return;
+		if (enabled)
+			glEnable(GL_BLEND);
+		else
+			glDisable(GL_BLEND);
+	}
+
+	// sets the same factors for color and alpha, replacing whatever BlendFuncSeparate() set
+	void BlendFunc(GLenum src, GLenum dst)
+	{
+		if (!blendFuncChanged(src, dst, src, dst))
+			return;
+		glBlendFunc(src, dst);
+	}
+
+	void BlendFuncSeparate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha)
+	{
+		if (!blendFuncChanged(srcRGB, dstRGB, srcAlpha, dstAlpha))
+			return;
+		glBlendFuncSeparate(srcRGB, dstRGB, srcAlpha, dstAlpha);
+	}
+
+private:
+	// value no real binding can have, so the first call after Invalidate() always goes through
+	static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+	enum TextureTarget { TARGET_2D, TARGET_CUBE_MAP, TARGET_2D_ARRAY, TARGET_COUNT };
+
+	GLuint program, vertexArray, framebuffer, activeUnit;
+	GLuint textures[MAX_TEXTURE_UNITS][TARGET_COUNT];
+	GLuint depthTest, blend, depthFunc, depthMask, stencilMask;
+	GLuint blendSrcRGB, blendDstRGB, blendSrcAlpha, blendDstAlpha;
+
+	static unsigned int targetIndex(GLenum target)
+	{
+		if (target == GL_TEXTURE_2D)
+			return TARGET_2D;
+		if (target == GL_TEXTURE_CUBE_MAP)
+			return TARGET_CUBE_MAP;
+		if (target == GL_TEXTURE_2D_ARRAY)
+			return TARGET_2D_ARRAY;
+		return TARGET_COUNT;
+	}
+
+	// records the new value and tells whether the call has to be issued
+	static bool changed(GLuint &current, GLuint value)
+	{
+		if (current == value)
+		{
+			renderStats().StateChangesSkipped++;
+			return false;
+		}
+		current = value;
+		renderStats().StateChangesIssued++;
+		return true;
+	}
+
+	// the four blend factors are one piece of state, glBlendFunc sets them all as well
+	bool blendFuncChanged(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha)
+	{
+		if (blendSrcRGB == srcRGB && blendDstRGB == dstRGB && blendSrcAlpha == srcAlpha && blendDstAlpha == dstAlpha)
+		{
+			renderStats().StateChangesSkipped++;
+			return false;
+		}
+		blendSrcRGB = srcRGB;
+		blendDstRGB = dstRGB;
+		blendSrcAlpha = srcAlpha;
+		blendDstAlpha = dstAlpha;
+		renderStats().StateChangesIssued++;
+		return true;
+	}
+};
+
+// the one state cache of the GL context
+inline GLStateCache &glState()
+{
+	static GLStateCache state;
+	return state;
+}
+#endif
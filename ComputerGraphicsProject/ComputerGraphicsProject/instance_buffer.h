@@ -0,0 +1,91 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstddef>
+using namespace std;
+
+// per-instance attributes of the instanced shaders:
+//   layout (location = 5) in mat4 aInstanceModel;   (takes locations 5 to 8)
+//   layout (location = 9) in float aInstanceOffset;
+//   layout (location = 10) in float aInstanceLayer;
+struct InstanceData {
+	glm::mat4 Model;
+	// explode distance, ignored by shaders that don't explode
+	float Offset;
+	// texture array layer, ignored by shaders that don't sample an array
+	float Layer;
+};
+
+const unsigned int INSTANCE_ATTRIBUTE_FIRST = 5;
+const unsigned int INSTANCE_ATTRIBUTE_COUNT = 6;
+
+// Vertex buffer of per-instance data, rewritten every frame. Meshes attach it to their vertex
+// array for the duration of an instanced draw (see Mesh::DrawInstanced).
+class InstanceBuffer
+{
+public:
+	InstanceBuffer() : VBO(0), count(0)
+	{
+	}
+
+	// replaces the instances; the old store is orphaned so the GPU can keep reading it for frames in flight
+	void Upload(const vector<InstanceData> &instances)
+	{
+		if (!VBO)
+			glGenBuffers(1, &VBO);
+		count = (unsigned int)instances.size();
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+		if (count > 0)
+			glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(InstanceData), &instances[0]);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	unsigned int Count() const
+	{
+		return count;
+	}
+
+	// points the instance attributes of the currently bound vertex array at this buffer
+	void EnableAttributes() const
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		for (unsigned int i = 0; i < 4; i++)
+		{
+			glEnableVertexAttribArray(INSTANCE_ATTRIBUTE_FIRST + i);
+			glVertexAttribPointer(INSTANCE_ATTRIBUTE_FIRST + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offsetof(InstanceData, Model) + i * sizeof(glm::vec4)));
+			glVertexAttribDivisor(INSTANCE_ATTRIBUTE_FIRST + i, 1);
+		}
+		glEnableVertexAttribArray(INSTANCE_ATTRIBUTE_FIRST + 4);
+		glVertexAttribPointer(INSTANCE_ATTRIBUTE_FIRST + 4, 1, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)offsetof(InstanceData, Offset));
+		glVertexAttribDivisor(INSTANCE_ATTRIBUTE_FIRST + 4, 1);
+		glEnableVertexAttribArray(INSTANCE_ATTRIBUTE_FIRST + 5);
+		glVertexAttribPointer(INSTANCE_ATTRIBUTE_FIRST + 5, 1, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)offsetof(InstanceData, Layer));
+		glVertexAttribDivisor(INSTANCE_ATTRIBUTE_FIRST + 5, 1);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// detaches the instance attributes again, so regular draws of the vertex array don't see them
+	void DisableAttributes() const
+	{
+		for (unsigned int i = 0; i < INSTANCE_ATTRIBUTE_COUNT; i++)
+			glDisableVertexAttribArray(INSTANCE_ATTRIBUTE_FIRST + i);
+	}
+
+	void Destroy()
+	{
+		if (VBO)
+			glDeleteBuffers(1, &VBO);
+		VBO = 0;
+		count = 0;
+	}
+
+private:
+	unsigned int VBO;
+	unsigned int count;
+};
+#endif
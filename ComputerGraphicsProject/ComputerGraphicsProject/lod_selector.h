@@ -0,0 +1,71 @@
+#ifndef LOD_SELECTOR_H
+#define LOD_SELECTOR_H
+
+#include <glm/glm.hpp>
+
+#include "model.h"
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+// pixels one world unit covers at a distance of one unit in front of a perspective camera with the
+// vertical field of view fovY (in radians) on a viewport viewportHeight pixels high
+inline float lodProjectionScale(float fovY, float viewportHeight)
+{
+	return viewportHeight / (2.0f * tan(fovY * 0.5f));
+}
+
+// Picks the level of detail of one model, or of one group of instances drawn together, once per
+// frame: the coarsest level whose error (Model::LodError()) covers at most PixelError pixels on
+// screen. A level is only given up for a coarser one once that one stays below the threshold by the
+// Hysteresis share of it, so a model resting at a switching distance does not pop back and forth.
+class LodSelector
+{
+public:
+	// error in pixels the picked level may show
+	float PixelError;
+	// share of PixelError a coarser level has to stay below before it replaces the current one
+	float Hysteresis;
+
+	LodSelector(float pixelError = 1.0f, float hysteresis = 0.25f) : PixelError(pixelError), Hysteresis(hysteresis), level(0)
+	{
+	}
+
+	// pixelsPerUnit is how many pixels one model unit covers where the model comes closest to the
+	// camera, see PixelsPerUnit(); for a group of instances the largest of them
+	unsigned int Select(const Model &model, float pixelsPerUnit)
+	{
+		unsigned int count = model.LodCount();
+		level = min(level, count > 0 ? count - 1 : 0);
+		// finer right away once the current level shows
+		while (level > 0 && model.LodError(level) * pixelsPerUnit > PixelError)
+			level--;
+		while (level + 1 < count && model.LodError(level + 1) * pixelsPerUnit <= PixelError * (1.0f - Hysteresis))
+			level++;
+		return level;
+	}
+
+	unsigned int Level() const
+	{
+		return level;
+	}
+
+	// pixels one model unit covers on screen at the point of the model's bounding sphere closest to
+	// the camera; FLT_MAX with the camera inside the sphere, which always picks the full model
+	static float PixelsPerUnit(const Model &model, const glm::mat4 &transform, const glm::vec3 &cameraPosition, float projectionScale)
+	{
+		BoundingSphere sphere = model.Sphere().Transformed(transform);
+		if (sphere.IsEmpty())
+			return FLT_MAX;
+		float distance = glm::length(sphere.Center - cameraPosition) - sphere.Radius;
+		if (distance <= 0.0f)
+			return FLT_MAX;
+		float scale = sqrt(max(max(glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])), glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1]))), glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2]))));
+		return projectionScale * scale / distance;
+	}
+
+private:
+	unsigned int level;
+};
+#endif
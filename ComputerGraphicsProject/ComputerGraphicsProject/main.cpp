@@ -10,17 +10,28 @@
 #include "model.h"
 #include "ship.h"
 #include "particle_generator.h"
+#include "thread_pool.h"
+#include "texture_loader.h"
+#include "render_stats.h"
+#include "benchmark.h"
+#include "offscreen_context.h"
+#include "frame_data.h"
+#include "gl_state.h"
+#include "instance_buffer.h"
+#include "scene_graph.h"
+#include "collision.h"
+#include "lod_selector.h"
 
 #include <iostream>
+#include <vector>
+#include <algorithm>
 using namespace std;
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void mouse_callback(GLFWwindow *window, double xpos, double ypos);
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
-unsigned int loadTexture(const char *path);
-unsigned int loadCubemap(vector<std::string> faces);
-bool checkCollision(glm::vec3 position1, float size1, glm::vec3 position2, float size2);
+vector<glm::vec3> chestLayout(unsigned int count);
 
 // settings
 const unsigned int SCR_WIDTH = 1280;
@@ -38,42 +49,76 @@ float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
 unsigned int scene_number = 1;
-unsigned int chestOffset[6];
+vector<unsigned int> chestOffset;
 bool stencil = false;
 Ship ship(camera.Position + glm::vec3(0.0f, -0.8f, -1.0f));
 
-int main()
+int main(int argc, char *argv[])
 {
-	// glfw: initialize and configure
-	// ------------------------------
-	glfwInit();
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-	// glfw window creation
-	// --------------------
-	GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "ComputerGraphicsProject", NULL, NULL);
-	if (window == NULL)
+	BenchmarkOptions benchmark = parseBenchmarkOptions(argc, argv);
+	if (benchmark.SceneGraphBodies > 0)
+		return runSceneGraphBenchmark(benchmark.SceneGraphBodies, benchmark.Frames) ? 0 : -1;
+	if (benchmark.Particles > 0)
 	{
-		std::cout << "Failed to create GLFW window" << std::endl;
-		glfwTerminate();
-		return -1;
+		runParticleBenchmark(benchmark.Particles, benchmark.Frames);
+		runParticleAllocatorBenchmark(benchmark.Particles, benchmark.Frames);
+		runParticleRandomBenchmark(benchmark.Particles);
+		runParticleSortBenchmark(benchmark.Particles, benchmark.Frames);
+		return 0;
 	}
-	glfwMakeContextCurrent(window);
-	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-	glfwSetCursorPosCallback(window, mouse_callback);
-	glfwSetScrollCallback(window, scroll_callback);
-
-	// tell GLFW to capture our mouse
-	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+	if (benchmark.Colliders > 0)
+		return runCollisionBenchmark(benchmark.Colliders, benchmark.Frames) ? 0 : -1;
+	if (benchmark.Emitters > 0)
+	{
+		runParticleSystemBenchmark(benchmark.Emitters, benchmark.Frames);
+		return 0;
+	}
+	OffscreenContext offscreen;
+	GLFWwindow* window = NULL;
+	// framebuffer that stands for the screen: the window's default framebuffer or the offscreen one
+	unsigned int screenFBO = 0;
 
-	// glad: load all OpenGL function pointers
-	// ---------------------------------------
-	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+	if (benchmark.Enabled)
 	{
-		std::cout << "Failed to initialize GLAD" << std::endl;
-		return -1;
+		// headless: create a context without a window and render into an offscreen framebuffer
+		// -------------------------------------------------------------------------------------
+		if (!offscreen.Create(SCR_WIDTH, SCR_HEIGHT))
+			return -1;
+		screenFBO = offscreen.Framebuffer();
+	}
+	else
+	{
+		// glfw: initialize and configure
+		// ------------------------------
+		glfwInit();
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+		// glfw window creation
+		// --------------------
+		window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "ComputerGraphicsProject", NULL, NULL);
+		if (window == NULL)
+		{
+			std::cout << "Failed to create GLFW window" << std::endl;
+			glfwTerminate();
+			return -1;
+		}
+		glfwMakeContextCurrent(window);
+		glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+		glfwSetCursorPosCallback(window, mouse_callback);
+		glfwSetScrollCallback(window, scroll_callback);
+
+		// tell GLFW to capture our mouse
+		glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+
+		// glad: load all OpenGL function pointers
+		// ---------------------------------------
+		if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+		{
+			std::cout << "Failed to initialize GLAD" << std::endl;
+			return -1;
+		}
 	}
 
 	// configure global opengl state
@@ -90,15 +135,24 @@ int main()
 	Shader scenery_shader("shaders/skybox.vs", "shaders/skybox.fs");
 
 	Shader aircraft_env_shader("shaders/model_environment.vs", "shaders/model_environment.fs");
-	Shader chest_shader("shaders/model_texture.vs", "shaders/model_texture.fs");
+	Shader chest_shader("shaders/model_texture_instanced.vs", "shaders/model_texture.fs");
 	Shader cloud_shader("shaders/skybox.vs", "shaders/skybox.fs");
-	Shader explode_shader("shaders/explode.vs", "shaders/explode.fs", "shaders/explode.gs");
+	Shader explode_shader("shaders/explode_instanced.vs", "shaders/explode.fs", "shaders/explode_instanced.gs");
 	Shader stencil_shader("shaders/stencil.vs", "shaders/stencil.fs");
 
 	Shader shader("shaders/model_texture.vs", "shaders/model_texture.fs");
 	Shader galaxy_shader("shaders/skybox.vs", "shaders/skybox.fs");
+	Shader planet_shader("shaders/planet.vs", "shaders/planet.fs");
 	Shader particle_shader("shaders/particle.vs", "shaders/particle.fs");
 
+	// model matrices are set every frame, resolve their locations once
+	UniformHandle<glm::mat4> aircraftShaderModel = aircraft_shader.Uniform<glm::mat4>("model");
+	UniformHandle<glm::mat4> shadowShaderModel = shadow_shader.Uniform<glm::mat4>("model");
+	UniformHandle<glm::mat4> depthShaderModel = depth_shader.Uniform<glm::mat4>("model");
+	UniformHandle<glm::mat4> aircraftEnvShaderModel = aircraft_env_shader.Uniform<glm::mat4>("model");
+	UniformHandle<glm::mat4> stencilShaderModel = stencil_shader.Uniform<glm::mat4>("model");
+	UniformHandle<glm::mat4> shaderModel = shader.Uniform<glm::mat4>("model");
+
 	// shader configuration
 	// --------------------
 	shadow_shader.use();
@@ -120,28 +174,87 @@ int main()
 	galaxy_shader.use();
 	galaxy_shader.setInt("skybox", 0);
 
+	planet_shader.use();
+	planet_shader.setInt("planetTextures", 0);
+
 	// load models
 	// -----------
-	Model aircraft("objects/E-45-Aircraft/E 45 Aircraft_obj.obj");
-	Model chest("objects/Pirate_A_Chest_A/Pirate_A_Chest_A.FBX");
-	Model earth("objects/earth/earth.obj");
-	Model moon("objects//.obj");
-	Model star1("objects/̫/̫.obj");
-	Model star2("objects/ˮ/ˮ.obj");
-	Model star3("objects//.obj");
-	Model star4("objects//.obj");
-	Model star5("objects/ľ/ľ.obj");
-	Model star6("objects//.obj");
-	Model star7("objects//.obj");
-	Model star8("objects//.obj");
-
-	float aircraftSize = aircraft.getCubeBoundingBox();
-	float chestSize = chest.getCubeBoundingBox();
+	// the textures of every model and skybox are decoded in parallel and uploaded in one go further down
+	ThreadPool workers;
+	TextureLoader textureLoader(workers);
+	if (benchmark.PackedVertices)
+		meshVertexFormat() = VERTEX_PACKED;
+	// only the aircraft and the chests take part in collision tests, the mesh query benchmark
+	// additionally rebuilds the aircraft's BVHs from its vertices
+	Model aircraft("objects/E-45-Aircraft/E 45 Aircraft_obj.obj", false, &textureLoader, true, benchmark.MeshQueries > 0 ? RETAIN_ALL : RETAIN_COLLISION);
+	Model chest("objects/Pirate_A_Chest_A/Pirate_A_Chest_A.FBX", false, &textureLoader, true, RETAIN_COLLISION);
+	if (benchmark.MeshQueries > 0)
+		return runMeshQueryBenchmark(aircraft, chest, benchmark.MeshQueries) ? 0 : -1;
+	Model earth("objects/earth/earth.obj", false, &textureLoader, false);
+	Model moon("objects//.obj", false, &textureLoader, false);
+	Model star1("objects/̫/̫.obj", false, &textureLoader, false);
+	Model star2("objects/ˮ/ˮ.obj", false, &textureLoader, false);
+	Model star3("objects//.obj", false, &textureLoader, false);
+	Model star4("objects//.obj", false, &textureLoader, false);
+	Model star5("objects/ľ/ľ.obj", false, &textureLoader, false);
+	Model star6("objects//.obj", false, &textureLoader, false);
+	Model star7("objects//.obj", false, &textureLoader, false);
+	Model star8("objects//.obj", false, &textureLoader, false);
+
+	if (benchmark.Enabled)
+	{
+		cout << "geometry: " << geometryRegistry().UniqueCount() << " buffers, " << geometryRegistry().UploadedBytes() / 1024 << " KiB of vertices and indices" << endl;
+		const Model *loaded[] = { &aircraft, &chest, &earth, &moon, &star1, &star2, &star3, &star4, &star5, &star6, &star7, &star8 };
+		const char *names[] = { "aircraft", "chest", "earth", "moon", "star1", "star2", "star3", "star4", "star5", "star6", "star7", "star8" };
+		printModelMemory(names, loaded, sizeof(loaded) / sizeof(loaded[0]));
+	}
+
+	// the planets are the same sphere with different textures: identical meshes share their buffers
+	// (see GeometryRegistry), and the textures become the layers of one array so that every group of
+	// planets drawing from the same buffers is a single instanced draw call
+	Model *planets[] = { &star1, &star2, &star3, &earth, &moon, &star4, &star5, &star6, &star7, &star8 };
+	const unsigned int PLANET_COUNT = sizeof(planets) / sizeof(planets[0]);
+	vector<string> planetTexturePaths;
+	for (unsigned int i = 0; i < PLANET_COUNT; i++)
+	{
+		const Model &planet = *planets[i];
+		planetTexturePaths.push_back(planet.textures_loaded.empty() ? string() : planet.directory + '/' + planet.textures_loaded[0].path);
+	}
+	unsigned int planetTextures = textureLoader.LoadArray(planetTexturePaths, 512, 256);
+	vector<vector<unsigned int> > planetGroups;
+	for (unsigned int i = 0; i < PLANET_COUNT; i++)
+	{
+		unsigned int group = 0;
+		while (group < planetGroups.size() && !planets[planetGroups[group][0]]->SharesGeometryWith(*planets[i]))
+			group++;
+		if (group == planetGroups.size())
+			planetGroups.push_back(vector<unsigned int>());
+		planetGroups[group].push_back(i);
+	}
+	vector<InstanceBuffer> planetInstances(planetGroups.size());
+	vector<InstanceData> planetInstanceData;
+	planetInstanceData.reserve(PLANET_COUNT);
+
+	// the orbit chain of the solar system, one node per planet in the order of planets[]: the sun
+	// turns in place, the moon orbits the earth and everything else orbits the sun
+	SceneGraph solarSystem;
+	solarSystem.Reserve(PLANET_COUNT);
+	int sun = solarSystem.AddNode(SceneGraph::NO_PARENT, OrbitMotion(glm::vec3(0.0f, 1.0f, 0.0f), 0.1f, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f), 0.0f));
+	solarSystem.AddNode(sun, OrbitMotion(glm::vec3(1.0f, 1.0f, 0.0f), 1.0f, glm::vec3(0.0f, 0.0f, -6.0f), glm::vec3(0.0f, 1.0f, 1.0f), 2.0f));
+	solarSystem.AddNode(sun, OrbitMotion(glm::vec3(0.5f, 1.0f, 0.5f), 0.9f, glm::vec3(0.0f, 0.0f, -12.0f), glm::vec3(1.0f, 1.0f, 0.0f), 2.5f));
+	int earthNode = solarSystem.AddNode(sun, OrbitMotion(glm::vec3(0.5f, 1.0f, 0.0f), 0.8f, glm::vec3(0.0f, -0.5f, -20.0f), glm::vec3(0.0f, 1.0f, 0.5f), 0.5f));
+	solarSystem.AddNode(earthNode, OrbitMotion(glm::vec3(0.0f, 0.8f, 0.3f), 2.0f, glm::vec3(0.0f, 0.0f, -4.0f), glm::vec3(0.7f, 0.3f, 0.0f), 1.0f));
+	solarSystem.AddNode(sun, OrbitMotion(glm::vec3(1.0f, 1.0f, 1.0f), 0.6f, glm::vec3(0.0f, 0.0f, -30.0f), glm::vec3(0.0f, 1.0f, 0.2f), 3.5f));
+	solarSystem.AddNode(sun, OrbitMotion(glm::vec3(0.5f, 1.4f, 0.3f), 0.5f, glm::vec3(0.0f, 0.0f, -38.0f), glm::vec3(0.0f, 1.0f, 0.2f), 4.0f));
+	solarSystem.AddNode(sun, OrbitMotion(glm::vec3(0.8f, 1.4f, 0.6f), 0.6f, glm::vec3(0.0f, 0.0f, -50.0f), glm::vec3(0.0f, 1.0f, 0.8f), 3.0f));
+	solarSystem.AddNode(sun, OrbitMotion(glm::vec3(0.2f, 1.0f, 2.0f), 0.7f, glm::vec3(0.0f, 0.0f, -60.0f), glm::vec3(0.0f, 1.0f, 0.1f), 2.0f));
+	solarSystem.AddNode(sun, OrbitMotion(glm::vec3(0.3f, 0.3f, 0.3f), 0.7f, glm::vec3(0.0f, 0.0f, -75.0f), glm::vec3(0.0f, 1.0f, 0.5f), 1.0f));
+
 
 	// load textures
 	// -------------
-	unsigned int diffuseMap = loadTexture("textures/grass.jpg");
-	unsigned int particle_texture = loadTexture("textures/particle.png");
+	unsigned int diffuseMap = textureLoader.Load2D("textures/grass.jpg");
+	unsigned int particle_texture = textureLoader.Load2D("textures/particle.png");
 
 	vector<std::string> scenery_faces
 	{
@@ -152,7 +265,7 @@ int main()
 		"textures/lake/back.jpg",
 		"textures/lake/front.jpg"
 	};
-	unsigned int sceneryTexture = loadCubemap(scenery_faces);
+	unsigned int sceneryTexture = textureLoader.LoadCubemap(scenery_faces);
 
 	vector<std::string> cloud_faces
 	{
@@ -163,7 +276,7 @@ int main()
 		"textures/cloud/back.jpg",
 		"textures/cloud/front.jpg"
 	};
-	unsigned int cloudTexture = loadCubemap(cloud_faces);
+	unsigned int cloudTexture = textureLoader.LoadCubemap(cloud_faces);
 
 	vector<std::string> galaxy_faces
 	{
@@ -174,7 +287,10 @@ int main()
 		"textures/ame_nebula/purplenebula_ft.tga",
 		"textures/ame_nebula/purplenebula_bk.tga"
 	};
-	unsigned int galaxyTexture = loadCubemap(galaxy_faces);
+	unsigned int galaxyTexture = textureLoader.LoadCubemap(galaxy_faces);
+
+	// wait for the decodes and upload them
+	textureLoader.Finish();
 
 	// congifure skybox vertices
 	// -------------------------
@@ -278,39 +394,173 @@ int main()
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
 	glDrawBuffer(GL_NONE);
 	glReadBuffer(GL_NONE);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, screenFBO);
 
 	// particle system
 	// ---------------
-	ParticleGenerator *generator = new ParticleGenerator(100);
+	// --gpu-particles N moves the simulation onto the GPU, spawning enough to keep N particles alive
+	ParticleGenerator *generator;
+	if (benchmark.GpuParticles > 0)
+		generator = new ParticleGenerator(benchmark.GpuParticles, benchmark.GpuParticles * 1.2f, 1);
+	else
+	{
+		generator = new ParticleGenerator(&workers);
+		// sparks all over the screen
+		generator->AddEmitter(EmitterSettings(), 100, 1);
+
+		// fountain rising from the bottom of the screen, shrinking and fading out as it falls
+		EmitterSettings fountain;
+		fountain.Shape = EMITTER_POINT;
+		fountain.Position = glm::vec3(-0.6f, -0.9f, 0.0f);
+		fountain.Rate = 200.0f;
+		fountain.VelocityMin = glm::vec3(-0.25f, 1.2f, 0.0f);
+		fountain.VelocityMax = glm::vec3(0.25f, 1.8f, 0.0f);
+		fountain.LifetimeMin = 1.5f;
+		fountain.LifetimeMax = 2.0f;
+		fountain.ColorMin = glm::vec4(0.8f, 0.4f, 0.0f, 1.0f);
+		fountain.ColorMax = glm::vec4(1.0f, 0.8f, 0.2f, 1.0f);
+		fountain.SizeEnd = 0.0f;
+		fountain.AlphaEnd = 0.0f;
+		fountain.Forces[0] = ForceField::Constant(glm::vec3(0.0f, -1.0f, 0.0f));
+		generator->AddEmitter(fountain, 512, 2);
+
+		// cloud swirling around a point, held together by an attractor and slowed down by drag
+		EmitterSettings swirl;
+		swirl.Shape = EMITTER_SPHERE;
+		swirl.Position = glm::vec3(0.6f, 0.5f, 0.0f);
+		swirl.Extent = glm::vec3(0.15f);
+		swirl.VelocityMin = glm::vec3(-0.5f);
+		swirl.VelocityMax = glm::vec3(0.5f);
+		swirl.LifetimeMin = 2.0f;
+		swirl.LifetimeMax = 3.0f;
+		swirl.ColorMin = glm::vec4(0.1f, 0.3f, 0.8f, 1.0f);
+		swirl.ColorMax = glm::vec4(0.4f, 0.7f, 1.0f, 1.0f);
+		swirl.SizeEnd = 0.02f;
+		swirl.AlphaEnd = 0.2f;
+		swirl.Forces.clear();
+		swirl.Forces.push_back(ForceField::Attractor(swirl.Position, 4.0f));
+		swirl.Forces.push_back(ForceField::Drag(0.5f));
+		generator->AddEmitter(swirl, 400, 3);
+	}
+	generator->SetTarget(screenFBO, SCR_WIDTH, SCR_HEIGHT);
+	if (benchmark.ParticleBlend == "sorted")
+		generator->SetBlendMode(PARTICLE_SORTED);
+	else if (benchmark.ParticleBlend == "oit")
+		generator->SetBlendMode(PARTICLE_WEIGHTED_OIT);
+	else if (benchmark.ParticleBlend != "additive")
+		cout << "WARNING::PARTICLE:: unknown blend mode " << benchmark.ParticleBlend << ", using additive" << endl;
 
 	// light position
 	glm::vec3 lightPos(5.0f, 5.0f, 0.0f);
 	// chest position
-	glm::vec3 chestPositions[] = {
-		glm::vec3(0.0f, 0.0f, -5.0f),
-		glm::vec3(5.0f, 0.0f, -3.0f),
-		glm::vec3(5.0f, 0.0f, 3.0f),
-		glm::vec3(0.0f, 0.0f, 5.0f),
-		glm::vec3(-5.0f, 0.0f, 3.0f),
-		glm::vec3(-5.0f, 0.0f, -3.0f)
-	};
+	vector<glm::vec3> chestPositions = chestLayout(benchmark.Chests);
 	// chest offset
-	memset(chestOffset, 0, sizeof(chestOffset));
+	chestOffset.assign(chestPositions.size(), 0);
+	// every chest shares the same orientation, only the translation differs
+	glm::mat4 chestRotation = glm::mat4(1.0f);
+	chestRotation = glm::rotate(chestRotation, glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	chestRotation = glm::rotate(chestRotation, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+	chestRotation = glm::scale(chestRotation, glm::vec3(0.01f));
+	// broad phase of scene 2: one collider per chest, moved with the bobbing, queried with the aircraft
+	AABBTree chestColliders;
+	vector<int> chestProxies(chestPositions.size());
+	vector<char> chestHit(chestPositions.size());
+	AABB chestBox = chest.Bounds().Transformed(chestRotation);
+	for (unsigned int i = 0; i < chestPositions.size(); i++)
+		chestProxies[i] = chestColliders.CreateProxy(AABB(chestBox.Min + chestPositions[i], chestBox.Max + chestPositions[i]), i);
+	glm::vec3 lastBob(0.0f);
+	// per-instance data of the intact and the exploding chests, rebuilt every frame
+	vector<InstanceData> intactChestData, explodingChestData;
+	intactChestData.reserve(chestPositions.size());
+	explodingChestData.reserve(chestPositions.size());
+	InstanceBuffer intactChests, explodingChests;
+
+	// per-frame uniforms shared by every shader
+	// -----------------------------------------
+	FrameDataBuffer frameUniforms;
+	frameUniforms.Create();
+
+	// everything from here on binds through the state cache, forget what loading left bound
+	glState().Invalidate();
+
+	if (benchmark.LodSweep > 0)
+	{
+		glState().BindFramebuffer(screenFBO);
+		bool stable = runLodSweepBenchmark("aircraft", aircraft, 0.2f, shader, frameUniforms, SCR_WIDTH, SCR_HEIGHT, benchmark.LodSweep, benchmark.Frames);
+		stable = runLodSweepBenchmark("earth", earth, 1.0f, shader, frameUniforms, SCR_WIDTH, SCR_HEIGHT, benchmark.LodSweep, benchmark.Frames) && stable;
+		return stable ? 0 : -1;
+	}
+
+	// levels of detail: one selector per model or group of instances drawn together, so each keeps
+	// its own hysteresis
+	LodSelector aircraftLod, chestLod;
+	vector<LodSelector> planetLods(planetGroups.size());
+
+	// the model draw path has to stay free of heap allocations, check it once before benchmarking
+	// -------------------------------------------------------------------------------------------
+	bool drawPathClean = true;
+	if (benchmark.Enabled)
+	{
+		Model *models[] = { &aircraft, &chest, &earth, &moon, &star1, &star2, &star3, &star4, &star5, &star6, &star7, &star8 };
+		shader.use();
+		drawPathClean = checkNoAllocations("Model::Draw", [&]() {
+			for (unsigned int i = 0; i < sizeof(models) / sizeof(models[0]); i++)
+				models[i]->Draw(shader);
+		});
+	}
 
 	// render loop
 	// -----------
-	while (!glfwWindowShouldClose(window))
+	BenchmarkRunner runner(benchmark);
+	while (benchmark.Enabled ? runner.Advance() : !glfwWindowShouldClose(window))
 	{
 		// per-frame time logic
 		// --------------------
-		float currentFrame = glfwGetTime();
-		deltaTime = currentFrame - lastFrame;
+		float currentFrame;
+		if (benchmark.Enabled)
+		{
+			// fixed time step so every run renders exactly the same frames
+			currentFrame = runner.Time();
+			deltaTime = runner.DeltaTime();
+		}
+		else
+		{
+			currentFrame = glfwGetTime();
+			deltaTime = currentFrame - lastFrame;
+		}
 		lastFrame = currentFrame;
 
 		// input
 		// -----
-		processInput(window);
+		if (benchmark.Enabled)
+		{
+			// scripted input: switch scenes and follow the camera path
+			if (runner.SceneStarted())
+			{
+				scene_number = runner.Scene();
+				fill(chestOffset.begin(), chestOffset.end(), 0);
+			}
+			applyCameraPath(camera, scene_number, currentFrame);
+			runner.BeginFrame();
+		}
+		else
+			processInput(window);
+
+		// update the per-frame uniform block
+		// ----------------------------------
+		FrameData frameData;
+		frameData.View = camera.GetViewMatrix();
+		frameData.Projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+		frameData.ViewProjection = frameData.Projection * frameData.View;
+		float projectionScale = lodProjectionScale(glm::radians(camera.Zoom), (float)SCR_HEIGHT);
+		glm::mat4 lightProjection = glm::perspective(glm::radians(45.0f), (GLfloat)SHADOW_WIDTH / (GLfloat)SHADOW_HEIGHT, 0.1f, 100.0f);
+		glm::mat4 lightView = glm::lookAt(lightPos, glm::vec3(0.0f), glm::vec3(0.0, 1.0, 0.0));
+		frameData.LightSpaceMatrix = lightProjection * lightView;
+		frameData.CameraPos = camera.Position;
+		frameData.Time = currentFrame;
+		frameData.LightPos = lightPos;
+		frameData.padding = 0.0f;
+		frameUniforms.Update(frameData);
 
 		// render
 		// ------
@@ -323,19 +573,11 @@ int main()
 		{
 			// disable stencil writing
 			// -----------------------
-			glStencilMask(0x00);
+			glState().StencilMask(0x00);
 
-			// set model, projection, view and lightSpaceMatrix matrices
-			// ---------------------------------------------------------
+			// set model matrices (view, projection and lightSpaceMatrix live in the FrameData block)
+			// -------------------------------------------------------------------------------------
 			glm::mat4 model;
-			glm::mat4 view = camera.GetViewMatrix();
-			glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-
-			glm::mat4 lightProjection, lightView;
-			glm::mat4 lightSpaceMatrix;
-			lightProjection = glm::perspective(glm::radians(45.0f), (GLfloat)SHADOW_WIDTH / (GLfloat)SHADOW_HEIGHT, 0.1f, 100.0f);
-			lightView = glm::lookAt(lightPos, glm::vec3(0.0f), glm::vec3(0.0, 1.0, 0.0));
-			lightSpaceMatrix = lightProjection * lightView;
 
 			// configure uniform variables
 			// ---------------------------
@@ -343,193 +585,164 @@ int main()
 			model = glm::mat4(1.0f);
 			model = glm::rotate(model, glm::radians(-30.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 			model = glm::scale(model, glm::vec3(0.2f));
-			aircraft_shader.setMat4("model", model);
-			aircraft_shader.setMat4("view", view);
-			aircraft_shader.setMat4("projection", projection);
-			aircraft_shader.setVec3("viewPos", camera.Position);
-			aircraft_shader.setVec3("lightPos", lightPos);
+			aircraftShaderModel.Set(model);
+			unsigned int aircraftLevel = aircraftLod.Select(aircraft, LodSelector::PixelsPerUnit(aircraft, model, camera.Position, projectionScale));
 
 			shadow_shader.use();
 			model = glm::mat4(1.0f);
-			shadow_shader.setMat4("model", model);
-			shadow_shader.setMat4("view", view);
-			shadow_shader.setMat4("projection", projection);
-			shadow_shader.setVec3("viewPos", camera.Position);
-			shadow_shader.setVec3("lightPos", lightPos);
-			shadow_shader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
+			shadowShaderModel.Set(model);
 
 			depth_shader.use();
 			model = glm::mat4(1.0f);
-			depth_shader.setMat4("model", model);
-			depth_shader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
+			depthShaderModel.Set(model);
 
 			// render depth of scene to texture from light's perspective
 			// ---------------------------------------------------------
 			glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-			glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+			glState().BindFramebuffer(depthMapFBO);
 			glClear(GL_DEPTH_BUFFER_BIT);
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, diffuseMap);
+			glState().BindTexture(0, GL_TEXTURE_2D, diffuseMap);
 			// draw plane
 			depth_shader.use();
-			glBindVertexArray(planeVAO);
+			glState().BindVertexArray(planeVAO);
 			glDrawArrays(GL_TRIANGLES, 0, 6);
+			renderStats().DrawCalls++;
 			// draw aircraft
 			aircraft_shader.use();
-			aircraft.Draw(aircraft_shader);
-			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			aircraft.Draw(aircraft_shader, aircraftLevel);
+			glState().BindFramebuffer(screenFBO);
 			// reset viewport
 			glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 			// render scene as normal using the generated depth map
 			// ----------------------------------------------------
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, diffuseMap);
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, depthMap);
+			glState().BindTexture(0, GL_TEXTURE_2D, diffuseMap);
+			glState().BindTexture(1, GL_TEXTURE_2D, depthMap);
 			// draw plane
 			shadow_shader.use();
-			glBindVertexArray(planeVAO);
+			glState().BindVertexArray(planeVAO);
 			glDrawArrays(GL_TRIANGLES, 0, 6);
-			glBindVertexArray(0);
+			renderStats().DrawCalls++;
 			// draw aircraft
 			aircraft_shader.use();
-			aircraft.Draw(aircraft_shader);
-			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			aircraft.Draw(aircraft_shader, aircraftLevel);
+			glState().BindFramebuffer(screenFBO);
 
 			// draw scenery skybox
 			// -------------------
-			glDepthFunc(GL_LEQUAL);
+			glState().DepthFunc(GL_LEQUAL);
 			scenery_shader.use();
-			view = glm::mat4(glm::mat3(camera.GetViewMatrix()));
-			scenery_shader.setMat4("view", view);
-			scenery_shader.setMat4("projection", projection);
-			glBindVertexArray(skyboxVAO);
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_CUBE_MAP, sceneryTexture);
+			glState().BindVertexArray(skyboxVAO);
+			glState().BindTexture(0, GL_TEXTURE_CUBE_MAP, sceneryTexture);
 			glDrawArrays(GL_TRIANGLES, 0, 36);
-			glBindVertexArray(0);
-			glDepthFunc(GL_LESS);
+			renderStats().DrawCalls++;
+			glState().DepthFunc(GL_LESS);
 			break;
 		}
 		case 2:
 		{
 			// disable stencil writing
 			// -----------------------
-			glStencilMask(0x00);
-
-			// configure view and projection matrices
-			// --------------------------------------
-			glm::mat4 model, view, projection;
-			view = camera.GetViewMatrix();
-			projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-
-			aircraft_env_shader.use();
-			aircraft_env_shader.setMat4("view", view);
-			aircraft_env_shader.setMat4("projection", projection);
+			glState().StencilMask(0x00);
 
-			chest_shader.use();
-			chest_shader.setMat4("view", view);
-			chest_shader.setMat4("projection", projection);
-
-			explode_shader.use();
-			explode_shader.setMat4("view", view);
-			explode_shader.setMat4("projection", projection);
-
-			cloud_shader.use();
-			cloud_shader.setMat4("projection", projection);
-
-			stencil_shader.use();
-			stencil_shader.setMat4("view", view);
-			stencil_shader.setMat4("projection", projection);
+			glm::mat4 model;
 
 			// set aircraft position
 			// ---------------------
 			glm::vec3 aircraftPosition = camera.Position + camera.Front * 2.0f + glm::vec3(0.0f, -0.5f, 0.0f);
+			glm::mat4 aircraftModel = glm::mat4(1.0f);
+			aircraftModel = glm::translate(aircraftModel, aircraftPosition);
+			aircraftModel = glm::rotate(aircraftModel, glm::radians(270.0f - camera.Yaw), glm::vec3(0.0f, 1.0f, 0.0f));
+			aircraftModel = glm::rotate(aircraftModel, glm::radians(camera.Pitch), glm::vec3(1.0f, 0.0f, 0.0f));
 
 			// draw chests
 			// -----------
-			for (unsigned int i = 0; i < 6; i++)
+			glm::vec3 bob = glm::vec3(0.0f, sin(currentFrame), 0.0f);
+
+			// check collision
+			for (unsigned int i = 0; i < chestPositions.size(); i++)
+				chestColliders.MoveProxy(chestProxies[i], AABB(chestBox.Min + chestPositions[i] + bob, chestBox.Max + chestPositions[i] + bob), bob - lastBob);
+			lastBob = bob;
+			fill(chestHit.begin(), chestHit.end(), 0);
+			glm::mat4 aircraftBody = glm::scale(aircraftModel, glm::vec3(0.2f));
+			chestColliders.Query(aircraft.Bounds().Transformed(aircraftBody), [&](unsigned int index) {
+				// narrow phase: only count the chest if the triangles really touch
+				if (chestOffset[index] > 0)
+					return;
+				glm::mat4 chestModel = glm::translate(glm::mat4(1.0f), chestPositions[index] + bob) * chestRotation;
+				chestHit[index] = aircraft.Intersects(chest, aircraftBody, chestModel);
+			});
+			intactChestData.clear();
+			explodingChestData.clear();
+			for (unsigned int i = 0; i < chestPositions.size(); i++)
 			{
-				if (chestOffset[i] < CHEST_MAX_OFFSET)
+				if (chestOffset[i] >= CHEST_MAX_OFFSET)
+					continue;
+				InstanceData instance;
+				instance.Model = glm::translate(glm::mat4(1.0f), chestPositions[i] + bob) * chestRotation;
+				instance.Offset = 0.0f;
+				instance.Layer = 0.0f;
+				if (chestHit[i] || chestOffset[i] > 0)
 				{
-					model = glm::mat4(1.0f);
-					model = glm::translate(model, chestPositions[i]);
-					model = glm::translate(model, glm::vec3(0.0f, sin(glfwGetTime()), 0.0f));
-					model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-					model = glm::rotate(model, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-					model = glm::scale(model, glm::vec3(0.01f));
-
-					// check collision
-					bool collision = checkCollision(aircraftPosition, aircraftSize * 0.2f, chestPositions[i], chestSize * 0.01f);
-					if (collision || chestOffset[i] > 0)
-					{
-						chestOffset[i]++;
-						float offset = (float)chestOffset[i] * 0.1f;
-						explode_shader.use();
-						explode_shader.setMat4("model", model);
-						explode_shader.setFloat("offset", offset);
-						chest.Draw(explode_shader);
-					}
-					else
-					{
-						chest_shader.use();
-						chest_shader.setMat4("model", model);
-						chest.Draw(chest_shader);
-					}
+					chestOffset[i]++;
+					instance.Offset = (float)chestOffset[i] * 0.1f;
+					explodingChestData.push_back(instance);
 				}
+				else
+					intactChestData.push_back(instance);
 			}
+			// one instanced draw per chest mesh for each group, all at the level the nearest chest needs
+			float chestPixels = 0.0f;
+			for (unsigned int i = 0; i < intactChestData.size(); i++)
+				chestPixels = max(chestPixels, LodSelector::PixelsPerUnit(chest, intactChestData[i].Model, camera.Position, projectionScale));
+			for (unsigned int i = 0; i < explodingChestData.size(); i++)
+				chestPixels = max(chestPixels, LodSelector::PixelsPerUnit(chest, explodingChestData[i].Model, camera.Position, projectionScale));
+			unsigned int chestLevel = chestLod.Select(chest, chestPixels);
+			intactChests.Upload(intactChestData);
+			explodingChests.Upload(explodingChestData);
+			chest_shader.use();
+			chest.DrawInstanced(chest_shader, intactChests, chestLevel);
+			explode_shader.use();
+			chest.DrawInstanced(explode_shader, explodingChests, chestLevel);
 
 			// draw cloud skybox
 			// -----------------
-			glDepthFunc(GL_LEQUAL);
+			glState().DepthFunc(GL_LEQUAL);
 			cloud_shader.use();
-			view = glm::mat4(glm::mat3(camera.GetViewMatrix()));
-			cloud_shader.setMat4("view", view);
-			glBindVertexArray(skyboxVAO);
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_CUBE_MAP, cloudTexture);
+			glState().BindVertexArray(skyboxVAO);
+			glState().BindTexture(0, GL_TEXTURE_CUBE_MAP, cloudTexture);
 			glDrawArrays(GL_TRIANGLES, 0, 36);
-			glBindVertexArray(0);
-			glDepthFunc(GL_LESS);
+			renderStats().DrawCalls++;
+			glState().DepthFunc(GL_LESS);
 
 			// draw aircraft and its outline
 			// -----------------------------
 			if (stencil)
 			{
 				glStencilFunc(GL_ALWAYS, 1, 0xFF);
-				glStencilMask(0xFF);
+				glState().StencilMask(0xFF);
 			}
 
 			// draw aircraft
+			unsigned int aircraftLevel = aircraftLod.Select(aircraft, LodSelector::PixelsPerUnit(aircraft, aircraftBody, camera.Position, projectionScale));
 			aircraft_env_shader.use();
-			model = glm::mat4(1.0f);
-			model = glm::translate(model, aircraftPosition);
-			model = glm::rotate(model, glm::radians(270.0f - camera.Yaw), glm::vec3(0.0f, 1.0f, 0.0f));
-			model = glm::rotate(model, glm::radians(camera.Pitch), glm::vec3(1.0f, 0.0f, 0.0f));
-			model = glm::scale(model, glm::vec3(0.2f));
-			aircraft_env_shader.setMat4("model", model);
-			aircraft_env_shader.setVec3("cameraPos", camera.Position);
-			aircraft.Draw(aircraft_env_shader);
+			aircraftEnvShaderModel.Set(aircraftBody);
+			aircraft.Draw(aircraft_env_shader, aircraftLevel);
 
 			if (stencil)
 			{
 				glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
-				glStencilMask(0x00);
+				glState().StencilMask(0x00);
 
 				// draw outline
-				glDisable(GL_DEPTH_TEST);
+				glState().SetDepthTest(false);
 				stencil_shader.use();
-				model = glm::mat4(1.0f);
-				model = glm::translate(model, aircraftPosition);
-				model = glm::rotate(model, glm::radians(270.0f - camera.Yaw), glm::vec3(0.0f, 1.0f, 0.0f));
-				model = glm::rotate(model, glm::radians(camera.Pitch), glm::vec3(1.0f, 0.0f, 0.0f));
-				model = glm::scale(model, glm::vec3(0.22f));
-				stencil_shader.setMat4("model", model);
-				aircraft.Draw(stencil_shader);
-				glStencilMask(0xFF);
-				glEnable(GL_DEPTH_TEST);
+				model = glm::scale(aircraftModel, glm::vec3(0.22f));
+				stencilShaderModel.Set(model);
+				aircraft.Draw(stencil_shader, aircraftLevel);
+				glState().StencilMask(0xFF);
+				glState().SetDepthTest(true);
 			}
 			break;
 		}
@@ -537,15 +750,12 @@ int main()
 		{
 			// disable stencil writing
 			// -----------------------
-			glStencilMask(0x00);
+			glState().StencilMask(0x00);
 
 			// don't forget to enable shader before setting uniforms
 			shader.use();
 
-			// view/projection transformations
 			glm::mat4 model;
-			glm::mat4 view = camera.GetViewMatrix();
-			glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
 
 			// render the aircraft
 			ship.Position = camera.Position + glm::vec3(0.0f, -0.8f, -1.0f);
@@ -555,107 +765,61 @@ int main()
 			model = glm::translate(model, ship.Position);
 			model = model * rot;
 			model = glm::scale(model, glm::vec3(0.2f, 0.2f, 0.2f));
-			shader.setMat4("model", model);
-			shader.setMat4("view", view);
-			shader.setMat4("projection", projection);
-			aircraft.Draw(shader);
-
-			// render the star1
-			glm::mat4 starp1 = glm::mat4(1.0f);
-			starp1 = glm::translate(starp1, glm::vec3(0.0f, 0.0f, 0.0f));
-			starp1 = glm::rotate(starp1, (float)glfwGetTime() * 0.1f, glm::vec3(0.0f, 1.0f, 0.0f));
-			shader.setMat4("model", starp1);
-			star1.Draw(shader);
-
-			// render the star2
-			glm::mat4 starp2 = glm::rotate(starp1, (float)glfwGetTime(), glm::vec3(1.0f, 1.0f, 0.0f)); // ת
-			starp2 = glm::translate(starp2, glm::vec3(0.0f, 0.0f, -6.0f));
-			starp2 = glm::rotate(starp2, (float)glfwGetTime() * 2, glm::vec3(0.0f, 1.0f, 1.0f)); // ת
-			shader.setMat4("model", starp2);
-			star2.Draw(shader);
-
-			// render the star3
-			glm::mat4 starp3 = glm::rotate(starp1, (float)(glfwGetTime()*0.9), glm::vec3(0.5f, 1.0f, 0.5f));
-			starp3 = glm::translate(starp3, glm::vec3(0.0f, 0.0f, -12.0f));
-			starp3 = glm::rotate(starp3, (float)(glfwGetTime()*2.5), glm::vec3(1.0f, 1.0f, 0.0f));
-			shader.setMat4("model", starp3);
-			star3.Draw(shader);
-
-			// render the earth
-			glm::mat4 emodel = glm::rotate(starp1, (float)(glfwGetTime()*0.8), glm::vec3(0.5f, 1.0f, 0.0f));
-			emodel = glm::translate(emodel, glm::vec3(0.0f, -0.5f, -20.0f));
-			emodel = glm::rotate(emodel, (float)(glfwGetTime()*0.5), glm::vec3(0.0f, 1.0f, 0.5f));
-			shader.setMat4("model", emodel);
-			earth.Draw(shader);
-
-			// render the moon
-			glm::mat4 mmodel = glm::rotate(emodel, (float)(glfwGetTime() * 2), glm::vec3(0.0f, 0.8f, 0.3f));
-			mmodel = glm::translate(mmodel, glm::vec3(0.0f, 0.0f, -4.0f));
-			mmodel = glm::rotate(mmodel, (float)(glfwGetTime()*1.0), glm::vec3(0.7f, 0.3f, 0.0f));
-			shader.setMat4("model", mmodel);
-			moon.Draw(shader);
-
-			// render the star4
-			glm::mat4 starp4 = glm::rotate(starp1, (float)(glfwGetTime()*0.6), glm::vec3(1.0f, 1.0f, 1.0f));
-			starp4 = glm::translate(starp4, glm::vec3(0.0f, 0.0f, -30.0f));
-			starp4 = glm::rotate(starp4, (float)(glfwGetTime()*3.5), glm::vec3(0.0f, 1.0f, 0.2f));
-			shader.setMat4("model", starp4);
-			star4.Draw(shader);
-
-			// render the star5
-			glm::mat4 starp5 = glm::rotate(starp1, (float)(glfwGetTime()*0.5), glm::vec3(0.5f, 1.4f, 0.3f));
-			starp5 = glm::translate(starp5, glm::vec3(0.0f, 0.0f, -38.0f));
-			starp5 = glm::rotate(starp5, (float)(glfwGetTime()*4.0), glm::vec3(0.0f, 1.0f, 0.2f));
-			shader.setMat4("model", starp5);
-			star5.Draw(shader);
-
-			// render the star6
-			glm::mat4 starp6 = glm::rotate(starp1, (float)(glfwGetTime()*0.6), glm::vec3(0.8f, 1.4f, 0.6f));
-			starp6 = glm::translate(starp6, glm::vec3(0.0f, 0.0f, -50.0f));
-			starp6 = glm::rotate(starp6, (float)(glfwGetTime()*3.0), glm::vec3(0.0f, 1.0f, 0.8f));
-			shader.setMat4("model", starp6);
-			star6.Draw(shader);
-
-			// render the star7
-			glm::mat4 starp7 = glm::rotate(starp1, (float)(glfwGetTime()*0.7), glm::vec3(0.2f, 1.0f, 2.0f));
-			starp7 = glm::translate(starp7, glm::vec3(0.0f, 0.0f, -60.0f));
-			starp7 = glm::rotate(starp7, (float)(glfwGetTime()*2.0), glm::vec3(0.0f, 1.0f, 0.1f));
-			shader.setMat4("model", starp7);
-			star7.Draw(shader);
-
-			// render the star8
-			glm::mat4 starp8 = glm::rotate(starp1, (float)(glfwGetTime()*0.7), glm::vec3(0.3f, 0.3f, 0.3f));
-			starp8 = glm::translate(starp8, glm::vec3(0.0f, 0.0f, -75.0f));
-			starp8 = glm::rotate(starp8, (float)(glfwGetTime()*1.0), glm::vec3(0.0f, 1.0f, 0.5f));
-			shader.setMat4("model", starp8);
-			star8.Draw(shader);
+			shaderModel.Set(model);
+			aircraft.Draw(shader, aircraftLod.Select(aircraft, LodSelector::PixelsPerUnit(aircraft, model, camera.Position, projectionScale)));
+
+			// transforms of the planets, the whole chain is updated from the one time of this frame
+			solarSystem.Update((float)currentFrame);
+
+			// render the planets, one instanced draw per group sharing a sphere
+			planet_shader.use();
+			glState().BindTexture(0, GL_TEXTURE_2D_ARRAY, planetTextures);
+			for (unsigned int g = 0; g < planetGroups.size(); g++)
+			{
+				const Model &planet = *planets[planetGroups[g][0]];
+				planetInstanceData.clear();
+				float planetPixels = 0.0f;
+				for (unsigned int j = 0; j < planetGroups[g].size(); j++)
+				{
+					InstanceData instance;
+					instance.Model = solarSystem.World(planetGroups[g][j]);
+					instance.Offset = 0.0f;
+					instance.Layer = (float)planetGroups[g][j];
+					planetInstanceData.push_back(instance);
+					planetPixels = max(planetPixels, LodSelector::PixelsPerUnit(planet, instance.Model, camera.Position, projectionScale));
+				}
+				planetInstances[g].Upload(planetInstanceData);
+				planets[planetGroups[g][0]]->DrawInstanced(planet_shader, planetInstances[g], planetLods[g].Select(planet, planetPixels));
+			}
 
 			// draw particles
-			generator->Update(deltaTime, 2);
+			generator->Update(deltaTime);
 			generator->Draw(particle_shader, particle_texture);
 
 			// draw skybox as last
-			glDepthFunc(GL_LEQUAL);
+			glState().DepthFunc(GL_LEQUAL);
 			galaxy_shader.use();
-			view = glm::mat4(glm::mat3(camera.GetViewMatrix()));
-			galaxy_shader.setMat4("view", view);
-			galaxy_shader.setMat4("projection", projection);
-			glBindVertexArray(skyboxVAO);
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_CUBE_MAP, galaxyTexture);
+			glState().BindVertexArray(skyboxVAO);
+			glState().BindTexture(0, GL_TEXTURE_CUBE_MAP, galaxyTexture);
 			glDrawArrays(GL_TRIANGLES, 0, 36);
-			glBindVertexArray(0);
-			glDepthFunc(GL_LESS);
+			renderStats().DrawCalls++;
+			glState().DepthFunc(GL_LESS);
 
 			break;
 		}
 		}
 
-		// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-		// -------------------------------------------------------------------------------
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		if (benchmark.Enabled)
+			runner.EndFrame();
+		else
+		{
+			// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
+			// -------------------------------------------------------------------------------
+			glfwSwapBuffers(window);
+			glfwPollEvents();
+		}
 	}
+	bool benchmarkWritten = benchmark.Enabled ? runner.Finish() : true;
 
 	// optional: de-allocate all resources once they've outlived their purpose:
 	// ------------------------------------------------------------------------
@@ -663,9 +827,16 @@ int main()
 	glDeleteVertexArrays(1, &skyboxVAO);
 	glDeleteBuffers(1, &planeVBO);
 	glDeleteBuffers(1, &skyboxVBO);
-
-	glfwTerminate();
-	return 0;
+	frameUniforms.Destroy();
+	delete generator;
+	intactChests.Destroy();
+	explodingChests.Destroy();
+	for (unsigned int i = 0; i < planetInstances.size(); i++)
+		planetInstances[i].Destroy();
+
+	if (!benchmark.Enabled)
+		glfwTerminate();
+	return benchmarkWritten && drawPathClean ? 0 : -1;
 }
 
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
@@ -680,7 +851,7 @@ void processInput(GLFWwindow *window)
 	if (glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS)
 	{
 		scene_number = 2;
-		memset(chestOffset, 0, sizeof(chestOffset));
+		fill(chestOffset.begin(), chestOffset.end(), 0);
 	}
 	if (glfwGetKey(window, GLFW_KEY_3) == GLFW_PRESS)
 		scene_number = 3;
@@ -747,96 +918,31 @@ void scroll_callback(GLFWwindow *window, double xoffset, double yoffset)
 	camera.ProcessMouseScroll(yoffset);
 }
 
-// utility function for loading a 2D texture from file
-// ---------------------------------------------------
-unsigned int loadTexture(char const *path)
+// places the chests of scene 2: the first six on the original hexagon around the origin,
+// any further ones (--chests N) on rings of growing radius with 6 * ring chests each
+// -------------------------------------------------------------------------------------
+vector<glm::vec3> chestLayout(unsigned int count)
 {
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
-	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
-	}
-
-	return textureID;
-}
-
-// loads a cubemap texture from 6 individual texture faces
-// order:
-// +X (right)
-// -X (left)
-// +Y (top)
-// -Y (bottom)
-// +Z (front) 
-// -Z (back)
-// -------------------------------------------------------
-unsigned int loadCubemap(vector<std::string> faces)
-{
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-
-	int width, height, nrChannels;
-	for (unsigned int i = 0; i < faces.size(); i++)
+	static const glm::vec3 hexagon[] = {
+		glm::vec3(0.0f, 0.0f, -5.0f),
+		glm::vec3(5.0f, 0.0f, -3.0f),
+		glm::vec3(5.0f, 0.0f, 3.0f),
+		glm::vec3(0.0f, 0.0f, 5.0f),
+		glm::vec3(-5.0f, 0.0f, 3.0f),
+		glm::vec3(-5.0f, 0.0f, -3.0f)
+	};
+	vector<glm::vec3> positions;
+	positions.reserve(count);
+	for (unsigned int i = 0; i < count && i < 6; i++)
+		positions.push_back(hexagon[i]);
+	for (unsigned int ring = 2; positions.size() < count; ring++)
 	{
-		unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-		if (data)
+		unsigned int ringSize = 6 * ring;
+		for (unsigned int i = 0; i < ringSize && positions.size() < count; i++)
 		{
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-			stbi_image_free(data);
-		}
-		else
-		{
-			std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-			stbi_image_free(data);
+			float angle = glm::radians(360.0f) * i / ringSize;
+			positions.push_back(glm::vec3(5.0f * ring * sin(angle), 0.0f, -5.0f * ring * cos(angle)));
 		}
 	}
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-	return textureID;
-}
-
-bool checkCollision(glm::vec3 position1, float size1, glm::vec3 position2, float size2)
-{
-	bool collisionX = true;
-	bool collisionY = true;
-	bool collisionZ = true;
-
-	if (position1.x + size1 < position2.x - size2 || position1.x - size1 > position2.x + size2)
-		collisionX = false;
-	if (position1.y + size1 < position2.y - size2 || position1.y - size1 > position2.y + size2)
-		collisionY = false;
-	if (position1.z + size1 < position2.z - size2 || position1.z - size1 > position2.z + size2)
-		collisionZ = false;
-
-	return collisionX && collisionY && collisionZ;
+	return positions;
 }
\ No newline at end of file
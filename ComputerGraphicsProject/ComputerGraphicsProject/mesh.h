@@ -7,12 +7,19 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "shader.h"
+#include "render_stats.h"
+#include "gl_state.h"
+#include "instance_buffer.h"
+#include "geometry_registry.h"
+#include "bvh.h"
+#include "packed_vertex.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <vector>
+#include <cstdint>
 using namespace std;
 
 struct Vertex {
@@ -28,93 +35,330 @@ struct Vertex {
 	glm::vec3 Bitangent;
 };
 
+// meshes with at most this many vertices are drawn with 16-bit indices, bigger ones with 32-bit
+// indices unless the model loader splits them (see MeshOptimizer::Split)
+const size_t MAX_SHORT_INDEXED_VERTICES = 65536;
+
+// a vertex in the compact GPU layout, with the position relative to box, the box of its mesh
+inline PackedVertex packVertex(const Vertex &vertex, const AABB &box)
+{
+	PackedVertex packed;
+	glm::vec3 size = box.Max - box.Min;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float fraction = size[axis] > 0.0f ? (vertex.Position[axis] - box.Min[axis]) / size[axis] : 0.0f;
+		fraction = fraction < 0.0f ? 0.0f : (fraction > 1.0f ? 1.0f : fraction);
+		packed.Position[axis] = (uint16_t)floor(fraction * 65535.0f + 0.5f);
+	}
+	packed.BitangentSign = glm::dot(glm::cross(vertex.Normal, vertex.Tangent), vertex.Bitangent) < 0.0f ? -32767 : 32767;
+	packOctahedral(vertex.Normal, packed.Normal);
+	packOctahedral(vertex.Tangent, packed.Tangent);
+	packed.TexCoords[0] = packHalf(vertex.TexCoords.x);
+	packed.TexCoords[1] = packHalf(vertex.TexCoords.y);
+	return packed;
+}
+
 struct Texture {
 	unsigned int id;
 	string type;
 	string path;
 };
 
+// what a mesh keeps in system memory once its buffers are on the GPU; bounds are always kept
+enum Mesh_Retention {
+	RETAIN_NONE,       // nothing, the mesh can only be drawn
+	RETAIN_COLLISION,  // the BVH, for Model::Intersects() and Model::Raycast()
+	RETAIN_ALL         // the BVH and the vertices and indices, e.g. for writing the mesh cache
+};
+
+// one level of detail of a mesh: a range of its index buffer over the shared vertices, and how
+// far the simplified surface is from the full one in model units (0 for the full mesh)
+struct MeshLod {
+	unsigned int IndexOffset;
+	unsigned int IndexCount;
+	float Error;
+};
+
+// a texture together with the material sampler slot it is bound to, resolved when the mesh is created
+struct SamplerBinding {
+	unsigned int TextureID;
+	unsigned int Slot;
+};
+
 class Mesh {
 public:
 	/*  Mesh Data  */
+	// empty unless the mesh retains everything, see Release()
 	vector<Vertex> vertices;
 	vector<unsigned int> indices;
 	vector<Texture> textures;
+	vector<SamplerBinding> samplerBindings;
 	unsigned int VAO;
+	// layout of the vertices on the GPU, taken from meshVertexFormat() when the mesh is created
+	Vertex_Format vertexFormat;
+	// box and sphere around the vertices in model space, computed once when the mesh is created
+	AABB bounds;
+	BoundingSphere sphere;
+	// triangle hierarchy in model space, for exact collision and ray queries; empty with RETAIN_NONE
+	MeshBVH bvh;
+	// the full mesh first, then ever coarser ones, all in the one element buffer
+	vector<MeshLod> lods;
 
 	/*  Functions  */
-	// constructor
-	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+	// constructor, takes over the vertex and index arrays without copying them.
+	// they are released right after the upload unless retention is RETAIN_ALL or keepData is set;
+	// keepData holds on to them until the owner calls Release(), e.g. after writing the mesh cache.
+	// without lods the whole index buffer is the only level.
+	Mesh(vector<Vertex> &&vertices, vector<unsigned int> &&indices, vector<Texture> textures, vector<MeshLod> lods = vector<MeshLod>(), Mesh_Retention retention = RETAIN_ALL, bool keepData = false)
+		: vertices(std::move(vertices)), indices(std::move(indices)), textures(std::move(textures)), lods(std::move(lods))
 	{
-		this->vertices = vertices;
-		this->indices = indices;
-		this->textures = textures;
-
 		// now that we have all the required data, set the vertex buffers and its attribute pointers.
-		setupMesh();
+		setup(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size(), retention);
+		if (!keepData)
+			Release(retention);
 	}
 
-	// render the mesh
-	void Draw(Shader shader)
+	// constructor for data that is already processed, e.g. memory-mapped from the mesh cache.
+	// the buffers are uploaded straight from the given arrays, which are only copied for RETAIN_ALL.
+	Mesh(const Vertex *vertices, size_t vertexCount, const unsigned int *indices, size_t indexCount, vector<Texture> textures, vector<MeshLod> lods = vector<MeshLod>(), Mesh_Retention retention = RETAIN_ALL)
+		: textures(std::move(textures)), lods(std::move(lods))
 	{
-		// bind appropriate textures
-		unsigned int diffuseNr = 1;
-		unsigned int specularNr = 1;
-		unsigned int normalNr = 1;
-		unsigned int heightNr = 1;
-		for (unsigned int i = 0; i < textures.size(); i++)
+		if (retention == RETAIN_ALL)
 		{
-			glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-											  // retrieve texture number (the N in diffuse_textureN)
-			string number;
-			string name = textures[i].type;
-			if (name == "texture_diffuse")
-				number = std::to_string(diffuseNr++);
-			else if (name == "texture_specular")
-				number = std::to_string(specularNr++); // transfer unsigned int to stream
-			else if (name == "texture_normal")
-				number = std::to_string(normalNr++); // transfer unsigned int to stream
-			else if (name == "texture_height")
-				number = std::to_string(heightNr++); // transfer unsigned int to stream
-
-			// now set the sampler to the correct texture unit
-			glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-			// and finally bind the texture
-			glBindTexture(GL_TEXTURE_2D, textures[i].id);
+			this->vertices.assign(vertices, vertices + vertexCount);
+			this->indices.assign(indices, indices + indexCount);
 		}
+		setup(vertices, vertexCount, indices, indexCount, retention);
+	}
+
+	// a mesh owns its GL objects' place in the registry and possibly megabytes of arrays, so it is
+	// moved, never copied
+	Mesh(const Mesh &) = delete;
+	Mesh &operator=(const Mesh &) = delete;
+	Mesh(Mesh &&) = default;
+	Mesh &operator=(Mesh &&) = default;
+
+	// frees what the retention policy does not keep
+	void Release(Mesh_Retention retention)
+	{
+		if (retention != RETAIN_ALL)
+		{
+			vector<Vertex>().swap(vertices);
+			vector<unsigned int>().swap(indices);
+		}
+		if (retention == RETAIN_NONE)
+			bvh = MeshBVH();
+	}
+
+	// system memory held by the vertex and index arrays and the BVH
+	size_t ResidentBytes() const
+	{
+		return vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int) + bvh.MemoryBytes();
+	}
+
+	// system memory the full vertex and index arrays would take, held or not
+	size_t DataBytes() const
+	{
+		return vertexCount * sizeof(Vertex) + indexCount * sizeof(unsigned int);
+	}
+
+	// size of the vertex and index buffers this mesh draws from
+	size_t GpuBytes() const
+	{
+		return vertexCount * (vertexFormat == VERTEX_PACKED ? sizeof(PackedVertex) : sizeof(Vertex)) +
+			indexCount * (indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int));
+	}
+
+	size_t VertexCount() const
+	{
+		return vertexCount;
+	}
+
+	size_t IndexCount() const
+	{
+		return indexCount;
+	}
+
+	unsigned int LodCount() const
+	{
+		return (unsigned int)lods.size();
+	}
+
+	// the given level, or the coarsest one if the mesh has fewer
+	const MeshLod &Lod(unsigned int level) const
+	{
+		return lods[level < lods.size() ? level : lods.size() - 1];
+	}
+
+	// render the mesh at the given level of detail
+	void Draw(const Shader &shader, unsigned int level = 0)
+	{
+		bindTextures(shader);
+		setVertexDecode(shader, true);
 
 		// draw mesh
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		const MeshLod &lod = Lod(level);
+		glState().BindVertexArray(VAO);
+		glDrawElements(GL_TRIANGLES, (GLsizei)lod.IndexCount, indexType, indexOffset(lod));
+		renderStats().DrawCalls++;
+		renderStats().Triangles += lod.IndexCount / 3;
+		setVertexDecode(shader, false);
+	}
 
-		// always good practice to set everything back to defaults once configured.
-		glActiveTexture(GL_TEXTURE0);
+	// render one copy of the mesh per instance in the buffer with a single draw call
+	void DrawInstanced(const Shader &shader, const InstanceBuffer &instances, unsigned int level = 0)
+	{
+		if (instances.Count() == 0)
+			return;
+		bindTextures(shader);
+		setVertexDecode(shader, true);
+
+		const MeshLod &lod = Lod(level);
+		glState().BindVertexArray(VAO);
+		instances.EnableAttributes();
+		glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)lod.IndexCount, indexType, indexOffset(lod), instances.Count());
+		renderStats().DrawCalls++;
+		renderStats().Triangles += lod.IndexCount / 3 * instances.Count();
+		instances.DisableAttributes();
+		setVertexDecode(shader, false);
 	}
 
 private:
 	/*  Render data  */
 	unsigned int VBO, EBO;
+	// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, whatever the element buffer holds
+	GLenum indexType;
+	// kept apart from the arrays, which may be released
+	size_t vertexCount, indexCount;
 
 	/*  Functions    */
-	// initializes all the buffer objects/arrays
-	void setupMesh()
+	// byte offset of the level in the element buffer
+	const void *indexOffset(const MeshLod &lod) const
 	{
+		return (const void *)(lod.IndexOffset * (indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int)));
+	}
+
+	void bindTextures(const Shader &shader)
+	{
+		for (unsigned int i = 0; i < samplerBindings.size(); i++)
+		{
+			// set the sampler to the correct texture unit and bind the texture there,
+			// the state cache drops the bind if the texture is still in place from the last mesh
+			glUniform1i(shader.SamplerLocation(samplerBindings[i].Slot), i);
+			glState().BindTexture(i, GL_TEXTURE_2D, samplerBindings[i].TextureID);
+		}
+	}
+
+	// turns the packed decoding of the vertex shader on for this mesh's draw and off again afterwards,
+	// so the other draws of the program, e.g. of plain float VAOs, are left alone.
+	// meshes with full vertices never touch the uniforms.
+	void setVertexDecode(const Shader &shader, bool enable)
+	{
+		if (vertexFormat != VERTEX_PACKED)
+			return;
+		const VertexDecodeLocations &locations = shader.VertexDecode();
+		glUniform1i(locations.Packed, enable ? 1 : 0);
+		if (!enable)
+			return;
+		glUniform3fv(locations.PositionOffset, 1, &bounds.Min[0]);
+		glm::vec3 scale = bounds.Max - bounds.Min;
+		glUniform3fv(locations.PositionScale, 1, &scale[0]);
+	}
+
+	// works out the sampler every texture goes to (the N in texture_diffuseN counts up per type),
+	// so drawing only has to walk this table
+	void setupSamplerBindings()
+	{
+		unsigned int counts[SAMPLER_TYPE_COUNT] = { 0 };
+		for (unsigned int i = 0; i < textures.size(); i++)
+		{
+			unsigned int type = 0;
+			while (type < SAMPLER_TYPE_COUNT && textures[i].type != materialSamplerPrefix(type))
+				type++;
+			if (type == SAMPLER_TYPE_COUNT || counts[type] == MAX_SAMPLERS_PER_TYPE)
+			{
+				cout << "WARNING::MESH:: no sampler for texture " << textures[i].path << " of type " << textures[i].type << endl;
+				continue;
+			}
+			SamplerBinding binding;
+			binding.TextureID = textures[i].id;
+			binding.Slot = materialSamplerSlot(type, ++counts[type]);
+			samplerBindings.push_back(binding);
+		}
+	}
+
+	// everything both constructors do with the data, before any of it is released
+	void setup(const Vertex *vertexData, size_t vertexCount, const unsigned int *indexData, size_t indexCount, Mesh_Retention retention)
+	{
+		this->vertexCount = vertexCount;
+		this->indexCount = indexCount;
+		if (lods.empty())
+		{
+			MeshLod full = { 0, (unsigned int)indexCount, 0.0f };
+			lods.push_back(full);
+		}
+		vertexFormat = meshVertexFormat();
+		// a mesh without vertices, e.g. an aiMesh without faces, has no data to point at
+		const glm::vec3 *positions = vertexCount > 0 ? &vertexData[0].Position : NULL;
+		setupBounds(positions, vertexCount);
+		setupMesh(vertexData, vertexCount, indexData, indexCount);
+		setupSamplerBindings();
+		// collisions and rays only ever look at the full mesh
+		if (retention != RETAIN_NONE)
+			bvh.Build(positions, sizeof(Vertex), indexData + lods[0].IndexOffset, lods[0].IndexCount);
+	}
+
+	void setupBounds(const glm::vec3 *positions, size_t vertexCount)
+	{
+		bounds = BoundsOf(positions, vertexCount, sizeof(Vertex));
+		sphere = SphereAround(bounds, positions, vertexCount, sizeof(Vertex));
+	}
+
+	// initializes all the buffer objects/arrays, or picks up the ones of an identical mesh uploaded before
+	void setupMesh(const Vertex *vertexData, size_t vertexCount, const unsigned int *indexData, size_t indexCount)
+	{
+		uint64_t key = GeometryRegistry::Key(vertexData, vertexCount * sizeof(Vertex), indexData, indexCount * sizeof(unsigned int));
+		// the same vertices in the other layout are different buffers
+		key = hashBytes(&vertexFormat, sizeof(vertexFormat), key);
+		// the index width follows from the vertex count, so shared geometry always agrees on it
+		indexType = vertexCount <= MAX_SHORT_INDEXED_VERTICES ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		SharedGeometry geometry;
+		if (geometryRegistry().Find(key, vertexCount, indexCount, geometry))
+		{
+			VAO = geometry.VAO;
+			VBO = geometry.VBO;
+			EBO = geometry.EBO;
+			return;
+		}
+
 		// create buffers/arrays
 		glGenVertexArrays(1, &VAO);
 		glGenBuffers(1, &VBO);
 		glGenBuffers(1, &EBO);
 
 		glBindVertexArray(VAO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		if (indexType == GL_UNSIGNED_SHORT)
+		{
+			vector<uint16_t> shortIndices(indexData, indexData + indexCount);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(uint16_t), shortIndices.empty() ? NULL : &shortIndices[0], GL_STATIC_DRAW);
+		}
+		else
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), indexData, GL_STATIC_DRAW);
+
 		// load data into vertex buffers
 		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		if (vertexFormat == VERTEX_PACKED)
+		{
+			setupPackedVertices(vertexData, vertexCount);
+			glBindVertexArray(0);
+			addGeometry(key, vertexCount, indexCount);
+			return;
+		}
 		// A great thing about structs is that their memory layout is sequential for all its items.
 		// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
 		// again translates to 3/2 floats which translates to a byte array.
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertexData, GL_STATIC_DRAW);
 
 		// set the vertex attribute pointers
 		// vertex Positions
@@ -134,6 +378,41 @@ private:
 		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
 
 		glBindVertexArray(0);
+		addGeometry(key, vertexCount, indexCount);
+	}
+
+	// uploads the vertices as PackedVertex into the bound VBO and points the attributes at them,
+	// see packed_vertex.h for what every location holds
+	void setupPackedVertices(const Vertex *vertexData, size_t vertexCount)
+	{
+		vector<PackedVertex> packed(vertexCount);
+		for (size_t i = 0; i < vertexCount; i++)
+			packed[i] = packVertex(vertexData[i], bounds);
+		glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(PackedVertex), packed.empty() ? NULL : &packed[0], GL_STATIC_DRAW);
+
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Position));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Normal));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, TexCoords));
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Tangent));
+		glEnableVertexAttribArray(4);
+		glVertexAttribPointer(4, 1, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, BitangentSign));
+	}
+
+	// registers the buffers just created so identical meshes can share them
+	void addGeometry(uint64_t key, size_t vertexCount, size_t indexCount)
+	{
+		SharedGeometry geometry;
+		geometry.VAO = VAO;
+		geometry.VBO = VBO;
+		geometry.EBO = EBO;
+		geometry.vertexCount = vertexCount;
+		geometry.indexCount = indexCount;
+		geometry.bytes = GpuBytes();
+		geometryRegistry().Add(key, geometry);
 	}
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,357 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "mesh.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+using namespace std;
+
+// Read-only memory mapping of a whole file.
+class MappedFile
+{
+public:
+	MappedFile() : data(NULL), size(0)
+	{
+#ifdef _WIN32
+		file = INVALID_HANDLE_VALUE;
+		mapping = NULL;
+#else
+		fd = -1;
+#endif
+	}
+
+	~MappedFile()
+	{
+		Close();
+	}
+
+	bool Open(const string &path)
+	{
+		Close();
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+		{
+			Close();
+			return false;
+		}
+		size = (size_t)fileSize.QuadPart;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping)
+			data = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+		fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size == 0)
+		{
+			Close();
+			return false;
+		}
+		size = (size_t)info.st_size;
+		void *address = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (address != MAP_FAILED)
+			data = (const unsigned char *)address;
+#endif
+		if (!data)
+		{
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+		mapping = NULL;
+#else
+		if (data)
+			munmap((void *)data, size);
+		if (fd >= 0)
+			close(fd);
+		fd = -1;
+#endif
+		data = NULL;
+		size = 0;
+	}
+
+	const unsigned char *Data() const
+	{
+		return data;
+	}
+
+	size_t Size() const
+	{
+		return size;
+	}
+
+private:
+	const unsigned char *data;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+};
+
+// a mesh as stored in the cache: pointers straight into the mapped file
+struct CachedMesh
+{
+	const Vertex *vertices;
+	size_t vertexCount;
+	const unsigned int *indices;
+	size_t indexCount;
+	vector<Texture> textures; // only type and path are filled in, the ids are resolved by the model
+	vector<MeshLod> lods;
+};
+
+// Binary cache of the processed meshes of one model, stored next to the asset as "<asset>.meshcache".
+//
+// layout (all fields 4-byte aligned, native endianness):
+//   header   magic "MSHC", version, sizeof(Vertex), mesh count, dependency count,
+//            64-bit hash of the source file and its dependencies
+//   per dependency path length, path characters padded to 4 bytes
+//   per mesh vertex count, index count, texture count, level of detail count,
+//            per texture: type length, path length, type and path characters padded to 4 bytes,
+//            MeshLod[level count], Vertex[vertex count], unsigned int[index count] (all levels)
+//
+// The dependencies are the other files the importer looked for, e.g. the material library of an
+// OBJ, see RecordingIOSystem. A cache is only used when version, vertex size and hash all match, so
+// editing the asset or any of its dependencies, adding a dependency that was missing, changing the
+// import flags (bump MESH_CACHE_VERSION) or the Vertex struct invalidates it.
+class MeshCache
+{
+public:
+	// 2: meshes are welded and reordered by MeshOptimizer before they are stored
+	// 3: meshes with more than MAX_SHORT_INDEXED_VERTICES vertices are stored split
+	// 4: every mesh carries its levels of detail
+	// 5: the files the importer read besides the source are stored and hashed with it
+	static const uint32_t MESH_CACHE_VERSION = 5;
+
+	MeshCache(const string &sourcePath) : sourcePath(sourcePath), cachePath(sourcePath + ".meshcache"), sourceHash(0)
+	{
+	}
+
+	// maps the cache file and checks it against the source asset; on success Meshes() points into the mapping
+	bool Load()
+	{
+		if (!file.Open(cachePath))
+			return false;
+
+		const unsigned char *cursor = file.Data();
+		const unsigned char *end = cursor + file.Size();
+		uint32_t header[5];
+		uint64_t hash;
+		if (!read(cursor, end, header, sizeof(header)) || !read(cursor, end, &hash, sizeof(hash)))
+			return invalid();
+		if (memcmp(header, "MSHC", 4) != 0 || header[1] != MESH_CACHE_VERSION || header[2] != sizeof(Vertex))
+			return invalid();
+		vector<string> dependencies(header[4]);
+		for (size_t i = 0; i < dependencies.size(); i++)
+		{
+			uint32_t length;
+			if (!read(cursor, end, &length, sizeof(length)) || (size_t)(end - cursor) < align4(length))
+				return invalid();
+			dependencies[i].assign((const char *)cursor, length);
+			cursor += align4(length);
+		}
+		if (!hashSource(dependencies) || hash != sourceHash)
+			return invalid();
+
+		meshes.resize(header[3]);
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			CachedMesh &mesh = meshes[i];
+			uint32_t counts[4];
+			if (!read(cursor, end, counts, sizeof(counts)))
+				return invalid();
+			mesh.vertexCount = counts[0];
+			mesh.indexCount = counts[1];
+			mesh.textures.resize(counts[2]);
+			mesh.lods.resize(counts[3]);
+			for (size_t j = 0; j < mesh.textures.size(); j++)
+			{
+				uint32_t lengths[2];
+				if (!read(cursor, end, lengths, sizeof(lengths)))
+					return invalid();
+				size_t padded = align4(lengths[0] + lengths[1]);
+				if ((size_t)(end - cursor) < padded)
+					return invalid();
+				mesh.textures[j].id = 0;
+				mesh.textures[j].type.assign((const char *)cursor, lengths[0]);
+				mesh.textures[j].path.assign((const char *)cursor + lengths[0], lengths[1]);
+				cursor += padded;
+			}
+			if (!mesh.lods.empty() && !read(cursor, end, &mesh.lods[0], mesh.lods.size() * sizeof(MeshLod)))
+				return invalid();
+			for (size_t j = 0; j < mesh.lods.size(); j++)
+			{
+				if ((size_t)mesh.lods[j].IndexOffset + mesh.lods[j].IndexCount > mesh.indexCount)
+					return invalid();
+			}
+			size_t vertexBytes = mesh.vertexCount * sizeof(Vertex);
+			size_t indexBytes = mesh.indexCount * sizeof(unsigned int);
+			if ((size_t)(end - cursor) < vertexBytes + indexBytes)
+				return invalid();
+			mesh.vertices = (const Vertex *)cursor;
+			cursor += vertexBytes;
+			mesh.indices = (const unsigned int *)cursor;
+			cursor += indexBytes;
+		}
+		return true;
+	}
+
+	const vector<CachedMesh> &Meshes() const
+	{
+		return meshes;
+	}
+
+	// writes the processed meshes of a freshly imported model, dependencies are the files the importer
+	// read or looked for besides the source. Returns false if the cache could not be written.
+	bool Save(const vector<Mesh> &meshes, const vector<string> &dependencies)
+	{
+		vector<string> others;
+		for (size_t i = 0; i < dependencies.size(); i++)
+		{
+			if (dependencies[i] != sourcePath)
+				others.push_back(dependencies[i]);
+		}
+		if (!hashSource(others))
+			return false;
+
+		// write to a temporary file first so an interrupted run never leaves a truncated cache behind
+		string tempPath = cachePath + ".tmp";
+		ofstream out(tempPath.c_str(), ios::binary | ios::trunc);
+		if (!out)
+		{
+			cout << "WARNING::MESH_CACHE:: could not write " << cachePath << endl;
+			return false;
+		}
+		static const char padding[4] = { 0, 0, 0, 0 };
+		uint32_t header[5] = { 0, MESH_CACHE_VERSION, (uint32_t)sizeof(Vertex), (uint32_t)meshes.size(), (uint32_t)others.size() };
+		memcpy(header, "MSHC", 4);
+		out.write((const char *)header, sizeof(header));
+		out.write((const char *)&sourceHash, sizeof(sourceHash));
+		for (size_t i = 0; i < others.size(); i++)
+		{
+			uint32_t length = (uint32_t)others[i].size();
+			out.write((const char *)&length, sizeof(length));
+			out.write(others[i].data(), length);
+			out.write(padding, align4(length) - length);
+		}
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			const Mesh &mesh = meshes[i];
+			uint32_t counts[4] = { (uint32_t)mesh.vertices.size(), (uint32_t)mesh.indices.size(), (uint32_t)mesh.textures.size(), (uint32_t)mesh.lods.size() };
+			out.write((const char *)counts, sizeof(counts));
+			for (size_t j = 0; j < mesh.textures.size(); j++)
+			{
+				const Texture &texture = mesh.textures[j];
+				uint32_t lengths[2] = { (uint32_t)texture.type.size(), (uint32_t)texture.path.size() };
+				out.write((const char *)lengths, sizeof(lengths));
+				out.write(texture.type.data(), texture.type.size());
+				out.write(texture.path.data(), texture.path.size());
+				out.write(padding, align4(lengths[0] + lengths[1]) - (lengths[0] + lengths[1]));
+			}
+			out.write((const char *)mesh.lods.data(), mesh.lods.size() * sizeof(MeshLod));
+			out.write((const char *)mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+			out.write((const char *)mesh.indices.data(), mesh.indices.size() * sizeof(unsigned int));
+		}
+		out.close();
+		if (!out)
+		{
+			remove(tempPath.c_str());
+			cout << "WARNING::MESH_CACHE:: could not write " << cachePath << endl;
+			return false;
+		}
+		file.Close(); // the old cache may still be mapped
+		remove(cachePath.c_str());
+		return rename(tempPath.c_str(), cachePath.c_str()) == 0;
+	}
+
+private:
+	string sourcePath;
+	string cachePath;
+	uint64_t sourceHash;
+	MappedFile file;
+	vector<CachedMesh> meshes;
+
+	// hashes the source and, with their paths, the dependencies; a missing dependency is hashed as
+	// missing rather than failing, as it was when the model was imported
+	bool hashSource(const vector<string> &dependencies)
+	{
+		MappedFile source;
+		if (!source.Open(sourcePath))
+			return false;
+		sourceHash = hashBytes(source.Data(), source.Size());
+		for (size_t i = 0; i < dependencies.size(); i++)
+		{
+			MappedFile dependency;
+			unsigned char present = dependency.Open(dependencies[i]) ? 1 : 0;
+			sourceHash = hashBytes(dependencies[i].data(), dependencies[i].size(), sourceHash);
+			sourceHash = hashBytes(&present, sizeof(present), sourceHash);
+			sourceHash = hashBytes(dependency.Data(), dependency.Size(), sourceHash);
+		}
+		return true;
+	}
+
+	bool invalid()
+	{
+		meshes.clear();
+		file.Close();
+		return false;
+	}
+
+	static size_t align4(size_t size)
+	{
+		return (size + 3) & ~(size_t)3;
+	}
+
+	static bool read(const unsigned char *&cursor, const unsigned char *end, void *target, size_t size)
+	{
+		if ((size_t)(end - cursor) < size)
+			return false;
+		memcpy(target, cursor, size);
+		cursor += size;
+		return true;
+	}
+};
+#endif
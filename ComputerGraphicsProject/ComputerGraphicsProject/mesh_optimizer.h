@@ -0,0 +1,459 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+#include "geometry_registry.h"
+
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+using namespace std;
+
+// How well an index buffer uses the post-transform vertex cache, simulated as a FIFO of
+// CacheSize entries: ACMR is the average number of vertex shader runs per triangle (0.5 at best
+// for big regular grids, 3 with no reuse at all), ATVR the runs per vertex (1 is ideal).
+struct VertexCacheStats {
+	unsigned int CacheSize;
+	size_t Transforms;
+	float ACMR;
+	float ATVR;
+};
+
+// Vertex and cache numbers of a mesh before and after MeshOptimizer::Optimize()
+struct MeshOptimizationReport {
+	size_t Triangles;
+	size_t VerticesBefore, VerticesAfter;
+	VertexCacheStats Before, After;
+
+	MeshOptimizationReport() : Triangles(0), VerticesBefore(0), VerticesAfter(0)
+	{
+		Before.CacheSize = After.CacheSize = 0;
+		Before.Transforms = After.Transforms = 0;
+		Before.ACMR = Before.ATVR = After.ACMR = After.ATVR = 0.0f;
+	}
+
+	// adds the numbers of another mesh, e.g. to report on a whole model
+	void Add(const MeshOptimizationReport &mesh)
+	{
+		Triangles += mesh.Triangles;
+		VerticesBefore += mesh.VerticesBefore;
+		VerticesAfter += mesh.VerticesAfter;
+		Before = sum(Before, mesh.Before, Triangles, VerticesBefore);
+		After = sum(After, mesh.After, Triangles, VerticesAfter);
+	}
+
+private:
+	static VertexCacheStats sum(const VertexCacheStats &a, const VertexCacheStats &b, size_t triangles, size_t vertices)
+	{
+		VertexCacheStats stats;
+		stats.CacheSize = b.CacheSize;
+		stats.Transforms = a.Transforms + b.Transforms;
+		stats.ACMR = triangles > 0 ? (float)stats.Transforms / triangles : 0.0f;
+		stats.ATVR = vertices > 0 ? (float)stats.Transforms / vertices : 0.0f;
+		return stats;
+	}
+};
+
+// one piece of a mesh cut by MeshOptimizer::Split(), with its own vertex numbering
+struct MeshPart {
+	vector<Vertex> Vertices;
+	vector<unsigned int> Indices;
+};
+
+// Load-time optimization of imported meshes, run before the result is written to the mesh cache:
+//   1. Weld() merges byte-identical vertices, which Assimp leaves apart without JoinIdenticalVertices.
+//   2. OptimizeVertexCache() reorders the triangles with Forsyth's linear-speed algorithm so the
+//      vertices of neighbouring triangles are still in the post-transform cache.
+//   3. OptimizeOverdraw() cuts that order into clusters where the cache starts over and draws the
+//      outward-facing clusters first, so fewer hidden fragments get shaded; inside a cluster the
+//      order stays, so the cache numbers barely change.
+//   4. OptimizeVertexFetch() renumbers the vertices in the order the triangles first use them.
+// The optimizer keeps its scratch buffers, so one instance can process all meshes of a model.
+class MeshOptimizer
+{
+public:
+	// the size Forsyth's scores assume, an LRU cache of this many vertices
+	static const unsigned int FORSYTH_CACHE_SIZE = 32;
+	// the cache the report simulates, close to what GPUs of the last decade reuse within a batch
+	static const unsigned int REPORT_CACHE_SIZE = 16;
+
+	// runs all four steps on the mesh and reports the cache numbers of the input and the output
+	MeshOptimizationReport Optimize(vector<Vertex> &vertices, vector<unsigned int> &indices)
+	{
+		MeshOptimizationReport report;
+		report.Triangles = indices.size() / 3;
+		report.VerticesBefore = vertices.size();
+		report.Before = Analyze(indices, vertices.size());
+		Weld(vertices, indices);
+		OptimizeVertexCache(indices, vertices.size());
+		OptimizeOverdraw(indices, vertices);
+		OptimizeVertexFetch(vertices, indices);
+		report.VerticesAfter = vertices.size();
+		report.After = Analyze(indices, vertices.size());
+		total.Add(report);
+		return report;
+	}
+
+	// cuts the triangles into consecutive runs that use at most maxVertices vertices each, e.g.
+	// MAX_SHORT_INDEXED_VERTICES so every part can be drawn with 16-bit indices. The triangle order
+	// is kept, so an optimized mesh stays cache friendly; vertices on the seams are duplicated.
+	void Split(const vector<Vertex> &vertices, const vector<unsigned int> &indices, size_t maxVertices, vector<MeshPart> &parts)
+	{
+		const unsigned int UNUSED = 0xFFFFFFFFu;
+		parts.clear();
+		remap.assign(vertices.size(), UNUSED);
+		size_t triangleCount = indices.size() / 3;
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			const unsigned int *triangle = &indices[3 * t];
+			unsigned int fresh = 0;
+			for (int corner = 0; corner < 3; corner++)
+				fresh += remap[triangle[corner]] == UNUSED ? 1 : 0;
+			if (parts.empty() || parts.back().Vertices.size() + fresh > maxVertices)
+			{
+				// start over with a new part, forgetting the numbering of the last one
+				if (!parts.empty())
+				{
+					for (size_t i = 0; i < parts.back().Indices.size(); i++)
+						remap[partSources[i]] = UNUSED;
+				}
+				parts.push_back(MeshPart());
+				partSources.clear();
+			}
+			MeshPart &part = parts.back();
+			for (int corner = 0; corner < 3; corner++)
+			{
+				unsigned int &target = remap[triangle[corner]];
+				if (target == UNUSED)
+				{
+					target = (unsigned int)part.Vertices.size();
+					part.Vertices.push_back(vertices[triangle[corner]]);
+				}
+				part.Indices.push_back(target);
+				partSources.push_back(triangle[corner]);
+			}
+		}
+	}
+
+	// sum of the reports of every Optimize() call so far
+	const MeshOptimizationReport &Total() const
+	{
+		return total;
+	}
+
+	// FIFO cache simulation of the index buffer
+	static VertexCacheStats Analyze(const vector<unsigned int> &indices, size_t vertexCount, unsigned int cacheSize = REPORT_CACHE_SIZE)
+	{
+		VertexCacheStats stats;
+		stats.CacheSize = cacheSize;
+		stats.Transforms = 0;
+		vector<size_t> loadedAt(vertexCount, 0);
+		for (size_t i = 0; i < indices.size(); i++)
+			missCache(loadedAt, stats.Transforms, indices[i], cacheSize);
+		size_t triangles = indices.size() / 3;
+		stats.ACMR = triangles > 0 ? (float)stats.Transforms / triangles : 0.0f;
+		stats.ATVR = vertexCount > 0 ? (float)stats.Transforms / vertexCount : 0.0f;
+		return stats;
+	}
+
+	// merges byte-identical vertices and points the indices at the kept copy, returns how many went
+	size_t Weld(vector<Vertex> &vertices, vector<unsigned int> &indices)
+	{
+		size_t buckets = 1;
+		while (buckets < 2 * vertices.size())
+			buckets <<= 1;
+		const unsigned int EMPTY = 0xFFFFFFFFu;
+		table.assign(buckets, EMPTY);
+		remap.resize(vertices.size());
+		size_t kept = 0;
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			// open addressing with linear probing, keyed by the bytes of the vertex
+			size_t bucket = (size_t)hashBytes(&vertices[i], sizeof(Vertex)) & (buckets - 1);
+			while (table[bucket] != EMPTY && memcmp(&vertices[table[bucket]], &vertices[i], sizeof(Vertex)) != 0)
+				bucket = (bucket + 1) & (buckets - 1);
+			if (table[bucket] == EMPTY)
+			{
+				vertices[kept] = vertices[i];
+				table[bucket] = (unsigned int)kept++;
+			}
+			remap[i] = table[bucket];
+		}
+		for (size_t i = 0; i < indices.size(); i++)
+			indices[i] = remap[indices[i]];
+		size_t removed = vertices.size() - kept;
+		vertices.resize(kept);
+		return removed;
+	}
+
+	// Forsyth, "Linear-Speed Vertex Cache Optimisation": every vertex is scored by its place in a
+	// simulated LRU cache and by how many triangles still need it, every triangle by the sum of its
+	// vertices. The next triangle is the best one touching the cache, or the next unused one in
+	// input order when none does.
+	void OptimizeVertexCache(vector<unsigned int> &indices, size_t vertexCount)
+	{
+		size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+			return;
+		buildAdjacency(indices, vertexCount);
+		vertexScores.resize(vertexCount);
+		cachePositions.assign(vertexCount, -1);
+		for (size_t v = 0; v < vertexCount; v++)
+			vertexScores[v] = vertexScore(-1, liveTriangles[v]);
+		triangleScores.resize(triangleCount);
+		emitted.assign(triangleCount, 0);
+		for (size_t t = 0; t < triangleCount; t++)
+			triangleScores[t] = vertexScores[indices[3 * t]] + vertexScores[indices[3 * t + 1]] + vertexScores[indices[3 * t + 2]];
+
+		ordered.resize(3 * triangleCount);
+		cache.clear();
+		size_t cursor = 0;
+		int best = -1;
+		for (size_t out = 0; out < triangleCount; out++)
+		{
+			if (best < 0)
+			{
+				while (emitted[cursor])
+					cursor++;
+				best = (int)cursor;
+			}
+			const unsigned int *triangle = &indices[3 * best];
+			memcpy(&ordered[3 * out], triangle, 3 * sizeof(unsigned int));
+			emitted[best] = 1;
+
+			// the triangle's vertices go to the front of the cache, the rest moves back
+			newCache.assign(triangle, triangle + 3);
+			for (size_t i = 0; i < cache.size(); i++)
+				if (cache[i] != triangle[0] && cache[i] != triangle[1] && cache[i] != triangle[2])
+					newCache.push_back(cache[i]);
+			for (int corner = 0; corner < 3; corner++)
+				removeTriangle(triangle[corner], (unsigned int)best);
+			if (newCache.size() > FORSYTH_CACHE_SIZE)
+			{
+				for (size_t i = FORSYTH_CACHE_SIZE; i < newCache.size(); i++)
+				{
+					cachePositions[newCache[i]] = -1;
+					rescore(newCache[i]);
+				}
+				newCache.resize(FORSYTH_CACHE_SIZE);
+			}
+			cache.swap(newCache);
+
+			// rescore everything in the cache and pick the best triangle that uses it
+			best = -1;
+			float bestScore = -1.0f;
+			for (size_t i = 0; i < cache.size(); i++)
+			{
+				cachePositions[cache[i]] = (int)i;
+				rescore(cache[i]);
+			}
+			for (size_t i = 0; i < cache.size(); i++)
+			{
+				unsigned int v = cache[i];
+				for (unsigned int j = adjacencyOffsets[v]; j < adjacencyOffsets[v] + liveTriangles[v]; j++)
+				{
+					unsigned int t = adjacency[j];
+					if (triangleScores[t] > bestScore)
+					{
+						bestScore = triangleScores[t];
+						best = (int)t;
+					}
+				}
+			}
+		}
+		indices.swap(ordered);
+	}
+
+	// Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw":
+	// the cache-optimized order is cut wherever a triangle misses the simulated cache with all three
+	// vertices, and the clusters are sorted by how far they face away from the mesh centre, the
+	// outermost front faces first.
+	void OptimizeOverdraw(vector<unsigned int> &indices, const vector<Vertex> &vertices)
+	{
+		size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+			return;
+		vector<unsigned int> clusterStarts;
+		vector<size_t> loadedAt(vertices.size(), 0);
+		size_t transforms = 0;
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			unsigned int misses = 0;
+			for (int corner = 0; corner < 3; corner++)
+				misses += missCache(loadedAt, transforms, indices[3 * t + corner], REPORT_CACHE_SIZE) ? 1 : 0;
+			if (misses == 3 || t == 0)
+				clusterStarts.push_back((unsigned int)t);
+		}
+		clusterStarts.push_back((unsigned int)triangleCount);
+		size_t clusterCount = clusterStarts.size() - 1;
+		if (clusterCount < 2)
+			return;
+
+		// area weighted centroid of the mesh and of every cluster, and the summed normal of each
+		glm::vec3 meshCenter(0.0f);
+		float meshArea = 0.0f;
+		vector<glm::vec3> centers(clusterCount), normals(clusterCount);
+		for (size_t c = 0; c < clusterCount; c++)
+		{
+			glm::vec3 center(0.0f), normal(0.0f);
+			float area = 0.0f;
+			for (unsigned int t = clusterStarts[c]; t < clusterStarts[c + 1]; t++)
+			{
+				const glm::vec3 &a = vertices[indices[3 * t]].Position;
+				const glm::vec3 &b = vertices[indices[3 * t + 1]].Position;
+				const glm::vec3 &d = vertices[indices[3 * t + 2]].Position;
+				glm::vec3 cross = glm::cross(b - a, d - a);
+				float doubleArea = glm::length(cross);
+				center += (a + b + d) * (doubleArea / 3.0f);
+				normal += cross;
+				area += doubleArea;
+			}
+			meshCenter += center;
+			meshArea += area;
+			centers[c] = area > 0.0f ? center / area : vertices[indices[3 * clusterStarts[c]]].Position;
+			normals[c] = normal;
+		}
+		if (meshArea > 0.0f)
+			meshCenter /= meshArea;
+		vector<float> clusterKeys(clusterCount);
+		vector<unsigned int> clusterOrder(clusterCount);
+		for (size_t c = 0; c < clusterCount; c++)
+		{
+			float length = glm::length(normals[c]);
+			clusterKeys[c] = length > 0.0f ? glm::dot(centers[c] - meshCenter, normals[c] / length) : 0.0f;
+			clusterOrder[c] = (unsigned int)c;
+		}
+		const vector<float> &keys = clusterKeys;
+		stable_sort(clusterOrder.begin(), clusterOrder.end(), [&keys](unsigned int a, unsigned int b) {
+			return keys[a] > keys[b];
+		});
+
+		ordered.resize(indices.size());
+		size_t out = 0;
+		for (size_t i = 0; i < clusterCount; i++)
+		{
+			unsigned int c = clusterOrder[i];
+			size_t count = 3 * (size_t)(clusterStarts[c + 1] - clusterStarts[c]);
+			memcpy(&ordered[out], &indices[3 * (size_t)clusterStarts[c]], count * sizeof(unsigned int));
+			out += count;
+		}
+		indices.swap(ordered);
+	}
+
+	// renumbers the vertices in the order the index buffer first uses them, so the vertex fetch walks
+	// forward through memory; vertices no triangle uses are dropped
+	void OptimizeVertexFetch(vector<Vertex> &vertices, vector<unsigned int> &indices)
+	{
+		const unsigned int UNUSED = 0xFFFFFFFFu;
+		remap.assign(vertices.size(), UNUSED);
+		reordered.clear();
+		reordered.reserve(vertices.size());
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			unsigned int &target = remap[indices[i]];
+			if (target == UNUSED)
+			{
+				target = (unsigned int)reordered.size();
+				reordered.push_back(vertices[indices[i]]);
+			}
+			indices[i] = target;
+		}
+		vertices.swap(reordered);
+	}
+
+private:
+	MeshOptimizationReport total;
+
+	// Forsyth's constants
+	static float vertexScore(int cachePosition, unsigned int live)
+	{
+		const float CACHE_DECAY_POWER = 1.5f;
+		const float LAST_TRIANGLE_SCORE = 0.75f;
+		const float VALENCE_BOOST_SCALE = 2.0f;
+		const float VALENCE_BOOST_POWER = 0.5f;
+		if (live == 0)
+			return -1.0f;
+		float score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			// the vertices of the last triangle get a fixed score so it is not used again right away
+			if (cachePosition < 3)
+				score = LAST_TRIANGLE_SCORE;
+			else
+				score = pow(1.0f - (float)(cachePosition - 3) / (FORSYTH_CACHE_SIZE - 3), CACHE_DECAY_POWER);
+		}
+		// vertices with few triangles left are finished off first
+		return score + VALENCE_BOOST_SCALE * pow((float)live, -VALENCE_BOOST_POWER);
+	}
+
+	vector<unsigned int> table, remap;
+	// source vertex of every index of the part Split() is filling
+	vector<unsigned int> partSources;
+	vector<Vertex> reordered;
+	// triangles of every vertex that are not emitted yet: adjacency[adjacencyOffsets[v] .. + liveTriangles[v])
+	vector<unsigned int> adjacency, adjacencyOffsets, liveTriangles;
+	vector<float> vertexScores, triangleScores;
+	vector<int> cachePositions;
+	vector<char> emitted;
+	vector<unsigned int> cache, newCache, ordered;
+
+	// FIFO step of the cache simulation: loadedAt holds the transform count at which each vertex
+	// was last loaded, and a vertex is still cached while fewer than cacheSize loads followed it
+	static bool missCache(vector<size_t> &loadedAt, size_t &transforms, unsigned int v, unsigned int cacheSize)
+	{
+		size_t &loaded = loadedAt[v];
+		if (loaded != 0 && transforms - loaded < cacheSize)
+			return false;
+		loaded = ++transforms;
+		return true;
+	}
+
+	void buildAdjacency(const vector<unsigned int> &indices, size_t vertexCount)
+	{
+		liveTriangles.assign(vertexCount, 0);
+		for (size_t i = 0; i < indices.size() - indices.size() % 3; i++)
+			liveTriangles[indices[i]]++;
+		adjacencyOffsets.resize(vertexCount);
+		unsigned int offset = 0;
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			adjacencyOffsets[v] = offset;
+			offset += liveTriangles[v];
+		}
+		adjacency.resize(offset);
+		liveTriangles.assign(vertexCount, 0);
+		for (size_t i = 0; i < indices.size() - indices.size() % 3; i++)
+		{
+			unsigned int v = indices[i];
+			adjacency[adjacencyOffsets[v] + liveTriangles[v]++] = (unsigned int)(i / 3);
+		}
+	}
+
+	void removeTriangle(unsigned int v, unsigned int triangle)
+	{
+		unsigned int *list = &adjacency[adjacencyOffsets[v]];
+		for (unsigned int i = 0; i < liveTriangles[v]; i++)
+		{
+			if (list[i] == triangle)
+			{
+				list[i] = list[--liveTriangles[v]];
+				return;
+			}
+		}
+	}
+
+	// new score of a vertex after its cache position or live triangles changed, passed on to its triangles
+	void rescore(unsigned int v)
+	{
+		float score = vertexScore(cachePositions[v], liveTriangles[v]);
+		float delta = score - vertexScores[v];
+		vertexScores[v] = score;
+		for (unsigned int j = adjacencyOffsets[v]; j < adjacencyOffsets[v] + liveTriangles[v]; j++)
+			triangleScores[adjacency[j]] += delta;
+	}
+};
+#endif
@@ -0,0 +1,483 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+#include "geometry_registry.h"
+
+#include <vector>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <algorithm>
+using namespace std;
+
+// Garland and Heckbert's error quadric: the sum of the squared distances of a point to a set of
+// planes, each weighted by the area it came from. Weight is the sum of those weights, so
+// Error() is the root of the mean squared distance, in the units of the mesh.
+struct Quadric {
+	double A00, A01, A02, A11, A12, A22;
+	double B0, B1, B2;
+	double C;
+	double Weight;
+
+	Quadric() : A00(0.0), A01(0.0), A02(0.0), A11(0.0), A12(0.0), A22(0.0), B0(0.0), B1(0.0), B2(0.0), C(0.0), Weight(0.0)
+	{
+	}
+
+	// plane of the points p with dot(normal, p) + distance = 0, normal of unit length
+	static Quadric Plane(const glm::vec3 &normal, float distance, float weight)
+	{
+		Quadric q;
+		double a = normal.x, b = normal.y, c = normal.z, d = distance, w = weight;
+		q.A00 = w * a * a; q.A01 = w * a * b; q.A02 = w * a * c;
+		q.A11 = w * b * b; q.A12 = w * b * c; q.A22 = w * c * c;
+		q.B0 = w * a * d; q.B1 = w * b * d; q.B2 = w * c * d;
+		q.C = w * d * d;
+		q.Weight = w;
+		return q;
+	}
+
+	void Add(const Quadric &q)
+	{
+		A00 += q.A00; A01 += q.A01; A02 += q.A02;
+		A11 += q.A11; A12 += q.A12; A22 += q.A22;
+		B0 += q.B0; B1 += q.B1; B2 += q.B2;
+		C += q.C;
+		Weight += q.Weight;
+	}
+
+	float Error(const glm::vec3 &p) const
+	{
+		if (Weight <= 0.0)
+			return 0.0f;
+		double x = p.x, y = p.y, z = p.z;
+		double sum = A00 * x * x + A11 * y * y + A22 * z * z + 2.0 * (A01 * x * y + A02 * x * z + A12 * y * z)
+			+ 2.0 * (B0 * x + B1 * y + B2 * z) + C;
+		return (float)sqrt(max(sum, 0.0) / Weight);
+	}
+};
+
+// Builds coarser versions of a mesh for distant draws by quadric edge collapse. Vertices are
+// only ever moved onto a neighbour, so every level indexes the original vertex buffer and all
+// levels of a mesh share one set of GPU buffers. Collapses work on positions:
+//   - A position in the middle of the surface collapses along any of its edges.
+//   - A position on an open border only collapses along the border, so the outline stays closed.
+//   - A position on a seam, shared by several vertices with different normals or texture
+//     coordinates, moves all its vertices at once, each onto a vertex of the target it shares an
+//     edge with; if one of them has none, the seam would tear and the collapse is refused.
+//   - Positions on an edge of more than two triangles never move.
+//   - Positions on the open border of more than one mesh, see AddBorders(), never move either:
+//     the meshes of a model and the parts MeshOptimizer::Split() cuts are simplified one at a
+//     time, and would otherwise pull their common outline apart into cracks and T-junctions.
+// Each pass collapses the cheapest edges first, at most one per neighbourhood, and refuses
+// collapses that would flip a triangle. Like MeshOptimizer it keeps its scratch buffers between
+// meshes.
+class MeshSimplifier
+{
+public:
+	// a level has to drop at least this share of the triangles of the level before, otherwise the
+	// chain ends, e.g. when most positions are locked
+	static constexpr float MIN_LOD_REDUCTION = 0.25f;
+	// levels stop once a mesh would move further than this share of its bounding sphere radius
+	static constexpr float MAX_LOD_ERROR = 0.05f;
+	// the full mesh plus at most this many coarser levels
+	static const unsigned int MAX_LODS = 5;
+	// meshes with fewer triangles get no levels
+	static const size_t MIN_LOD_TRIANGLES = 64;
+
+	MeshSimplifier() : sharedBordersValid(true)
+	{
+	}
+
+	// notes the open border positions of one of the meshes that are simplified with this simplifier;
+	// all of them have to be added before the first of them is simplified
+	void AddBorders(const vector<Vertex> &vertices, const vector<unsigned int> &indices)
+	{
+		vector<unsigned int> triangles(indices.begin(), indices.end() - indices.size() % 3);
+		setupPositions(vertices, triangles);
+		classify(triangles);
+		for (size_t p = 0; p < positions.size(); p++)
+		{
+			if (kinds[p] != KIND_MANIFOLD)
+				borders.push_back(positions[p]);
+		}
+		sharedBordersValid = false;
+	}
+
+	// simplified copy of indices with at most targetIndexCount indices, or as close as the error
+	// limit and the locked positions allow. Returns the largest error a collapse caused.
+	float Simplify(const vector<Vertex> &vertices, const vector<unsigned int> &indices, size_t targetIndexCount, float maxError, vector<unsigned int> &result)
+	{
+		result.assign(indices.begin(), indices.end() - indices.size() % 3);
+		if (result.size() <= targetIndexCount)
+			return 0.0f;
+		setupPositions(vertices, result);
+		lockSharedBorders();
+		classify(result);
+		setupQuadrics(result);
+
+		float error = 0.0f;
+		while (result.size() > targetIndexCount)
+		{
+			size_t collapsed = collapsePass(result, (result.size() - targetIndexCount) / 3, maxError, error);
+			// borders and locks only ever grow, a pass that moved nothing is the end
+			if (collapsed == 0)
+				break;
+			removeDegenerates(result);
+			classify(result);
+		}
+		return error;
+	}
+
+	// halves the triangles level by level until MAX_LODS, MAX_LOD_ERROR or MIN_LOD_REDUCTION ends the
+	// chain. levels gets the index buffer of every coarser level, errors the error of each against
+	// the full mesh.
+	void BuildLods(const vector<Vertex> &vertices, const vector<unsigned int> &indices, float radius, vector<vector<unsigned int> > &levels, vector<float> &errors)
+	{
+		levels.clear();
+		errors.clear();
+		if (indices.size() / 3 < MIN_LOD_TRIANGLES)
+			return;
+		size_t previous = indices.size();
+		while (levels.size() + 1 < MAX_LODS)
+		{
+			// every level starts over from the full mesh, so its error is measured against the original
+			vector<unsigned int> level;
+			float error = Simplify(vertices, indices, (previous / 6) * 3, radius * MAX_LOD_ERROR, level);
+			if (level.empty() || level.size() > (size_t)(previous * (1.0f - MIN_LOD_REDUCTION)))
+				break;
+			previous = level.size();
+			levels.push_back(level);
+			errors.push_back(error);
+		}
+	}
+
+private:
+	enum Position_Kind {
+		KIND_MANIFOLD,
+		KIND_BORDER,
+		KIND_LOCKED
+	};
+
+	// one id per distinct position, shared by the vertices along seams
+	vector<unsigned int> positionIds;
+	vector<glm::vec3> positions;
+	vector<unsigned char> kinds;
+	vector<Quadric> quadrics;
+	vector<unsigned int> table;
+	// vertices at every position: copies[copyOffsets[p] .. copyOffsets[p + 1])
+	vector<unsigned int> copies, copyOffsets;
+	// triangles around every position: adjacency[adjacencyOffsets[p] .. adjacencyOffsets[p + 1])
+	vector<unsigned int> adjacency, adjacencyOffsets;
+	// cheapest collapse of every position and its error, sorted by error for each pass
+	vector<unsigned int> collapseTargets, collapseOrder;
+	vector<float> collapseErrors;
+	vector<char> touched;
+	// vertex of the target every vertex of the collapsing position moves onto
+	vector<unsigned int> partners;
+	// border positions of every mesh added, once per mesh, and sorted those found in more than one
+	vector<glm::vec3> borders, sharedBorders;
+	bool sharedBordersValid;
+
+	static bool lessPosition(const glm::vec3 &a, const glm::vec3 &b)
+	{
+		return a.x != b.x ? a.x < b.x : (a.y != b.y ? a.y < b.y : a.z < b.z);
+	}
+
+	// locks the positions of the mesh being simplified that other meshes have on their border too
+	void lockSharedBorders()
+	{
+		if (!sharedBordersValid)
+		{
+			sort(borders.begin(), borders.end(), lessPosition);
+			sharedBorders.clear();
+			for (size_t i = 1; i < borders.size(); i++)
+			{
+				// every mesh adds a position once, so a repeat means another mesh has it
+				if (borders[i] == borders[i - 1] && (sharedBorders.empty() || sharedBorders.back() != borders[i]))
+					sharedBorders.push_back(borders[i]);
+			}
+			sharedBordersValid = true;
+		}
+		if (sharedBorders.empty())
+			return;
+		for (size_t p = 0; p < positions.size(); p++)
+		{
+			if (binary_search(sharedBorders.begin(), sharedBorders.end(), positions[p], lessPosition))
+				kinds[p] = KIND_LOCKED;
+		}
+	}
+
+	void setupPositions(const vector<Vertex> &vertices, const vector<unsigned int> &indices)
+	{
+		size_t buckets = 1;
+		while (buckets < 2 * vertices.size())
+			buckets <<= 1;
+		const unsigned int EMPTY = 0xFFFFFFFFu;
+		table.assign(buckets, EMPTY);
+		positionIds.resize(vertices.size());
+		positions.clear();
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			// open addressing as in MeshOptimizer::Weld(), keyed by the position only
+			const glm::vec3 &position = vertices[i].Position;
+			size_t bucket = (size_t)hashBytes(&position, sizeof(position)) & (buckets - 1);
+			while (table[bucket] != EMPTY && memcmp(&positions[table[bucket]], &position, sizeof(position)) != 0)
+				bucket = (bucket + 1) & (buckets - 1);
+			if (table[bucket] == EMPTY)
+			{
+				table[bucket] = (unsigned int)positions.size();
+				positions.push_back(position);
+			}
+			positionIds[i] = table[bucket];
+		}
+		kinds.assign(positions.size(), KIND_MANIFOLD);
+
+		// the vertices the triangles use, grouped by position
+		vector<char> &used = touched;
+		used.assign(vertices.size(), 0);
+		for (size_t i = 0; i < indices.size(); i++)
+			used[indices[i]] = 1;
+		copyOffsets.assign(positions.size() + 1, 0);
+		for (size_t v = 0; v < vertices.size(); v++)
+			copyOffsets[positionIds[v] + 1] += used[v];
+		for (size_t p = 0; p < positions.size(); p++)
+			copyOffsets[p + 1] += copyOffsets[p];
+		copies.resize(copyOffsets.back());
+		vector<unsigned int> &filled = table;
+		filled.assign(copyOffsets.begin(), copyOffsets.end() - 1);
+		for (size_t v = 0; v < vertices.size(); v++)
+		{
+			if (used[v])
+				copies[filled[positionIds[v]]++] = (unsigned int)v;
+		}
+		partners.resize(vertices.size());
+	}
+
+	unsigned int countEdges(unsigned int from, unsigned int to, const vector<unsigned int> &indices) const
+	{
+		unsigned int count = 0;
+		for (unsigned int j = adjacencyOffsets[from]; j < adjacencyOffsets[from + 1]; j++)
+		{
+			const unsigned int *triangle = &indices[3 * adjacency[j]];
+			for (int corner = 0; corner < 3; corner++)
+			{
+				if (positionIds[triangle[corner]] == from && positionIds[triangle[(corner + 1) % 3]] == to)
+					count++;
+			}
+		}
+		return count;
+	}
+
+	// rebuilds the triangles around every position and marks the positions on open borders, and
+	// the ends of edges shared by more than two triangles as locked
+	void classify(const vector<unsigned int> &indices)
+	{
+		adjacencyOffsets.assign(positions.size() + 1, 0);
+		for (size_t i = 0; i < indices.size(); i++)
+			adjacencyOffsets[positionIds[indices[i]] + 1]++;
+		for (size_t p = 0; p < positions.size(); p++)
+			adjacencyOffsets[p + 1] += adjacencyOffsets[p];
+		adjacency.resize(indices.size());
+		vector<unsigned int> &filled = table;
+		filled.assign(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+			adjacency[filled[positionIds[indices[i]]]++] = (unsigned int)(i / 3);
+
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			unsigned int from = positionIds[indices[i]];
+			unsigned int to = positionIds[indices[i - i % 3 + (i + 1) % 3]];
+			unsigned int forward = countEdges(from, to, indices), backward = countEdges(to, from, indices);
+			if (forward > 1 || backward > 1)
+			{
+				kinds[from] = KIND_LOCKED;
+				kinds[to] = KIND_LOCKED;
+			}
+			else if (backward == 0)
+			{
+				kinds[from] = max(kinds[from], (unsigned char)KIND_BORDER);
+				kinds[to] = max(kinds[to], (unsigned char)KIND_BORDER);
+			}
+		}
+	}
+
+	// area weighted planes of the triangles, and along open borders a plane upright on the
+	// triangle through the edge, so border positions are kept from wandering off the outline
+	void setupQuadrics(const vector<unsigned int> &indices)
+	{
+		quadrics.assign(positions.size(), Quadric());
+		for (size_t t = 0; t < indices.size() / 3; t++)
+		{
+			unsigned int ids[3] = { positionIds[indices[3 * t]], positionIds[indices[3 * t + 1]], positionIds[indices[3 * t + 2]] };
+			glm::vec3 normal = glm::cross(positions[ids[1]] - positions[ids[0]], positions[ids[2]] - positions[ids[0]]);
+			float length = glm::length(normal);
+			if (length == 0.0f)
+				continue;
+			normal /= length;
+			Quadric plane = Quadric::Plane(normal, -glm::dot(normal, positions[ids[0]]), length * 0.5f);
+			for (int corner = 0; corner < 3; corner++)
+				quadrics[ids[corner]].Add(plane);
+			for (int corner = 0; corner < 3; corner++)
+			{
+				unsigned int from = ids[corner], to = ids[(corner + 1) % 3];
+				if (countEdges(to, from, indices) != 0)
+					continue;
+				glm::vec3 edge = positions[to] - positions[from];
+				glm::vec3 side = glm::cross(edge, normal);
+				float sideLength = glm::length(side);
+				if (sideLength == 0.0f)
+					continue;
+				side /= sideLength;
+				Quadric border = Quadric::Plane(side, -glm::dot(side, positions[from]), glm::dot(edge, edge));
+				quadrics[from].Add(border);
+				quadrics[to].Add(border);
+			}
+		}
+	}
+
+	// finds for every vertex at source a vertex at target it shares a triangle with and stores it
+	// in partners, returns false if one of them has none
+	bool findPartners(unsigned int source, unsigned int target, const vector<unsigned int> &indices)
+	{
+		for (unsigned int c = copyOffsets[source]; c < copyOffsets[source + 1]; c++)
+		{
+			unsigned int v = copies[c], partner = 0xFFFFFFFFu;
+			for (unsigned int j = adjacencyOffsets[source]; j < adjacencyOffsets[source + 1] && partner == 0xFFFFFFFFu; j++)
+			{
+				const unsigned int *triangle = &indices[3 * adjacency[j]];
+				if (triangle[0] != v && triangle[1] != v && triangle[2] != v)
+					continue;
+				for (int corner = 0; corner < 3; corner++)
+				{
+					if (positionIds[triangle[corner]] == target)
+						partner = triangle[corner];
+				}
+			}
+			// a vertex the collapses before left without triangles goes nowhere
+			bool unused = true;
+			for (unsigned int j = adjacencyOffsets[source]; j < adjacencyOffsets[source + 1] && unused; j++)
+			{
+				const unsigned int *triangle = &indices[3 * adjacency[j]];
+				unused = triangle[0] != v && triangle[1] != v && triangle[2] != v;
+			}
+			if (partner == 0xFFFFFFFFu && !unused)
+				return false;
+			partners[v] = partner;
+		}
+		return true;
+	}
+
+	bool canCollapse(unsigned int source, unsigned int target, const vector<unsigned int> &indices) const
+	{
+		if (source == target || kinds[source] == KIND_LOCKED)
+			return false;
+		return kinds[source] == KIND_MANIFOLD || countEdges(source, target, indices) == 0 || countEdges(target, source, indices) == 0;
+	}
+
+	// true if moving source onto target would turn a remaining triangle around it by more than ~75 degrees
+	bool flips(unsigned int source, unsigned int target, const vector<unsigned int> &indices) const
+	{
+		for (unsigned int j = adjacencyOffsets[source]; j < adjacencyOffsets[source + 1]; j++)
+		{
+			const unsigned int *triangle = &indices[3 * adjacency[j]];
+			glm::vec3 corners[3], moved[3];
+			bool collapses = false;
+			for (int corner = 0; corner < 3; corner++)
+			{
+				unsigned int id = positionIds[triangle[corner]];
+				collapses = collapses || id == target;
+				corners[corner] = positions[id];
+				moved[corner] = id == source ? positions[target] : positions[id];
+			}
+			if (collapses)
+				continue;
+			glm::vec3 before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+			glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+			if (glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after))
+				return true;
+		}
+		return false;
+	}
+
+	// one round of collapses, cheapest first and at most one per neighbourhood, until triangles are
+	// gone or the next one costs more than maxError. Returns how many collapses were made.
+	size_t collapsePass(vector<unsigned int> &indices, size_t triangles, float maxError, float &error)
+	{
+		const unsigned int NONE = 0xFFFFFFFFu;
+		collapseTargets.assign(positions.size(), NONE);
+		collapseErrors.assign(positions.size(), FLT_MAX);
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			unsigned int source = positionIds[indices[i]];
+			for (int side = 1; side < 3; side++)
+			{
+				unsigned int target = positionIds[indices[i - i % 3 + (i + side) % 3]];
+				if (target == collapseTargets[source] || !canCollapse(source, target, indices))
+					continue;
+				float cost = quadrics[source].Error(positions[target]);
+				if (cost < collapseErrors[source])
+				{
+					collapseErrors[source] = cost;
+					collapseTargets[source] = target;
+				}
+			}
+		}
+		collapseOrder.clear();
+		for (size_t p = 0; p < positions.size(); p++)
+		{
+			if (collapseTargets[p] != NONE && collapseErrors[p] <= maxError)
+				collapseOrder.push_back((unsigned int)p);
+		}
+		const vector<float> &errors = collapseErrors;
+		stable_sort(collapseOrder.begin(), collapseOrder.end(), [&errors](unsigned int a, unsigned int b) { return errors[a] < errors[b]; });
+
+		touched.assign(positions.size(), 0);
+		size_t collapsed = 0, removed = 0;
+		for (size_t i = 0; i < collapseOrder.size() && removed < triangles; i++)
+		{
+			unsigned int source = collapseOrder[i], target = collapseTargets[source];
+			if (touched[source] || touched[target] || flips(source, target, indices) || !findPartners(source, target, indices))
+				continue;
+			for (unsigned int j = adjacencyOffsets[source]; j < adjacencyOffsets[source + 1]; j++)
+			{
+				unsigned int *triangle = &indices[3 * adjacency[j]];
+				bool collapses = false;
+				for (int corner = 0; corner < 3; corner++)
+					collapses = collapses || positionIds[triangle[corner]] == target;
+				removed += collapses ? 1 : 0;
+				for (int corner = 0; corner < 3; corner++)
+				{
+					if (positionIds[triangle[corner]] == source)
+						triangle[corner] = partners[triangle[corner]];
+				}
+				// the triangles around source changed, what was worked out for their corners is stale
+				for (int corner = 0; corner < 3; corner++)
+					touched[positionIds[triangle[corner]]] = 1;
+			}
+			touched[source] = 1;
+			quadrics[target].Add(quadrics[source]);
+			error = max(error, collapseErrors[source]);
+			collapsed++;
+		}
+		return collapsed;
+	}
+
+	// drops the triangles that lost their area to a collapse
+	void removeDegenerates(vector<unsigned int> &indices) const
+	{
+		size_t kept = 0;
+		for (size_t t = 0; t < indices.size() / 3; t++)
+		{
+			unsigned int a = positionIds[indices[3 * t]], b = positionIds[indices[3 * t + 1]], c = positionIds[indices[3 * t + 2]];
+			if (a == b || b == c || c == a)
+				continue;
+			for (int corner = 0; corner < 3; corner++)
+				indices[kept++] = indices[3 * t + corner];
+		}
+		indices.resize(kept);
+	}
+};
+#endif
@@ -5,12 +5,16 @@
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
-#include <stb_image.h>
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
 #include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "recording_io_system.h"
+#include "texture_loader.h"
 #include "shader.h"
 
 #include <string>
@@ -21,7 +25,23 @@
 #include <vector>
 using namespace std;
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+// a mesh as ASSIMP and the optimizer hand it over, before its levels of detail are built
+struct ImportedMesh
+{
+	vector<Vertex> Vertices;
+	vector<unsigned int> Indices;
+	vector<Texture> Textures;
+	// only triangle meshes are optimized and simplified
+	bool Simplify;
+};
+
+// where a model's geometry lives, summed over its meshes
+struct ModelMemory
+{
+	size_t ResidentBytes;  // vertex and index arrays and BVHs still in system memory
+	size_t ReleasedBytes;  // vertex and index arrays that were dropped after the upload
+	size_t GpuBytes;       // vertex and index buffers, shared buffers are counted by every model using them
+};
 
 class Model
 {
@@ -34,58 +54,176 @@ public:
 
 	/*  Functions   */
 	// constructor, expects a filepath to a 3D model.
-	Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+	// textures are decoded through the given loader, the caller has to call its Finish() before rendering.
+	// without a loader the model decodes its own textures in parallel and waits for them here.
+	// with loadTextures false only the texture paths are recorded, for callers that sample the images some other way.
+	// retention says what the meshes keep in system memory after the upload; models that are tested for
+	// collisions or picked with rays need at least RETAIN_COLLISION.
+	Model(string const &path, bool gamma = false, TextureLoader *loader = NULL, bool loadTextures = true, Mesh_Retention retention = RETAIN_NONE)
+		: gammaCorrection(gamma), textureLoader(loader), loadTextures(loadTextures), optimizer(NULL), simplifier(NULL), retention(retention)
 	{
+		if (loader || !loadTextures)
+		{
+			loadModel(path);
+			return;
+		}
+		ThreadPool pool;
+		TextureLoader localLoader(pool);
+		textureLoader = &localLoader;
 		loadModel(path);
+		localLoader.Finish();
+		textureLoader = NULL;
+	}
+
+	// draws the model, and thus all its meshes, at the given level of detail (see LodSelector)
+	void Draw(const Shader &shader, unsigned int level = 0)
+	{
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].Draw(shader, level);
+	}
+
+	// draws every instance in the buffer, one instanced draw call per mesh
+	void DrawInstanced(const Shader &shader, const InstanceBuffer &instances, unsigned int level = 0)
+	{
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].DrawInstanced(shader, instances, level);
+	}
+
+	// levels of detail the model can be drawn at, level 0 is the full model. Meshes with fewer
+	// levels than others draw their coarsest one at the levels they lack.
+	unsigned int LodCount() const
+	{
+		return (unsigned int)lodErrors.size();
+	}
+
+	// how far, in model units, the model drawn at level is from the full one at most
+	float LodError(unsigned int level) const
+	{
+		return lodErrors[level < lodErrors.size() ? level : lodErrors.size() - 1];
+	}
+
+	size_t LodTriangles(unsigned int level) const
+	{
+		size_t triangles = 0;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			triangles += meshes[i].Lod(level).IndexCount / 3;
+		return triangles;
+	}
+
+	// true if both models draw from the same geometry buffers, so their instances can be drawn together
+	bool SharesGeometryWith(const Model &other) const
+	{
+		if (meshes.size() != other.meshes.size() || meshes.empty())
+			return false;
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			if (meshes[i].VAO != other.meshes[i].VAO)
+				return false;
+		}
+		return true;
+	}
+
+	// box and sphere around all meshes in model space, computed once after loading
+	const AABB &Bounds() const
+	{
+		return bounds;
+	}
+
+	const BoundingSphere &Sphere() const
+	{
+		return sphere;
 	}
 
-	// draws the model, and thus all its meshes
-	void Draw(Shader shader)
+	// exact test whether any triangle of this model, placed by model, touches one of other placed by otherModel
+	bool Intersects(const Model &other, const glm::mat4 &model, const glm::mat4 &otherModel) const
 	{
+		glm::mat4 otherToThis = glm::inverse(model) * otherModel;
 		for (unsigned int i = 0; i < meshes.size(); i++)
-			meshes[i].Draw(shader);
+		{
+			for (unsigned int j = 0; j < other.meshes.size(); j++)
+			{
+				if (meshes[i].bvh.Intersects(other.meshes[j].bvh, otherToThis))
+					return true;
+			}
+		}
+		return false;
 	}
 
-	float getCubeBoundingBox()
+	// closest hit of a world space ray with the model placed by model. The ray is moved into model
+	// space without normalizing the direction, so hit.Distance stays a parameter of the world ray.
+	bool Raycast(const glm::vec3 &origin, const glm::vec3 &direction, const glm::mat4 &model, float maxDistance, RayHit &hit) const
 	{
-		glm::vec3 minBoundary = glm::vec3(0.0f);
-		glm::vec3 maxBoundary = glm::vec3(0.0f);
+		glm::mat4 worldToModel = glm::inverse(model);
+		glm::vec3 localOrigin = glm::vec3(worldToModel * glm::vec4(origin, 1.0f));
+		glm::vec3 localDirection = glm::vec3(worldToModel * glm::vec4(direction, 0.0f));
+		bool found = false;
 		for (unsigned int i = 0; i < meshes.size(); i++)
 		{
-			Mesh mesh = meshes[i];
-			for (unsigned int j = 0; j < mesh.vertices.size(); j++)
+			if (meshes[i].bvh.Raycast(localOrigin, localDirection, maxDistance, hit))
 			{
-				glm::vec3 position = mesh.vertices[j].Position;
-				// compare vertex's position with min and max boundary
-				// min boundary
-				if (position.x < minBoundary.x)
-					minBoundary.x = position.x;
-				if (position.y < minBoundary.y)
-					minBoundary.y = position.y;
-				if (position.z < minBoundary.z)
-					minBoundary.z = position.z;
-				// max boundary
-				if (position.x > maxBoundary.x)
-					maxBoundary.x = position.x;
-				if (position.y > maxBoundary.y)
-					maxBoundary.y = position.y;
-				if (position.z > maxBoundary.z)
-					maxBoundary.z = position.z;
+				maxDistance = hit.Distance;
+				found = true;
 			}
 		}
-		float maxX = max(maxBoundary.x, abs(minBoundary.x));
-		float maxY = max(maxBoundary.y, abs(minBoundary.y));
-		float maxZ = max(maxBoundary.z, abs(minBoundary.z));
-		return max(max(maxX, maxY), maxZ);
+		return found;
+	}
+
+	ModelMemory Memory() const
+	{
+		ModelMemory memory = ModelMemory();
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			memory.ResidentBytes += meshes[i].ResidentBytes();
+			memory.ReleasedBytes += meshes[i].vertices.empty() ? meshes[i].DataBytes() : 0;
+			memory.GpuBytes += meshes[i].GpuBytes();
+		}
+		return memory;
+	}
+
+	// half size of the smallest cube centred on the origin that holds the model
+	float getCubeBoundingBox() const
+	{
+		if (bounds.IsEmpty())
+			return 0.0f;
+		glm::vec3 reach = glm::max(glm::abs(bounds.Min), glm::abs(bounds.Max));
+		return max(max(reach.x, reach.y), reach.z);
 	}
 
 private:
+	// only set while the model is loading
+	TextureLoader *textureLoader;
+	bool loadTextures;
+	// only set while ASSIMP's meshes are processed
+	MeshOptimizer *optimizer;
+	MeshSimplifier *simplifier;
+	vector<ImportedMesh> imported;
+	Mesh_Retention retention;
+	AABB bounds;
+	BoundingSphere sphere;
+	// the largest error of any mesh at every level of detail
+	vector<float> lodErrors;
+
 	/*  Functions   */
 	// loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+	// the processed meshes are cached next to the file, so ASSIMP only runs when the cache is missing or stale.
 	void loadModel(string const &path)
 	{
-		// read file via ASSIMP
+		// retrieve the directory path of the filepath
+		directory = path.substr(0, path.find_last_of('/'));
+
+		MeshCache cache(path);
+		if (cache.Load())
+		{
+			loadCachedMeshes(cache);
+			setupBounds();
+			setupLods();
+			return;
+		}
+
+		// read file via ASSIMP, noting the other files it reads for the cache; the importer owns the file system
 		Assimp::Importer importer;
+		RecordingIOSystem *files = new RecordingIOSystem();
+		importer.SetIOHandler(files);
 		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
 		// check for errors
 		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
@@ -93,11 +231,79 @@ private:
 			cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
 			return;
 		}
-		// retrieve the directory path of the filepath
-		directory = path.substr(0, path.find_last_of('/'));
 
-		// process ASSIMP's root node recursively
+		// process ASSIMP's root node recursively, every mesh is optimized for the vertex cache on the
+		// way; once all are known they are simplified into their levels of detail.
+		// this only happens when the cache is rebuilt, the cached meshes are stored optimized.
+		MeshOptimizer meshOptimizer;
+		MeshSimplifier meshSimplifier;
+		optimizer = &meshOptimizer;
+		simplifier = &meshSimplifier;
 		processNode(scene->mRootNode, scene);
+		addImportedMeshes();
+		optimizer = NULL;
+		simplifier = NULL;
+		setupBounds();
+		setupLods();
+		const MeshOptimizationReport &report = meshOptimizer.Total();
+		cout << "mesh optimizer: " << path << ": " << report.Triangles << " triangles, vertices " << report.VerticesBefore << " -> " << report.VerticesAfter
+			<< ", ACMR " << report.Before.ACMR << " -> " << report.After.ACMR << ", ATVR " << report.Before.ATVR << " -> " << report.After.ATVR << endl;
+		cout << "mesh lods: " << path << ":";
+		for (unsigned int level = 0; level < LodCount(); level++)
+			cout << (level > 0 ? "," : "") << " " << LodTriangles(level) << " triangles (error " << LodError(level) << ")";
+		cout << endl;
+
+		// store the result for the next start, the meshes kept their arrays until now for this
+		cache.Save(meshes, files->Paths());
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			meshes[i].Release(retention);
+	}
+
+	// merges the bounds the meshes computed when they were created, the vertices are not read again.
+	// the sphere is centred on the box and reaches around every mesh sphere.
+	void setupBounds()
+	{
+		bounds = AABB();
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			bounds.Expand(meshes[i].bounds);
+		sphere = BoundingSphere();
+		if (bounds.IsEmpty())
+			return;
+		sphere = BoundingSphere(bounds.Center(), 0.0f);
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			if (!meshes[i].sphere.IsEmpty())
+				sphere.Radius = max(sphere.Radius, glm::length(meshes[i].sphere.Center - sphere.Center) + meshes[i].sphere.Radius);
+		}
+	}
+
+	void setupLods()
+	{
+		lodErrors.clear();
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			if (meshes[i].LodCount() > lodErrors.size())
+				lodErrors.resize(meshes[i].LodCount(), 0.0f);
+		}
+		for (unsigned int level = 0; level < lodErrors.size(); level++)
+		{
+			for (unsigned int i = 0; i < meshes.size(); i++)
+				lodErrors[level] = max(lodErrors[level], meshes[i].Lod(level).Error);
+		}
+	}
+
+	// creates the meshes from a loaded cache, uploading vertex and index data straight from the mapped file
+	void loadCachedMeshes(const MeshCache &cache)
+	{
+		const vector<CachedMesh> &cached = cache.Meshes();
+		meshes.reserve(cached.size());
+		for (unsigned int i = 0; i < cached.size(); i++)
+		{
+			vector<Texture> textures;
+			for (unsigned int j = 0; j < cached[i].textures.size(); j++)
+				textures.push_back(loadTexture(cached[i].textures[j].path.c_str(), cached[i].textures[j].type));
+			meshes.push_back(Mesh(cached[i].vertices, cached[i].vertexCount, cached[i].indices, cached[i].indexCount, textures, cached[i].lods, retention));
+		}
 	}
 
 	// processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -109,7 +315,7 @@ private:
 			// the node object only contains indices to index the actual objects in the scene. 
 			// the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
 			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
+			processMesh(mesh, scene);
 		}
 		// after we've processed all of the meshes (if any) we then recursively process each of the children nodes
 		for (unsigned int i = 0; i < node->mNumChildren; i++)
@@ -119,7 +325,30 @@ private:
 
 	}
 
-	Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+	// simplifies the imported meshes and adds them to meshes. The borders of all of them are noted
+	// first, so the positions where meshes or the parts of a split mesh meet stay in place.
+	void addImportedMeshes()
+	{
+		for (unsigned int i = 0; i < imported.size(); i++)
+		{
+			if (imported[i].Simplify)
+				simplifier->AddBorders(imported[i].Vertices, imported[i].Indices);
+		}
+		meshes.reserve(meshes.size() + imported.size());
+		for (unsigned int i = 0; i < imported.size(); i++)
+		{
+			ImportedMesh &mesh = imported[i];
+			vector<MeshLod> lods;
+			if (mesh.Simplify)
+				lods = buildLods(mesh.Vertices, mesh.Indices);
+			// the arrays are kept until the cache is written
+			meshes.push_back(Mesh(std::move(mesh.Vertices), std::move(mesh.Indices), std::move(mesh.Textures), std::move(lods), retention, true));
+		}
+		vector<ImportedMesh>().swap(imported);
+	}
+
+	// adds the mesh to imported, as several meshes if it has too many vertices for 16-bit indices
+	void processMesh(aiMesh *mesh, const aiScene *scene)
 	{
 		// data to fill
 		vector<Vertex> vertices;
@@ -195,8 +424,52 @@ private:
 		std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
 		textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
 
-		// return a mesh object created from the extracted mesh data
-		return Mesh(vertices, indices, textures);
+		// weld, reorder for the vertex cache and fetch, and cut what 16-bit indices cannot address
+		// into parts that share the textures; meshes with points or lines are left as they are
+		bool triangles = mesh->mPrimitiveTypes == aiPrimitiveType_TRIANGLE;
+		if (triangles)
+		{
+			optimizer->Optimize(vertices, indices);
+			if (vertices.size() > MAX_SHORT_INDEXED_VERTICES)
+			{
+				vector<MeshPart> parts;
+				optimizer->Split(vertices, indices, MAX_SHORT_INDEXED_VERTICES, parts);
+				for (unsigned int i = 0; i < parts.size(); i++)
+				{
+					ImportedMesh part = { std::move(parts[i].Vertices), std::move(parts[i].Indices), textures, true };
+					imported.push_back(std::move(part));
+				}
+				return;
+			}
+		}
+
+		// keep the extracted mesh data for addImportedMeshes()
+		ImportedMesh result = { std::move(vertices), std::move(indices), std::move(textures), triangles };
+		imported.push_back(std::move(result));
+	}
+
+	// simplifies an optimized mesh into coarser levels, orders each for the vertex cache and appends
+	// it to indices; the full mesh stays at the front as level 0
+	vector<MeshLod> buildLods(const vector<Vertex> &vertices, vector<unsigned int> &indices)
+	{
+		vector<MeshLod> lods;
+		MeshLod full = { 0, (unsigned int)indices.size(), 0.0f };
+		lods.push_back(full);
+		if (vertices.empty())
+			return lods;
+		AABB box = BoundsOf(&vertices[0].Position, vertices.size(), sizeof(Vertex));
+		BoundingSphere around = SphereAround(box, &vertices[0].Position, vertices.size(), sizeof(Vertex));
+		vector<vector<unsigned int> > levels;
+		vector<float> errors;
+		simplifier->BuildLods(vertices, indices, around.Radius, levels, errors);
+		for (unsigned int i = 0; i < levels.size(); i++)
+		{
+			optimizer->OptimizeVertexCache(levels[i], vertices.size());
+			MeshLod lod = { (unsigned int)indices.size(), (unsigned int)levels[i].size(), errors[i] };
+			indices.insert(indices.end(), levels[i].begin(), levels[i].end());
+			lods.push_back(lod);
+		}
+		return lods;
 	}
 
 	// checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -208,69 +481,27 @@ private:
 		{
 			aiString str;
 			mat->GetTexture(type, i, &str);
-			// check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-			bool skip = false;
-			for (unsigned int j = 0; j < textures_loaded.size(); j++)
-			{
-				if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-				{
-					textures.push_back(textures_loaded[j]);
-					skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-					break;
-				}
-			}
-			if (!skip)
-			{   // if texture hasn't been loaded already, load it
-				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory);
-				texture.type = typeName;
-				texture.path = str.C_Str();
-				textures.push_back(texture);
-				textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-			}
+			textures.push_back(loadTexture(str.C_Str(), typeName));
 		}
 		return textures;
 	}
-};
-
-
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
-{
-	string filename = string(path);
-	filename = directory + '/' + filename;
 
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	int width, height, nrComponents;
-	unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-	if (data)
-	{
-		GLenum format;
-		if (nrComponents == 1)
-			format = GL_RED;
-		else if (nrComponents == 3)
-			format = GL_RGB;
-		else if (nrComponents == 4)
-			format = GL_RGBA;
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
-	}
-	else
+	// loads the texture at the given path relative to the model, unless it has been loaded before.
+	Texture loadTexture(const char *path, const string &typeName)
 	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
+		// check if texture was loaded before and if so, reuse it instead of loading a new texture
+		for (unsigned int j = 0; j < textures_loaded.size(); j++)
+		{
+			if (std::strcmp(textures_loaded[j].path.data(), path) == 0)
+				return textures_loaded[j]; // a texture with the same filepath has already been loaded. (optimization)
+		}
+		// if texture hasn't been loaded already, load it
+		Texture texture;
+		texture.id = loadTextures ? textureLoader->Load2D(this->directory + '/' + path) : 0;
+		texture.type = typeName;
+		texture.path = path;
+		textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+		return texture;
 	}
-
-	return textureID;
-}
+};
 #endif
\ No newline at end of file
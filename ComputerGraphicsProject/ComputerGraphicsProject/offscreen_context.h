@@ -0,0 +1,207 @@
+#ifndef OFFSCREEN_CONTEXT_H
+#define OFFSCREEN_CONTEXT_H
+
+#include <glad/glad.h>
+
+// On Linux the headless context is created through EGL so it runs on build boxes without
+// a display server (Mesa's llvmpipe provides a software GL 3.3 core context, e.g. with
+// LIBGL_ALWAYS_SOFTWARE=1). Everywhere else we fall back to an invisible GLFW window.
+#if defined(__linux__) && !defined(OFFSCREEN_USE_GLFW)
+#define OFFSCREEN_USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#else
+#include <GLFW/glfw3.h>
+#endif
+
+#include <iostream>
+
+// A GL 3.3 core context without a visible window, plus a framebuffer object that stands
+// in for the default framebuffer. Everything the render loop draws "to the screen" ends
+// up in Framebuffer() instead.
+class OffscreenContext
+{
+public:
+	OffscreenContext() : width(0), height(0), FBO(0), colorRBO(0), depthStencilRBO(0)
+	{
+#ifdef OFFSCREEN_USE_EGL
+		display = EGL_NO_DISPLAY;
+		surface = EGL_NO_SURFACE;
+		context = EGL_NO_CONTEXT;
+#else
+		window = NULL;
+#endif
+	}
+
+	~OffscreenContext()
+	{
+		Destroy();
+	}
+
+	// creates the context, makes it current, loads the GL functions and builds the target framebuffer
+	bool Create(unsigned int width, unsigned int height)
+	{
+		this->width = width;
+		this->height = height;
+		if (!createContext())
+			return false;
+		return createFramebuffer();
+	}
+
+	void Destroy()
+	{
+		if (FBO)
+		{
+			glDeleteFramebuffers(1, &FBO);
+			glDeleteRenderbuffers(1, &colorRBO);
+			glDeleteRenderbuffers(1, &depthStencilRBO);
+			FBO = colorRBO = depthStencilRBO = 0;
+		}
+#ifdef OFFSCREEN_USE_EGL
+		if (display != EGL_NO_DISPLAY)
+		{
+			eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			if (context != EGL_NO_CONTEXT)
+				eglDestroyContext(display, context);
+			if (surface != EGL_NO_SURFACE)
+				eglDestroySurface(display, surface);
+			eglTerminate(display);
+			display = EGL_NO_DISPLAY;
+			surface = EGL_NO_SURFACE;
+			context = EGL_NO_CONTEXT;
+		}
+#else
+		if (window)
+		{
+			glfwDestroyWindow(window);
+			glfwTerminate();
+			window = NULL;
+		}
+#endif
+	}
+
+	unsigned int Framebuffer() const
+	{
+		return FBO;
+	}
+
+private:
+	unsigned int width, height;
+	unsigned int FBO, colorRBO, depthStencilRBO;
+#ifdef OFFSCREEN_USE_EGL
+	EGLDisplay display;
+	EGLSurface surface;
+	EGLContext context;
+#else
+	GLFWwindow *window;
+#endif
+
+#ifdef OFFSCREEN_USE_EGL
+	bool createContext()
+	{
+		// prefer Mesa's surfaceless platform, it needs neither X11 nor a DRM device
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay)
+			display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		if (display == EGL_NO_DISPLAY)
+			display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL))
+		{
+			std::cout << "ERROR::OFFSCREEN:: failed to initialize EGL display" << std::endl;
+			return false;
+		}
+
+		const EGLint configAttribs[] = {
+			EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+			EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+			EGL_RED_SIZE, 8,
+			EGL_GREEN_SIZE, 8,
+			EGL_BLUE_SIZE, 8,
+			EGL_NONE
+		};
+		EGLConfig config;
+		EGLint numConfigs = 0;
+		if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0)
+		{
+			std::cout << "ERROR::OFFSCREEN:: no suitable EGL config" << std::endl;
+			return false;
+		}
+
+		// the pbuffer is only there to have something to make current, rendering goes to the FBO
+		const EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+		surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+
+		eglBindAPI(EGL_OPENGL_API);
+		const EGLint contextAttribs[] = {
+			EGL_CONTEXT_MAJOR_VERSION, 3,
+			EGL_CONTEXT_MINOR_VERSION, 3,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE
+		};
+		context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+		if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, surface, surface, context))
+		{
+			std::cout << "ERROR::OFFSCREEN:: failed to create GL 3.3 core context" << std::endl;
+			return false;
+		}
+
+		if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+		{
+			std::cout << "Failed to initialize GLAD" << std::endl;
+			return false;
+		}
+		return true;
+	}
+#else
+	bool createContext()
+	{
+		glfwInit();
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+		window = glfwCreateWindow(1, 1, "ComputerGraphicsProject", NULL, NULL);
+		if (window == NULL)
+		{
+			std::cout << "Failed to create GLFW window" << std::endl;
+			glfwTerminate();
+			return false;
+		}
+		glfwMakeContextCurrent(window);
+
+		if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+		{
+			std::cout << "Failed to initialize GLAD" << std::endl;
+			return false;
+		}
+		return true;
+	}
+#endif
+
+	// color + depth/stencil renderbuffers matching what the windowed path gets from GLFW
+	bool createFramebuffer()
+	{
+		glGenRenderbuffers(1, &colorRBO);
+		glBindRenderbuffer(GL_RENDERBUFFER, colorRBO);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glGenRenderbuffers(1, &depthStencilRBO);
+		glBindRenderbuffer(GL_RENDERBUFFER, depthStencilRBO);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glGenFramebuffers(1, &FBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRBO);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthStencilRBO);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			std::cout << "ERROR::OFFSCREEN:: framebuffer is not complete" << std::endl;
+			return false;
+		}
+		glViewport(0, 0, width, height);
+		return true;
+	}
+};
+#endif
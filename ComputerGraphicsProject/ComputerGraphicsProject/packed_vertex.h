@@ -0,0 +1,96 @@
+#ifndef PACKED_VERTEX_H
+#define PACKED_VERTEX_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+// Compact GPU copy of a Vertex, 20 bytes instead of 56:
+//   layout (location = 0) positions as 16-bit fractions of the mesh box (unsigned, normalized)
+//   layout (location = 1) octahedral normal (2 x signed normalized short)
+//   layout (location = 2) texture coordinates as half floats
+//   layout (location = 3) octahedral tangent (2 x signed normalized short)
+//   layout (location = 4) sign of the bitangent against cross(normal, tangent), +1 or -1
+// The vertex shaders turn the position and normal back with decodePosition() and decodeNormal(),
+// gated by the packedVertices uniform that Mesh sets for meshes in this format.
+struct PackedVertex {
+	uint16_t Position[3];
+	int16_t BitangentSign;
+	int16_t Normal[2];
+	int16_t Tangent[2];
+	uint16_t TexCoords[2];
+};
+static_assert(sizeof(PackedVertex) == 20, "PackedVertex has to stay 20 tightly packed bytes");
+
+// which of the two layouts a mesh uploads its vertices in
+enum Vertex_Format {
+	VERTEX_FULL,   // Vertex as it is, 56 bytes
+	VERTEX_PACKED  // PackedVertex, 20 bytes
+};
+
+// format that meshes created from now on upload in, VERTEX_FULL unless the application picks the
+// packed one before loading its models
+inline Vertex_Format &meshVertexFormat()
+{
+	static Vertex_Format format = VERTEX_FULL;
+	return format;
+}
+
+// IEEE half float with round to nearest; too large values become infinity, tiny ones zero
+inline uint16_t packHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint16_t sign = (uint16_t)((bits >> 16) & 0x8000u);
+	int exponent = (int)((bits >> 23) & 0xFFu) - 127 + 15;
+	uint32_t mantissa = bits & 0x7FFFFFu;
+	if (exponent >= 31)
+		return (uint16_t)(sign | 0x7C00u | (((bits >> 23) & 0xFFu) == 0xFFu && mantissa ? 0x200u : 0u));
+	if (exponent <= 0)
+	{
+		// denormal half, or zero below that
+		if (exponent < -10)
+			return sign;
+		mantissa |= 0x800000u;
+		unsigned int shift = (unsigned int)(14 - exponent);
+		uint32_t half = mantissa >> shift;
+		if ((mantissa >> (shift - 1)) & 1u)
+			half++;
+		return (uint16_t)(sign | half);
+	}
+	uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> 13);
+	// rounding may carry into the exponent, which is still the right result
+	if (mantissa & 0x1000u)
+		half++;
+	return (uint16_t)(sign | half);
+}
+
+// value in [-1, 1] as a signed normalized short
+inline int16_t packSnorm16(float value)
+{
+	value = value < -1.0f ? -1.0f : (value > 1.0f ? 1.0f : value);
+	return (int16_t)floor(value * 32767.0f + 0.5f);
+}
+
+// unit vector folded onto the octahedron and laid out flat in [-1, 1]^2
+inline void packOctahedral(const glm::vec3 &direction, int16_t *packed)
+{
+	float length = fabs(direction.x) + fabs(direction.y) + fabs(direction.z);
+	if (length == 0.0f)
+	{
+		packed[0] = packed[1] = 0;
+		return;
+	}
+	glm::vec3 n = direction / length;
+	float x = n.x, y = n.y;
+	if (n.z < 0.0f)
+	{
+		x = (1.0f - fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+		y = (1.0f - fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	packed[0] = packSnorm16(x);
+	packed[1] = packSnorm16(y);
+}
+#endif
@@ -1,67 +1,163 @@
 #pragma once
 #include "shader.h"
+#include "render_stats.h"
+#include "gl_state.h"
+#include "particle_system.h"
+#include "radix_sort.h"
+#include "random.h"
 #include <vector>
-#include <cstdlib>
-#include <ctime>
-
-typedef struct {
-	glm::vec3 position;
-	glm::vec3 velosity;
-	glm::vec3 acceleration;
-	glm::vec4 color;
-	GLfloat size;
-	GLfloat life;
-} Particle;
+#include <chrono>
+#include <cstddef>
 
+// state of one particle of the GPU simulation (see shaders/particle_update.vs); it starts like a
+// ParticleInstance, so the state buffer doubles as the instance buffer of particle.vs and a dead
+// particle, which has size 0, draws nothing
+struct GPUParticle {
+	glm::vec3 Offset;
+	GLfloat Size;
+	glm::vec4 Color;
+	glm::vec3 Velocity;
+	GLfloat Life;
+};
+
+// how the particles are combined with what is behind them
+enum Particle_Blend_Mode {
+	PARTICLE_ADDITIVE,     // glow, the order does not matter
+	PARTICLE_SORTED,       // alpha blended back to front, depth sorted on the CPU every frame
+	PARTICLE_WEIGHTED_OIT  // alpha blended with weighted blended order-independent transparency, no sort
+};
+
+// Draws particles with one instanced call. The particles come either from the emitters of a
+// ParticleSystem, simulated on the CPU (on the given thread pool) and streamed into an instance
+// buffer every frame, or from the GPU simulation.
+//
+// The GPU simulation keeps the particles on the GPU: they live in two state buffers and every
+// Update() runs particle_update.vs over one of them, capturing the result in the other with
+// transform feedback. The CPU only sets the emitter uniforms, so nothing is uploaded per frame.
+// It always uses the default EmitterSettings recipe. Its particles never reach the CPU, so they
+// cannot be sorted and PARTICLE_SORTED falls back to PARTICLE_WEIGHTED_OIT.
 class ParticleGenerator {
 public:
-	ParticleGenerator(GLuint amount) {
-		this->amount = amount;
+	// CPU emitters, added with AddEmitter()
+	ParticleGenerator(ThreadPool *pool)
+		: particles(pool), pool(pool), blendMode(PARTICLE_ADDITIVE), oitShader(NULL), compositeShader(NULL), oitFBO(0), targetFBO(0), targetWidth(0), targetHeight(0), amount(0), spawnRate(0.0f), spawnDebt(0.0f), rng(1), gpuSimulation(false), simulation(NULL), current(0), spawnCursor(0) {
 		this->init();
 	}
 
-	void Update(GLfloat dt, GLuint newParticles) {
-		// 
-		for (GLuint i = 0; i < newParticles; i++) {
-			int unusedParticle = this->firstUnusedParticle();
-			this->respawnParticle(this->particles[unusedParticle]);
+	// GPU simulation of amount particles, spawnRate new ones per second; the seed fixes its
+	// random numbers, equal seeds give identical runs
+	ParticleGenerator(GLuint amount, float spawnRate, unsigned int seed)
+		: pool(NULL), blendMode(PARTICLE_ADDITIVE), oitShader(NULL), compositeShader(NULL), oitFBO(0), targetFBO(0), targetWidth(0), targetHeight(0), amount(amount), spawnRate(spawnRate), spawnDebt(0.0f), rng(seed), gpuSimulation(true), simulation(NULL), current(0), spawnCursor(0) {
+		this->init();
+		this->initSimulation();
+	}
+
+	~ParticleGenerator() {
+		glDeleteVertexArrays(1, &this->VAO);
+		glDeleteBuffers(1, &this->VBO);
+		glDeleteBuffers(1, &this->instanceVBO);
+		if (this->gpuSimulation) {
+			glDeleteVertexArrays(2, this->simulationVAO);
+			glDeleteVertexArrays(2, this->renderVAO);
+			glDeleteBuffers(2, this->stateVBO);
+			glDeleteProgram(this->simulation->ID);
+			delete this->simulation;
+		}
+		if (this->oitShader) {
+			this->deleteOITTargets();
+			glDeleteVertexArrays(1, &this->emptyVAO);
+			glDeleteProgram(this->oitShader->ID);
+			glDeleteProgram(this->compositeShader->ID);
+			delete this->oitShader;
+			delete this->compositeShader;
 		}
+	}
 
-		// 
-		for (GLuint i = 0; i < this->amount; i++) {
-			Particle &p = this->particles[i];
-			// 
-			p.life -= dt;
-			if (p.life > 0.0f) {
-				// λ
-				p.position += p.velosity * dt + 0.5f * p.acceleration * dt * dt;
-				// ٶ
-				p.velosity += p.acceleration * dt;
-			}
+	unsigned int AddEmitter(const EmitterSettings &settings, unsigned int capacity, unsigned int seed) {
+		return this->particles.AddEmitter(settings, capacity, seed);
+	}
+
+	void SetBlendMode(Particle_Blend_Mode mode) {
+		this->blendMode = mode;
+	}
+
+	// framebuffer Draw() renders into and its size; PARTICLE_WEIGHTED_OIT accumulates into
+	// targets of the same size, which are composited onto it
+	void SetTarget(GLuint framebuffer, unsigned int width, unsigned int height) {
+		this->targetFBO = framebuffer;
+		if (width != this->targetWidth || height != this->targetHeight)
+			this->deleteOITTargets();
+		this->targetWidth = width;
+		this->targetHeight = height;
+	}
+
+	void Update(GLfloat dt) {
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		if (this->gpuSimulation)
+			this->simulate(dt);
+		else {
+			// 
+			this->particles.Update(dt);
+			renderStats().ParticleOverflows += this->particles.TakeOverflows();
 		}
+		renderStats().ParticleSimulateMs += elapsedMs(start);
 	}
 
-	void Draw(Shader shader, GLuint textureID) {
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-		for (Particle particle : this->particles) {
-			if (particle.life > 0) {
-				shader.use();
-				shader.setVec3("offset", particle.position);
-				shader.setVec4("color", particle.color);
-				shader.setFloat("size", particle.size);
-				glActiveTexture(GL_TEXTURE0);
-				glBindTexture(GL_TEXTURE_2D, textureID);
-				glBindVertexArray(this->VAO);
-				glDrawArrays(GL_TRIANGLES, 0, 6);
-			}
+	// streams the live particles of all emitters into the instance buffer and draws them with
+	// one call (the GPU simulation draws every slot, dead ones are degenerate)
+	void Draw(const Shader &shader, GLuint textureID) {
+		GLuint instances = this->gpuSimulation ? this->amount : this->uploadInstances();
+		if (instances == 0)
+			return;
+		glState().SetBlend(true);
+		if (this->blendMode == PARTICLE_ADDITIVE) {
+			glState().BlendFunc(GL_SRC_ALPHA, GL_ONE);
+			this->drawInstances(shader, textureID, instances);
+			glState().BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		}
+		else if (this->blendMode == PARTICLE_SORTED && !this->gpuSimulation) {
+			// sorted back to front, so later particles blend over earlier ones; they must not
+			// hide each other through the depth buffer
+			glState().BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			glState().DepthMask(false);
+			this->drawInstances(shader, textureID, instances);
+			glState().DepthMask(true);
 		}
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		else
+			this->drawWeightedOIT(textureID, instances);
+		glState().SetBlend(false);
 	}
 
 private:
-	std::vector<Particle> particles;
+	ParticleSystem particles;
+	ThreadPool *pool;
+	GLuint VAO, VBO, instanceVBO;
+	Particle_Blend_Mode blendMode;
+
+	// PARTICLE_SORTED: the live instances, their depth keys and the drawing order sorted by them
+	std::vector<ParticleInstance> packed;
+	std::vector<uint32_t> depthKeys, order;
+	RadixSorter sorter;
+
+	// PARTICLE_WEIGHTED_OIT: accumulation targets, created on first use
+	Shader *oitShader, *compositeShader;
+	GLuint oitFBO, accumulationTexture, weightTexture, depthRBO, emptyVAO;
+	GLuint targetFBO;
+	unsigned int targetWidth, targetHeight;
+
+	// GPU simulation: ping-pong state buffers, stateVBO[current] holds the latest state
 	GLuint amount;
-	GLuint VAO, VBO;
+	float spawnRate, spawnDebt;
+	RandomGenerator rng;
+	bool gpuSimulation;
+	Shader *simulation;
+	GLuint stateVBO[2], simulationVAO[2], renderVAO[2];
+	GLuint current;
+	// first slot of the next spawn window, the window moves around the buffer like a ring
+	GLuint spawnCursor;
+
+	ParticleGenerator(const ParticleGenerator &) = delete;
+	ParticleGenerator &operator=(const ParticleGenerator &) = delete;
 
 	void init() {
 		GLfloat particle_quad[] = {
@@ -87,59 +183,269 @@ private:
 		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *)(3 * sizeof(GLfloat)));
 		glEnableVertexAttribArray(1);
 
-		for (GLuint i = 0; i < this->amount; i++) {
-			Particle particle;
-			particle.position = glm::vec3(0.0f);
-			particle.velosity = glm::vec3(0.0f);
-			particle.acceleration = glm::vec3(0.0f);
-			particle.color = glm::vec4(0.0f);
-			particle.size = 0.0f;
-			particle.life = 0.0f;
-			this->particles.push_back(particle);
+		// one ParticleInstance per live particle, the store is (re)allocated by uploadInstances()
+		glGenBuffers(1, &this->instanceVBO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->instanceVBO);
+		glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(ParticleInstance), (GLvoid *)offsetof(ParticleInstance, Offset));
+		glEnableVertexAttribArray(2);
+		glVertexAttribDivisor(2, 1);
+		glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(ParticleInstance), (GLvoid *)offsetof(ParticleInstance, Color));
+		glEnableVertexAttribArray(3);
+		glVertexAttribDivisor(3, 1);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+	}
+
+	void initSimulation() {
+		const char *varyings[] = { "outOffsetSize", "outColor", "outVelocityLife" };
+		this->simulation = new Shader("shaders/particle_update.vs", vector<const char *>(varyings, varyings + 3));
+
+		// every particle starts out dead
+		GPUParticle dead = { glm::vec3(0.0f), 0.0f, glm::vec4(0.0f), glm::vec3(0.0f), 0.0f };
+		vector<GPUParticle> state(this->amount, dead);
+		glGenBuffers(2, this->stateVBO);
+		glGenVertexArrays(2, this->simulationVAO);
+		glGenVertexArrays(2, this->renderVAO);
+		for (int i = 0; i < 2; i++) {
+			glBindBuffer(GL_ARRAY_BUFFER, this->stateVBO[i]);
+			glBufferData(GL_ARRAY_BUFFER, state.size() * sizeof(GPUParticle), state.data(), GL_DYNAMIC_COPY);
+
+			// input of particle_update.vs
+			glBindVertexArray(this->simulationVAO[i]);
+			glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(GPUParticle), (GLvoid *)offsetof(GPUParticle, Offset));
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(GPUParticle), (GLvoid *)offsetof(GPUParticle, Color));
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(GPUParticle), (GLvoid *)offsetof(GPUParticle, Velocity));
+			glEnableVertexAttribArray(2);
+
+			// the quad plus the state as instance attributes of particle.vs
+			glBindVertexArray(this->renderVAO[i]);
+			glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *)0);
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid *)(3 * sizeof(GLfloat)));
+			glEnableVertexAttribArray(1);
+			glBindBuffer(GL_ARRAY_BUFFER, this->stateVBO[i]);
+			glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(GPUParticle), (GLvoid *)offsetof(GPUParticle, Offset));
+			glEnableVertexAttribArray(2);
+			glVertexAttribDivisor(2, 1);
+			glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(GPUParticle), (GLvoid *)offsetof(GPUParticle, Color));
+			glEnableVertexAttribArray(3);
+			glVertexAttribDivisor(3, 1);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+		glState().Invalidate();
+	}
+
+	// runs one simulation step on the GPU: dead particles in the spawn window are respawned, the
+	// rest age and move, and the result lands in the other state buffer
+	void simulate(GLfloat dt) {
+		this->spawnDebt += this->spawnRate * dt;
+		GLuint spawns = (GLuint)this->spawnDebt;
+		this->spawnDebt -= spawns;
+		spawns = spawns < this->amount ? spawns : this->amount;
+		EmitterSettings recipe;
+		this->simulation->use();
+		this->simulation->setFloat("deltaTime", dt);
+		this->simulation->setVec3("acceleration", recipe.Forces[0].Vector);
+		this->simulation->setInt("capacity", (int)this->amount);
+		this->simulation->setInt("spawnStart", (int)this->spawnCursor);
+		this->simulation->setInt("spawnCount", (int)spawns);
+		this->simulation->setInt("seed", (int)this->rng.Next());
+
+		glEnable(GL_RASTERIZER_DISCARD);
+		glState().BindVertexArray(this->simulationVAO[this->current]);
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, this->stateVBO[1 - this->current]);
+		glBeginTransformFeedback(GL_POINTS);
+		glDrawArrays(GL_POINTS, 0, this->amount);
+		glEndTransformFeedback();
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+		glDisable(GL_RASTERIZER_DISCARD);
+		renderStats().DrawCalls++;
+
+		this->current = 1 - this->current;
+		this->spawnCursor = (this->spawnCursor + spawns) % this->amount;
+	}
+
+	void drawInstances(const Shader &shader, GLuint textureID, GLuint instances) {
+		shader.use();
+		glState().BindTexture(0, GL_TEXTURE_2D, textureID);
+		glState().BindVertexArray(this->gpuSimulation ? this->renderVAO[this->current] : this->VAO);
+		glDrawArraysInstanced(GL_TRIANGLES, 0, 6, instances);
+		renderStats().DrawCalls++;
+	}
+
+	// Weighted blended OIT: every particle adds its weighted colour to one target and its weight
+	// to another while the blend function multiplies the revealage into the alpha of the first,
+	// then a full-screen pass divides the sums and blends the average over the target. The same
+	// blend function works for both targets, so glBlendFunci (GL 4.0) is not needed.
+	void drawWeightedOIT(GLuint textureID, GLuint instances) {
+		if (!this->oitShader)
+			this->initOIT();
+		if (!this->oitFBO && !this->createOITTargets())
+			return;
+
+		// the particles are still hidden by the scene: they test against a copy of its depth
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, this->targetFBO);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->oitFBO);
+		glBlitFramebuffer(0, 0, this->targetWidth, this->targetHeight, 0, 0, this->targetWidth, this->targetHeight, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		glState().BindFramebuffer(this->oitFBO);
+		const GLfloat clearAccumulation[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+		const GLfloat clearWeight[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		glClearBufferfv(GL_COLOR, 0, clearAccumulation);
+		glClearBufferfv(GL_COLOR, 1, clearWeight);
+
+		glState().BlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+		glState().DepthMask(false);
+		this->drawInstances(*this->oitShader, textureID, instances);
+		glState().DepthMask(true);
+		glState().BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+		glState().BindFramebuffer(this->targetFBO);
+		glState().SetDepthTest(false);
+		this->compositeShader->use();
+		glState().BindTexture(0, GL_TEXTURE_2D, this->accumulationTexture);
+		glState().BindTexture(1, GL_TEXTURE_2D, this->weightTexture);
+		glState().BindVertexArray(this->emptyVAO);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		renderStats().DrawCalls++;
+		glState().SetDepthTest(true);
+	}
+
+	void initOIT() {
+		this->oitShader = new Shader("shaders/particle.vs", "shaders/particle_oit.fs");
+		this->oitShader->use();
+		this->oitShader->setInt("sprite", 0);
+		this->compositeShader = new Shader("shaders/particle_composite.vs", "shaders/particle_composite.fs");
+		this->compositeShader->use();
+		this->compositeShader->setInt("accumulation", 0);
+		this->compositeShader->setInt("weight", 1);
+		// the composite pass makes its triangle from gl_VertexID, but core profile needs a bound VAO
+		glGenVertexArrays(1, &this->emptyVAO);
+	}
+
+	bool createOITTargets() {
+		if (this->targetWidth == 0 || this->targetHeight == 0) {
+			std::cout << "ERROR::PARTICLE:: weighted OIT needs SetTarget() first" << std::endl;
+			this->blendMode = PARTICLE_ADDITIVE;
+			return false;
 		}
+		glGenTextures(1, &this->accumulationTexture);
+		glBindTexture(GL_TEXTURE_2D, this->accumulationTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, this->targetWidth, this->targetHeight, 0, GL_RGBA, GL_HALF_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glGenTextures(1, &this->weightTexture);
+		glBindTexture(GL_TEXTURE_2D, this->weightTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, this->targetWidth, this->targetHeight, 0, GL_RED, GL_HALF_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		// same format as the depth of the window and of the offscreen context, so it can be blitted
+		glGenRenderbuffers(1, &this->depthRBO);
+		glBindRenderbuffer(GL_RENDERBUFFER, this->depthRBO);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, this->targetWidth, this->targetHeight);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glGenFramebuffers(1, &this->oitFBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, this->oitFBO);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->accumulationTexture, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, this->weightTexture, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, this->depthRBO);
+		const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(2, drawBuffers);
+		bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		glBindFramebuffer(GL_FRAMEBUFFER, this->targetFBO);
+		glState().Invalidate();
+		if (!complete) {
+			std::cout << "ERROR::PARTICLE:: weighted OIT framebuffer is not complete" << std::endl;
+			this->deleteOITTargets();
+			this->blendMode = PARTICLE_ADDITIVE;
+		}
+		return complete;
+	}
+
+	void deleteOITTargets() {
+		if (!this->oitFBO)
+			return;
+		glDeleteFramebuffers(1, &this->oitFBO);
+		glDeleteTextures(1, &this->accumulationTexture);
+		glDeleteTextures(1, &this->weightTexture);
+		glDeleteRenderbuffers(1, &this->depthRBO);
+		this->oitFBO = 0;
 	}
 
-	GLuint lastUsedParticle = 0;
-	GLuint firstUnusedParticle() {
-		for (GLuint i = lastUsedParticle; i < this->amount; i++) {
-			if (this->particles[i].life <= 0.0f) {
-				lastUsedParticle = i;
-				return i;
+	// Back to front: the depth of a particle is the z of its offset, which particle.vs uses as a
+	// clip-space position with w = 1. Keys and order are filled and the result gathered in chunks
+	// on the thread pool; the radix sort is O(n), so the cost grows linearly with the particles.
+	void sortByDepth(GLuint live) {
+		this->depthKeys.resize(live);
+		this->order.resize(live);
+		this->parallelFor(live, [this](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				// inverted, so the farthest particle gets the smallest key
+				this->depthKeys[i] = ~RadixSorter::FloatKey(this->packed[i].Offset.z);
+				this->order[i] = (uint32_t)i;
 			}
+		});
+		this->sorter.Sort(&this->depthKeys[0], &this->order[0], live, this->pool);
+	}
+
+	template <typename Body>
+	void parallelFor(size_t count, Body body) {
+		if (!this->pool) {
+			body(0, count);
+			return;
 		}
-		for (GLuint i = 0; i < lastUsedParticle; i++) {
-			if (this->particles[i].life <= 0.0f) {
-				lastUsedParticle = i;
-				return i;
+		this->pool->ParallelFor(count, std::max((size_t)RadixSorter::MIN_CHUNK, count / (this->pool->Size() + 1)), body);
+	}
+
+	static double elapsedMs(std::chrono::high_resolution_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	// orphans the instance buffer, so the GPU can keep reading last frame's copy, and lets the
+	// emitters write their live particles straight into the new store, or, when sorting, packs
+	// them on the side and copies them over in depth order; returns how many there are
+	GLuint uploadInstances() {
+		GLuint capacity = this->particles.Capacity();
+		if (capacity == 0)
+			return 0;
+		bool sorted = this->blendMode == PARTICLE_SORTED;
+		GLuint live = 0;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		if (sorted) {
+			this->packed.resize(capacity);
+			live = this->particles.Pack(&this->packed[0]);
+			renderStats().ParticlePackMs += elapsedMs(start);
+			start = std::chrono::high_resolution_clock::now();
+			this->sortByDepth(live);
+			renderStats().ParticleSortMs += elapsedMs(start);
+			start = std::chrono::high_resolution_clock::now();
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, this->instanceVBO);
+		glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(ParticleInstance), NULL, GL_STREAM_DRAW);
+		ParticleInstance *instances = (ParticleInstance *)glMapBufferRange(GL_ARRAY_BUFFER, 0, capacity * sizeof(ParticleInstance),
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (instances) {
+			if (sorted) {
+				this->parallelFor(live, [this, instances](size_t begin, size_t end) {
+					for (size_t i = begin; i < end; i++)
+						instances[i] = this->packed[this->order[i]];
+				});
+				renderStats().ParticleUploadMs += elapsedMs(start);
+			}
+			else {
+				live = this->particles.Pack(instances);
+				renderStats().ParticlePackMs += elapsedMs(start);
 			}
+			glUnmapBuffer(GL_ARRAY_BUFFER);
 		}
-		lastUsedParticle = 0;
-		return 0;
-	}
-
-	void respawnParticle(Particle &particle) {
-		// -11֮
-		float pos_rand_x = (float)rand() / (float)(RAND_MAX / 2) - 1.0f;
-		float pos_rand_y = (float)rand() / (float)(RAND_MAX / 2) - 1.0f;
-		float pos_rand_z = (float)rand() / (float)(RAND_MAX / 2) - 1.0f;
-		float vel_rand_x = (float)rand() / (float)(RAND_MAX / 2) - 1.0f;
-		float vel_rand_y = (float)rand() / (float)(RAND_MAX / 2) - 1.0f;
-		float vel_rand_z = (float)rand() / (float)(RAND_MAX / 2) - 1.0f;
-		// 0-1֮
-		float color_rand_r = (float)rand() / (float)RAND_MAX;
-		float color_rand_g = (float)rand() / (float)RAND_MAX;
-		float color_rand_b = (float)rand() / (float)RAND_MAX;
-		// λ
-		particle.position = glm::vec3(pos_rand_x, pos_rand_y, pos_rand_z);
-		// ٶ
-		particle.velosity = glm::vec3(vel_rand_x, vel_rand_y, vel_rand_z);
-		// Ӽٶ
-		particle.acceleration = glm::vec3(0.0f, -0.2f, 0.0f);
-		// ɫ
-		particle.color = glm::vec4(color_rand_r, color_rand_g, color_rand_b, 1.0f);
-		// ӴС
-		particle.size = 0.05f;
-		// 
-		particle.life = 1.0f;
+		else
+			live = 0;
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		return live;
 	}
 };
\ No newline at end of file
@@ -0,0 +1,217 @@
+#ifndef PARTICLE_POOL_H
+#define PARTICLE_POOL_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define PARTICLE_POOL_SSE
+#endif
+using namespace std;
+
+// Particle state kept as a structure of arrays, one array per component, so the integration
+// loop streams through memory and handles four particles per SSE instruction.
+//
+// The live particles are always the first Live() slots: a particle that dies is replaced by
+// the last live one, so spawning is an append and nothing ever walks over dead slots. Slots
+// are therefore not stable, a particle may move to a lower index during Update().
+class ParticlePool
+{
+public:
+	// acceleration shared by every particle of the pool
+	glm::vec3 Acceleration;
+
+	ParticlePool(unsigned int capacity) : Acceleration(0.0f), capacity(capacity), live(0), overflows(0)
+	{
+		// padded to a whole number of SSE lanes, the integration loop runs over the padding too
+		size_t padded = (capacity + 3) & ~(size_t)3;
+		positionX.assign(padded, 0.0f);
+		positionY.assign(padded, 0.0f);
+		positionZ.assign(padded, 0.0f);
+		velocityX.assign(padded, 0.0f);
+		velocityY.assign(padded, 0.0f);
+		velocityZ.assign(padded, 0.0f);
+		life.assign(padded, 0.0f);
+		colors.assign(capacity, glm::vec4(0.0f));
+		sizes.assign(capacity, 0.0f);
+		lifetimes.assign(capacity, 0.0f);
+	}
+
+	// adds a particle in O(1), returns false and counts an overflow if the pool is full;
+	// live particles are never overwritten
+	bool Spawn(const glm::vec3 &position, const glm::vec3 &velocity, const glm::vec4 &color, float size, float lifetime)
+	{
+		if (live == capacity)
+		{
+			overflows++;
+			return false;
+		}
+		unsigned int i = live++;
+		positionX[i] = position.x;
+		positionY[i] = position.y;
+		positionZ[i] = position.z;
+		velocityX[i] = velocity.x;
+		velocityY[i] = velocity.y;
+		velocityZ[i] = velocity.z;
+		colors[i] = color;
+		sizes[i] = size;
+		life[i] = lifetime;
+		lifetimes[i] = lifetime;
+		return true;
+	}
+
+	// ages and moves every live particle by dt seconds, then drops the ones that ran out of life
+	void Update(float dt)
+	{
+		integrate(dt);
+		removeDead();
+	}
+
+	// pulls every live particle towards center, with an acceleration of strength times the distance
+	void Attract(const glm::vec3 &center, float strength, float dt)
+	{
+		float pull = strength * dt;
+		for (unsigned int i = 0; i < live; i++)
+		{
+			velocityX[i] += (center.x - positionX[i]) * pull;
+			velocityY[i] += (center.y - positionY[i]) * pull;
+			velocityZ[i] += (center.z - positionZ[i]) * pull;
+		}
+	}
+
+	// slows every live particle down by the given fraction of its velocity per second
+	void Drag(float coefficient, float dt)
+	{
+		float keep = max(0.0f, 1.0f - coefficient * dt);
+		for (unsigned int i = 0; i < live; i++)
+		{
+			velocityX[i] *= keep;
+			velocityY[i] *= keep;
+			velocityZ[i] *= keep;
+		}
+	}
+
+	unsigned int Live() const
+	{
+		return live;
+	}
+
+	unsigned int Capacity() const
+	{
+		return capacity;
+	}
+
+	// number of spawns refused so far because the pool was full
+	unsigned long long Overflows() const
+	{
+		return overflows;
+	}
+
+	glm::vec3 Position(unsigned int i) const
+	{
+		return glm::vec3(positionX[i], positionY[i], positionZ[i]);
+	}
+
+	glm::vec3 Velocity(unsigned int i) const
+	{
+		return glm::vec3(velocityX[i], velocityY[i], velocityZ[i]);
+	}
+
+	const glm::vec4 &Color(unsigned int i) const
+	{
+		return colors[i];
+	}
+
+	float Size(unsigned int i) const
+	{
+		return sizes[i];
+	}
+
+	float Life(unsigned int i) const
+	{
+		return life[i];
+	}
+
+	// how far the particle is through its life, 0 when spawned and 1 when it dies
+	float Age(unsigned int i) const
+	{
+		return 1.0f - life[i] / lifetimes[i];
+	}
+
+private:
+	unsigned int capacity;
+	unsigned int live;
+	unsigned long long overflows;
+	vector<float> positionX, positionY, positionZ;
+	vector<float> velocityX, velocityY, velocityZ;
+	vector<float> life;
+	// only read when drawing, so they stay interleaved, lifetimes are the life a particle started with
+	vector<glm::vec4> colors;
+	vector<float> sizes;
+	vector<float> lifetimes;
+
+	// p += v * dt + a * dt^2 / 2, v += a * dt, life -= dt for the live range
+	void integrate(float dt)
+	{
+		float moveX = 0.5f * Acceleration.x * dt * dt, moveY = 0.5f * Acceleration.y * dt * dt, moveZ = 0.5f * Acceleration.z * dt * dt;
+		float speedX = Acceleration.x * dt, speedY = Acceleration.y * dt, speedZ = Acceleration.z * dt;
+		unsigned int i = 0;
+#ifdef PARTICLE_POOL_SSE
+		__m128 step = _mm_set1_ps(dt);
+		__m128 moveX4 = _mm_set1_ps(moveX), moveY4 = _mm_set1_ps(moveY), moveZ4 = _mm_set1_ps(moveZ);
+		__m128 speedX4 = _mm_set1_ps(speedX), speedY4 = _mm_set1_ps(speedY), speedZ4 = _mm_set1_ps(speedZ);
+		for (; i < live; i += 4)
+		{
+			__m128 vx = _mm_loadu_ps(&velocityX[i]);
+			__m128 vy = _mm_loadu_ps(&velocityY[i]);
+			__m128 vz = _mm_loadu_ps(&velocityZ[i]);
+			_mm_storeu_ps(&positionX[i], _mm_add_ps(_mm_loadu_ps(&positionX[i]), _mm_add_ps(_mm_mul_ps(vx, step), moveX4)));
+			_mm_storeu_ps(&positionY[i], _mm_add_ps(_mm_loadu_ps(&positionY[i]), _mm_add_ps(_mm_mul_ps(vy, step), moveY4)));
+			_mm_storeu_ps(&positionZ[i], _mm_add_ps(_mm_loadu_ps(&positionZ[i]), _mm_add_ps(_mm_mul_ps(vz, step), moveZ4)));
+			_mm_storeu_ps(&velocityX[i], _mm_add_ps(vx, speedX4));
+			_mm_storeu_ps(&velocityY[i], _mm_add_ps(vy, speedY4));
+			_mm_storeu_ps(&velocityZ[i], _mm_add_ps(vz, speedZ4));
+			_mm_storeu_ps(&life[i], _mm_sub_ps(_mm_loadu_ps(&life[i]), step));
+		}
+#else
+		for (; i < live; i++)
+		{
+			positionX[i] += velocityX[i] * dt + moveX;
+			positionY[i] += velocityY[i] * dt + moveY;
+			positionZ[i] += velocityZ[i] * dt + moveZ;
+			velocityX[i] += speedX;
+			velocityY[i] += speedY;
+			velocityZ[i] += speedZ;
+			life[i] -= dt;
+		}
+#endif
+	}
+
+	// fills the slot of every dead particle with the last live one
+	void removeDead()
+	{
+		unsigned int i = 0;
+		while (i < live)
+		{
+			if (life[i] > 0.0f)
+			{
+				i++;
+				continue;
+			}
+			unsigned int last = --live;
+			positionX[i] = positionX[last];
+			positionY[i] = positionY[last];
+			positionZ[i] = positionZ[last];
+			velocityX[i] = velocityX[last];
+			velocityY[i] = velocityY[last];
+			velocityZ[i] = velocityZ[last];
+			life[i] = life[last];
+			colors[i] = colors[last];
+			sizes[i] = sizes[last];
+			lifetimes[i] = lifetimes[last];
+		}
+	}
+};
+#endif
@@ -0,0 +1,293 @@
+#ifndef PARTICLE_SYSTEM_H
+#define PARTICLE_SYSTEM_H
+
+#include <glm/glm.hpp>
+
+#include "particle_pool.h"
+#include "random.h"
+#include "thread_pool.h"
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+// per-instance attributes of particle.vs:
+//   layout (location = 2) in vec4 aOffsetSize;   (offset in xyz, size in w)
+//   layout (location = 3) in vec4 aColor;
+struct ParticleInstance {
+	glm::vec3 Offset;
+	float Size;
+	glm::vec4 Color;
+};
+
+// volume new particles of an emitter appear in, centred on EmitterSettings::Position
+enum Emitter_Shape {
+	EMITTER_POINT,
+	EMITTER_BOX,     // half sizes in Extent
+	EMITTER_SPHERE   // radius in Extent.x
+};
+
+enum Force_Field_Type {
+	FORCE_CONSTANT,  // adds Vector as acceleration, e.g. gravity or wind
+	FORCE_ATTRACTOR, // pulls towards Vector with Strength times the distance
+	FORCE_DRAG       // takes away Strength times the velocity per second
+};
+
+struct ForceField {
+	Force_Field_Type Type;
+	glm::vec3 Vector;
+	float Strength;
+
+	static ForceField Constant(const glm::vec3 &acceleration)
+	{
+		ForceField field = { FORCE_CONSTANT, acceleration, 0.0f };
+		return field;
+	}
+
+	static ForceField Attractor(const glm::vec3 &center, float strength)
+	{
+		ForceField field = { FORCE_ATTRACTOR, center, strength };
+		return field;
+	}
+
+	static ForceField Drag(float coefficient)
+	{
+		ForceField field = { FORCE_DRAG, glm::vec3(0.0f), coefficient };
+		return field;
+	}
+};
+
+// Everything that makes up the look of an emitter. The defaults are the recipe the particle
+// generator always had: particles all over [-1, 1]^3 with random velocities and colours that
+// live for a second under a little gravity.
+struct EmitterSettings {
+	Emitter_Shape Shape;
+	glm::vec3 Position;
+	glm::vec3 Extent;
+	// new particles per second
+	float Rate;
+	// every component of the start velocity is picked in [VelocityMin, VelocityMax]
+	glm::vec3 VelocityMin, VelocityMax;
+	// the life of every particle is picked in [LifetimeMin, LifetimeMax] seconds
+	float LifetimeMin, LifetimeMax;
+	// colour at birth, picked per component in [ColorMin, ColorMax]
+	glm::vec4 ColorMin, ColorMax;
+	// lifetime curve: size and alpha go linearly from start to end over the life of a particle
+	float SizeStart, SizeEnd;
+	float AlphaStart, AlphaEnd;
+	vector<ForceField> Forces;
+
+	EmitterSettings()
+		: Shape(EMITTER_BOX), Position(0.0f), Extent(1.0f), Rate(120.0f), VelocityMin(-1.0f), VelocityMax(1.0f),
+		LifetimeMin(1.0f), LifetimeMax(1.0f), ColorMin(0.0f, 0.0f, 0.0f, 1.0f), ColorMax(1.0f), SizeStart(0.05f), SizeEnd(0.05f),
+		AlphaStart(1.0f), AlphaEnd(1.0f)
+	{
+		Forces.push_back(ForceField::Constant(glm::vec3(0.0f, -0.2f, 0.0f)));
+	}
+};
+
+// One emitter: its settings, its own particle pool and random numbers. Emitters share nothing,
+// so different emitters can be updated on different threads at the same time.
+class ParticleEmitter
+{
+public:
+	EmitterSettings Settings;
+
+	ParticleEmitter(const EmitterSettings &settings, unsigned int capacity, uint64_t seed)
+		: Settings(settings), particles(capacity), rng(seed), spawnDebt(0.0f)
+	{
+	}
+
+	// spawns what the rate asks for since the last update, then applies the forces and moves everything by dt
+	void Update(float dt)
+	{
+		spawnDebt += Settings.Rate * dt;
+		unsigned int spawns = (unsigned int)spawnDebt;
+		spawnDebt -= spawns;
+		spawn(spawns);
+
+		particles.Acceleration = glm::vec3(0.0f);
+		for (size_t i = 0; i < Settings.Forces.size(); i++)
+		{
+			const ForceField &force = Settings.Forces[i];
+			if (force.Type == FORCE_CONSTANT)
+				particles.Acceleration += force.Vector;
+			else if (force.Type == FORCE_ATTRACTOR)
+				particles.Attract(force.Vector, force.Strength, dt);
+			else if (force.Type == FORCE_DRAG)
+				particles.Drag(force.Strength, dt);
+		}
+		particles.Update(dt);
+	}
+
+	// writes one instance per live particle, with the lifetime curve applied, and returns how many
+	unsigned int Pack(ParticleInstance *instances) const
+	{
+		unsigned int live = particles.Live();
+		for (unsigned int i = 0; i < live; i++)
+		{
+			float age = particles.Age(i);
+			instances[i].Offset = particles.Position(i);
+			instances[i].Size = Settings.SizeStart + (Settings.SizeEnd - Settings.SizeStart) * age;
+			instances[i].Color = particles.Color(i);
+			instances[i].Color.w *= Settings.AlphaStart + (Settings.AlphaEnd - Settings.AlphaStart) * age;
+		}
+		return live;
+	}
+
+	const ParticlePool &Particles() const
+	{
+		return particles;
+	}
+
+private:
+	ParticlePool particles;
+	RandomGenerator rng;
+	// fraction of a particle the rate has asked for but that has not been spawned yet
+	float spawnDebt;
+	// random numbers of the particles spawned by the current update
+	vector<glm::vec3> spawnPositions, spawnVelocities;
+	vector<glm::vec4> spawnColors;
+	vector<float> spawnLifetimes;
+
+	void spawn(unsigned int count)
+	{
+		if (count == 0)
+			return;
+		spawnPositions.resize(count);
+		spawnVelocities.resize(count);
+		spawnColors.resize(count);
+		spawnLifetimes.resize(count);
+		rng.Fill(&spawnPositions[0], count, -1.0f, 1.0f);
+		rng.Fill(&spawnVelocities[0], count, 0.0f, 1.0f);
+		rng.Fill(&spawnColors[0].x, 4 * count, 0.0f, 1.0f);
+		rng.Fill(&spawnLifetimes[0], count, Settings.LifetimeMin, Settings.LifetimeMax);
+		for (unsigned int i = 0; i < count; i++)
+		{
+			glm::vec3 velocity = Settings.VelocityMin + (Settings.VelocityMax - Settings.VelocityMin) * spawnVelocities[i];
+			glm::vec4 color = Settings.ColorMin + (Settings.ColorMax - Settings.ColorMin) * spawnColors[i];
+			particles.Spawn(Settings.Position + offset(spawnPositions[i]), velocity, color, Settings.SizeStart, spawnLifetimes[i]);
+		}
+	}
+
+	// turns a random point of [-1, 1]^3 into a point of the emitter shape
+	glm::vec3 offset(glm::vec3 point)
+	{
+		switch (Settings.Shape)
+		{
+		case EMITTER_BOX:
+			return point * Settings.Extent;
+		case EMITTER_SPHERE:
+			// rejection sampling keeps the points uniform inside the ball
+			while (glm::dot(point, point) > 1.0f)
+				point = glm::vec3(rng.Range(-1.0f, 1.0f), rng.Range(-1.0f, 1.0f), rng.Range(-1.0f, 1.0f));
+			return point * Settings.Extent.x;
+		default:
+			return glm::vec3(0.0f);
+		}
+	}
+};
+
+// A set of independent emitters. Update() spreads the emitters over a thread pool in chunks,
+// Pack() gathers all of them into one instance array so they can be drawn with a single call.
+// Without a pool everything runs on the calling thread.
+class ParticleSystem
+{
+public:
+	ParticleSystem(ThreadPool *pool = NULL) : pool(pool), overflowsReported(0)
+	{
+	}
+
+	// adds an emitter with room for capacity live particles and returns its index
+	unsigned int AddEmitter(const EmitterSettings &settings, unsigned int capacity, uint64_t seed)
+	{
+		emitters.push_back(ParticleEmitter(settings, capacity, seed));
+		return (unsigned int)(emitters.size() - 1);
+	}
+
+	ParticleEmitter &Emitter(unsigned int index)
+	{
+		return emitters[index];
+	}
+
+	unsigned int EmitterCount() const
+	{
+		return (unsigned int)emitters.size();
+	}
+
+	void Update(float dt)
+	{
+		forEachChunk([this, dt](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+				emitters[i].Update(dt);
+		});
+	}
+
+	// live particles over all emitters
+	unsigned int Live() const
+	{
+		unsigned int live = 0;
+		for (size_t i = 0; i < emitters.size(); i++)
+			live += emitters[i].Particles().Live();
+		return live;
+	}
+
+	// room for live particles over all emitters, the most Pack() will ever write
+	unsigned int Capacity() const
+	{
+		unsigned int capacity = 0;
+		for (size_t i = 0; i < emitters.size(); i++)
+			capacity += emitters[i].Particles().Capacity();
+		return capacity;
+	}
+
+	// spawns refused by full emitters since the last call
+	unsigned int TakeOverflows()
+	{
+		unsigned long long overflows = 0;
+		for (size_t i = 0; i < emitters.size(); i++)
+			overflows += emitters[i].Particles().Overflows();
+		unsigned int reported = (unsigned int)(overflows - overflowsReported);
+		overflowsReported = overflows;
+		return reported;
+	}
+
+	// writes the instances of every emitter one after another and returns how many there are
+	unsigned int Pack(ParticleInstance *instances)
+	{
+		firstInstance.resize(emitters.size());
+		unsigned int count = 0;
+		for (size_t i = 0; i < emitters.size(); i++)
+		{
+			firstInstance[i] = count;
+			count += emitters[i].Particles().Live();
+		}
+		forEachChunk([this, instances](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+				emitters[i].Pack(instances + firstInstance[i]);
+		});
+		return count;
+	}
+
+private:
+	ThreadPool *pool;
+	vector<ParticleEmitter> emitters;
+	unsigned long long overflowsReported;
+	// where the instances of every emitter start in the output of Pack()
+	vector<unsigned int> firstInstance;
+
+	// a few chunks per thread, so emitters of different sizes still keep every thread busy
+	template <typename Body>
+	void forEachChunk(Body body)
+	{
+		if (!pool)
+		{
+			body(0, emitters.size());
+			return;
+		}
+		size_t chunkSize = max((size_t)1, emitters.size() / ((pool->Size() + 1) * 4));
+		pool->ParallelFor(emitters.size(), chunkSize, body);
+	}
+};
+#endif
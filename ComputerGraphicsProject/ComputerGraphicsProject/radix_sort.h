@@ -0,0 +1,130 @@
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+
+#include "thread_pool.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+using namespace std;
+
+// Least significant digit radix sort of 32-bit keys that carry a 32-bit value along, three passes
+// of 11-bit digits, O(n) and stable. Every pass counts the digits of each chunk of the input, turns
+// the counts into write offsets and scatters; with a thread pool the chunks are counted and
+// scattered in parallel. A pass on which all keys have the same digit is skipped.
+//
+// The sorter keeps its scratch buffers and histograms between calls, so sorting the same amount
+// every frame allocates nothing after the first time.
+class RadixSorter
+{
+public:
+	// below this many keys per chunk the threads cost more than they save
+	static const size_t MIN_CHUNK = 16384;
+
+	// sorts keys[0..count) ascending, values[i] moves with keys[i]
+	void Sort(uint32_t *keys, uint32_t *values, size_t count, ThreadPool *pool = NULL)
+	{
+		if (count < 2)
+			return;
+		if (keyScratch.size() < count)
+		{
+			keyScratch.resize(count);
+			valueScratch.resize(count);
+		}
+		size_t threads = pool ? pool->Size() + 1 : 1;
+		size_t chunks = max((size_t)1, min(threads, count / MIN_CHUNK));
+		histograms.resize(chunks * RADIX);
+
+		uint32_t *sourceKeys = keys, *sourceValues = values;
+		uint32_t *targetKeys = &keyScratch[0], *targetValues = &valueScratch[0];
+		for (unsigned int shift = 0; shift < 32; shift += DIGIT_BITS)
+		{
+			forEachChunk(pool, chunks, [&](size_t chunk) {
+				size_t *histogram = &histograms[chunk * RADIX];
+				memset(histogram, 0, RADIX * sizeof(size_t));
+				for (size_t i = chunkBegin(count, chunks, chunk), end = chunkBegin(count, chunks, chunk + 1); i < end; i++)
+					histogram[(sourceKeys[i] >> shift) & (RADIX - 1)]++;
+			});
+			if (!toOffsets(chunks, count))
+				continue;
+			forEachChunk(pool, chunks, [&](size_t chunk) {
+				size_t *offsets = &histograms[chunk * RADIX];
+				for (size_t i = chunkBegin(count, chunks, chunk), end = chunkBegin(count, chunks, chunk + 1); i < end; i++)
+				{
+					size_t target = offsets[(sourceKeys[i] >> shift) & (RADIX - 1)]++;
+					targetKeys[target] = sourceKeys[i];
+					targetValues[target] = sourceValues[i];
+				}
+			});
+			swap(sourceKeys, targetKeys);
+			swap(sourceValues, targetValues);
+		}
+		// an odd number of passes leaves the result in the scratch buffers
+		if (sourceKeys != keys)
+		{
+			memcpy(keys, sourceKeys, count * sizeof(uint32_t));
+			memcpy(values, sourceValues, count * sizeof(uint32_t));
+		}
+	}
+
+	// key that sorts like the float itself: flips the sign bit of positive numbers and every bit
+	// of negative ones, so the unsigned order matches the float order
+	static uint32_t FloatKey(float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return bits ^ ((bits >> 31) ? 0xFFFFFFFFu : 0x80000000u);
+	}
+
+private:
+	static const unsigned int DIGIT_BITS = 11;
+	static const size_t RADIX = (size_t)1 << DIGIT_BITS;
+
+	vector<uint32_t> keyScratch, valueScratch;
+	// RADIX counts per chunk, turned into write offsets in place
+	vector<size_t> histograms;
+
+	static size_t chunkBegin(size_t count, size_t chunks, size_t chunk)
+	{
+		return count * chunk / chunks;
+	}
+
+	template <typename Body>
+	static void forEachChunk(ThreadPool *pool, size_t chunks, Body body)
+	{
+		if (!pool || chunks == 1)
+		{
+			for (size_t chunk = 0; chunk < chunks; chunk++)
+				body(chunk);
+			return;
+		}
+		pool->ParallelFor(chunks, 1, [&body](size_t begin, size_t end) {
+			for (size_t chunk = begin; chunk < end; chunk++)
+				body(chunk);
+		});
+	}
+
+	// digit d of chunk c starts after all smaller digits and after digit d of the chunks before c;
+	// returns false, leaving the counts alone, if every key has the same digit and the pass can go
+	bool toOffsets(size_t chunks, size_t count)
+	{
+		size_t offset = 0;
+		for (size_t digit = 0; digit < RADIX; digit++)
+		{
+			size_t total = 0;
+			for (size_t chunk = 0; chunk < chunks; chunk++)
+				total += histograms[chunk * RADIX + digit];
+			if (total == count)
+				return false;
+			for (size_t chunk = 0; chunk < chunks; chunk++)
+			{
+				size_t digitCount = histograms[chunk * RADIX + digit];
+				histograms[chunk * RADIX + digit] = offset;
+				offset += digitCount;
+			}
+		}
+		return true;
+	}
+};
+#endif
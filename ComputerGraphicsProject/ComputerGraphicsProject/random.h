@@ -0,0 +1,119 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+using namespace std;
+
+// Small seedable random number generator for the particle code: xoshiro128+ run as four
+// independent streams side by side. The lanes are updated with the same operations in a
+// fixed-size loop, which compilers turn into SSE instructions, and the batch functions write
+// four numbers per step. Every owner has its own generator, so there is no shared state between
+// threads, and the same seed always gives the same sequence.
+class RandomGenerator
+{
+public:
+	static const unsigned int LANES = 4;
+
+	RandomGenerator(uint64_t seed = 1)
+	{
+		Seed(seed);
+	}
+
+	// restarts the sequence, the lanes are filled from the seed with splitmix64
+	void Seed(uint64_t seed)
+	{
+		for (unsigned int lane = 0; lane < LANES; lane++)
+		{
+			uint64_t a = splitMix64(seed), b = splitMix64(seed);
+			s0[lane] = (uint32_t)a;
+			s1[lane] = (uint32_t)(a >> 32);
+			s2[lane] = (uint32_t)b;
+			s3[lane] = (uint32_t)(b >> 32);
+		}
+		buffered = 0;
+	}
+
+	uint32_t Next()
+	{
+		if (buffered == 0)
+		{
+			step(buffer);
+			buffered = LANES;
+		}
+		return buffer[--buffered];
+	}
+
+	// uniform in [0, 1)
+	float Float()
+	{
+		return toFloat(Next());
+	}
+
+	// uniform in [low, high)
+	float Range(float low, float high)
+	{
+		return low + (high - low) * Float();
+	}
+
+	// fills values[0..count) with numbers uniform in [low, high)
+	void Fill(float *values, size_t count, float low, float high)
+	{
+		float scale = high - low;
+		uint32_t block[LANES];
+		size_t i = 0;
+		for (; i + LANES <= count; i += LANES)
+		{
+			step(block);
+			for (unsigned int lane = 0; lane < LANES; lane++)
+				values[i + lane] = low + scale * toFloat(block[lane]);
+		}
+		for (; i < count; i++)
+			values[i] = low + scale * Float();
+	}
+
+	// fills vectors[0..count) with vectors whose components are uniform in [low, high)
+	void Fill(glm::vec3 *vectors, size_t count, float low, float high)
+	{
+		static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "glm::vec3 has to be three tightly packed floats");
+		Fill(&vectors[0].x, 3 * count, low, high);
+	}
+
+private:
+	uint32_t s0[LANES], s1[LANES], s2[LANES], s3[LANES];
+	uint32_t buffer[LANES];
+	unsigned int buffered;
+
+	// advances every lane by one and returns one number per lane
+	void step(uint32_t *out)
+	{
+		for (unsigned int lane = 0; lane < LANES; lane++)
+		{
+			out[lane] = s0[lane] + s3[lane];
+			uint32_t t = s1[lane] << 9;
+			s2[lane] ^= s0[lane];
+			s3[lane] ^= s1[lane];
+			s1[lane] ^= s2[lane];
+			s0[lane] ^= s3[lane];
+			s2[lane] ^= t;
+			s3[lane] = (s3[lane] << 11) | (s3[lane] >> 21);
+		}
+	}
+
+	// the top 24 bits, which are the best ones of xoshiro128+, as a float in [0, 1)
+	static float toFloat(uint32_t x)
+	{
+		return (x >> 8) * (1.0f / 16777216.0f);
+	}
+
+	static uint64_t splitMix64(uint64_t &state)
+	{
+		uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		return z ^ (z >> 31);
+	}
+};
+#endif
@@ -0,0 +1,138 @@
+#ifndef RECORDING_IO_SYSTEM_H
+#define RECORDING_IO_SYSTEM_H
+
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
+
+#include "mesh_cache.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+using namespace std;
+
+// read-only ASSIMP stream over a memory mapped file
+class MappedFileStream : public Assimp::IOStream
+{
+public:
+	MappedFileStream() : position(0)
+	{
+	}
+
+	bool Open(const string &path)
+	{
+		return file.Open(path);
+	}
+
+	size_t Read(void *buffer, size_t size, size_t count)
+	{
+		if (size == 0)
+			return 0;
+		count = min(count, (file.Size() - position) / size);
+		memcpy(buffer, file.Data() + position, size * count);
+		position += size * count;
+		return count;
+	}
+
+	size_t Write(const void *buffer, size_t size, size_t count)
+	{
+		return 0;
+	}
+
+	// as ASSIMP's MemoryIOStream, an offset from the end counts backwards
+	aiReturn Seek(size_t offset, aiOrigin origin)
+	{
+		if (origin == aiOrigin_END)
+		{
+			if (offset > file.Size())
+				return aiReturn_FAILURE;
+			position = file.Size() - offset;
+			return aiReturn_SUCCESS;
+		}
+		size_t base = origin == aiOrigin_CUR ? position : 0;
+		if (offset > file.Size() - base)
+			return aiReturn_FAILURE;
+		position = base + offset;
+		return aiReturn_SUCCESS;
+	}
+
+	size_t Tell() const
+	{
+		return position;
+	}
+
+	size_t FileSize() const
+	{
+		return file.Size();
+	}
+
+	void Flush()
+	{
+	}
+
+private:
+	MappedFile file;
+	size_t position;
+};
+
+// ASSIMP file system that reads through MappedFileStream and records every file the importer
+// looks for, so the mesh cache can check material libraries and other side files of a model
+// along with the model itself. Files that were probed but missing are recorded too: the cache
+// has to go stale when one of them appears later.
+class RecordingIOSystem : public Assimp::IOSystem
+{
+public:
+	bool Exists(const char *path) const
+	{
+		record(path);
+		ifstream file(path, ios::binary);
+		return file.good();
+	}
+
+	char getOsSeparator() const
+	{
+#ifdef _WIN32
+		return '\\';
+#else
+		return '/';
+#endif
+	}
+
+	// files are only ever opened for reading
+	Assimp::IOStream *Open(const char *path, const char *mode = "rb")
+	{
+		record(path);
+		if (strchr(mode, 'w') || strchr(mode, 'a'))
+			return NULL;
+		MappedFileStream *stream = new MappedFileStream();
+		if (!stream->Open(path))
+		{
+			delete stream;
+			return NULL;
+		}
+		return stream;
+	}
+
+	void Close(Assimp::IOStream *stream)
+	{
+		delete stream;
+	}
+
+	// every path asked for so far, each once, in the order of the first request
+	const vector<string> &Paths() const
+	{
+		return paths;
+	}
+
+private:
+	mutable vector<string> paths;
+
+	void record(const char *path) const
+	{
+		if (find(paths.begin(), paths.end(), path) == paths.end())
+			paths.push_back(path);
+	}
+};
+#endif
@@ -0,0 +1,52 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+// Per-frame counters filled in by the renderer and read back by the benchmark runner.
+// Every draw site bumps DrawCalls right after issuing its glDraw* call.
+struct RenderStats
+{
+	unsigned int DrawCalls;
+	// triangles the mesh draws submitted, every instance counted; skyboxes, planes and particles are left out
+	unsigned int Triangles;
+	// uniform locations used without resolving a name: UniformHandle::Set() and Shader's sampler / vertex decode tables
+	unsigned int UniformLookupsAvoided;
+	// binds and state changes passed on to the driver / dropped as redundant by GLStateCache
+	unsigned int StateChangesIssued;
+	unsigned int StateChangesSkipped;
+	// particles that could not be spawned because their pool was full
+	unsigned int ParticleOverflows;
+	// CPU time of the particle stages: simulation, packing the instances, the depth sort and
+	// writing the instance buffer (in ms, 0 for stages the current blend mode does not run)
+	double ParticleSimulateMs;
+	double ParticlePackMs;
+	double ParticleSortMs;
+	double ParticleUploadMs;
+
+	RenderStats()
+	{
+		Reset();
+	}
+
+	// called once at the start of every frame
+	void Reset()
+	{
+		DrawCalls = 0;
+		Triangles = 0;
+		UniformLookupsAvoided = 0;
+		StateChangesIssued = 0;
+		StateChangesSkipped = 0;
+		ParticleOverflows = 0;
+		ParticleSimulateMs = 0.0;
+		ParticlePackMs = 0.0;
+		ParticleSortMs = 0.0;
+		ParticleUploadMs = 0.0;
+	}
+};
+
+// the one RenderStats instance shared by every module of the project
+inline RenderStats &renderStats()
+{
+	static RenderStats stats;
+	return stats;
+}
+#endif
@@ -0,0 +1,372 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <glm/glm.hpp>
+
+#include "thread_pool.h"
+
+#include <vector>
+#include <cmath>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCENE_GRAPH_SSE
+#endif
+using namespace std;
+
+// Motion of a body relative to its parent: it orbits the parent around OrbitAxis at
+// Offset distance and spins around its own SpinAxis, i.e. the local transform is
+//   rotate(OrbitSpeed * t, OrbitAxis) * translate(Offset) * rotate(SpinSpeed * t, SpinAxis)
+// Speeds are in radians per second; a body with both speeds 0 never changes.
+struct OrbitMotion
+{
+	glm::vec3 OrbitAxis;
+	float OrbitSpeed;
+	glm::vec3 Offset;
+	glm::vec3 SpinAxis;
+	float SpinSpeed;
+
+	OrbitMotion() : OrbitAxis(0.0f, 1.0f, 0.0f), OrbitSpeed(0.0f), Offset(0.0f), SpinAxis(0.0f, 1.0f, 0.0f), SpinSpeed(0.0f) {}
+	OrbitMotion(glm::vec3 orbitAxis, float orbitSpeed, glm::vec3 offset, glm::vec3 spinAxis, float spinSpeed)
+		: OrbitAxis(orbitAxis), OrbitSpeed(orbitSpeed), Offset(offset), SpinAxis(spinAxis), SpinSpeed(spinSpeed) {}
+};
+
+// Flat transform hierarchy. Nodes are added after their parents and keep the index AddNode()
+// returns, but Update() works on slots: the nodes sorted by depth, each depth padded to a
+// multiple of four. Nodes of one depth never depend on each other, so every level is computed
+// four nodes at a time with SSE, and a big level can be split over a ThreadPool. The motions
+// are kept per group of four slots, field by field, so a group loads with a few vector reads.
+// Roots and padding slots have the slot after the last level as parent, which always holds the
+// identity. Only groups with an animated node, or below one that changed, are recomputed.
+class SceneGraph
+{
+public:
+	static const int NO_PARENT = -1;
+
+	SceneGraph() : layoutDirty(false)
+	{
+	}
+
+	void Reserve(size_t count)
+	{
+		parents.reserve(count);
+		motions.reserve(count);
+		slots.reserve(count);
+	}
+
+	// adds a body and returns its index, parent has to be NO_PARENT or an index returned before
+	unsigned int AddNode(int parent, const OrbitMotion &motion)
+	{
+		parents.push_back(parent);
+		motions.push_back(normalized(motion));
+		// placed by the next Update(), until then the world matrix reads as identity
+		slots.push_back((unsigned int)NO_SLOT);
+		layoutDirty = true;
+		return (unsigned int)(parents.size() - 1);
+	}
+
+	void SetMotion(unsigned int node, const OrbitMotion &motion)
+	{
+		motions[node] = normalized(motion);
+		if (slots[node] == NO_SLOT)
+			return;
+		storeMotion(slots[node], motions[node]);
+		flags[slots[node]] = LOCAL_DIRTY | (isAnimated(motions[node]) ? ANIMATED : 0);
+	}
+
+	// recomputes the world matrices for time t (seconds), sampled once by the caller for the whole
+	// frame. With a pool, levels of more than PARALLEL_GROUPS groups are split over its workers.
+	void Update(float t, ThreadPool *pool = NULL)
+	{
+		if (layoutDirty)
+			buildLayout();
+		for (size_t level = 0; level + 1 < levelStarts.size(); level++)
+		{
+			size_t first = levelStarts[level] / 4, groups = (levelStarts[level + 1] - levelStarts[level]) / 4;
+			if (pool && groups > PARALLEL_GROUPS)
+			{
+				pool->ParallelFor(groups, PARALLEL_GROUPS, [this, first, t](size_t begin, size_t end) {
+					for (size_t group = first + begin; group < first + end; group++)
+						updateGroup(group, t);
+				});
+				continue;
+			}
+			for (size_t group = first; group < first + groups; group++)
+				updateGroup(group, t);
+		}
+	}
+
+	const glm::mat4 &World(unsigned int node) const
+	{
+		static const glm::mat4 IDENTITY(1.0f);
+		return slots[node] == NO_SLOT ? IDENTITY : worlds[slots[node]];
+	}
+
+	size_t Size() const
+	{
+		return parents.size();
+	}
+
+private:
+	enum NodeFlags
+	{
+		LOCAL_DIRTY = 1,   // motion changed since the last update
+		ANIMATED = 2,      // local transform depends on time
+		WORLD_CHANGED = 4  // world matrix was rewritten in the last update
+	};
+
+	static const unsigned int NO_SLOT = 0xFFFFFFFFu;
+	// groups of four slots a worker takes at a time, and the fewest a level needs to be split at all
+	static const size_t PARALLEL_GROUPS = 256;
+	// floats a group keeps its motions in: 11 fields, four lanes each, padded to 12 fields
+	static const size_t GROUP_FLOATS = 48;
+	enum MotionField { ORBIT_X, ORBIT_Y, ORBIT_Z, ORBIT_SPEED, OFFSET_X, OFFSET_Y, OFFSET_Z, SPIN_X, SPIN_Y, SPIN_Z, SPIN_SPEED };
+
+	// by node
+	vector<int> parents;
+	vector<OrbitMotion> motions;
+	vector<unsigned int> slots;
+	// by slot, plus the identity slot at the end; padding slots have no motion and never change
+	vector<unsigned int> parentSlots;
+	vector<unsigned char> flags;
+	vector<glm::mat4> worlds;
+	vector<float> groupMotions;
+	// first slot of every depth, and the slot count at the end
+	vector<size_t> levelStarts;
+	bool layoutDirty;
+
+	static OrbitMotion normalized(const OrbitMotion &motion)
+	{
+		OrbitMotion result = motion;
+		result.OrbitAxis = glm::normalize(motion.OrbitAxis);
+		result.SpinAxis = glm::normalize(motion.SpinAxis);
+		return result;
+	}
+
+	static bool isAnimated(const OrbitMotion &motion)
+	{
+		return motion.OrbitSpeed != 0.0f || motion.SpinSpeed != 0.0f;
+	}
+
+	void storeMotion(unsigned int slot, const OrbitMotion &m)
+	{
+		float *group = &groupMotions[(slot / 4) * GROUP_FLOATS] + slot % 4;
+		const float values[] = { m.OrbitAxis.x, m.OrbitAxis.y, m.OrbitAxis.z, m.OrbitSpeed, m.Offset.x, m.Offset.y, m.Offset.z,
+			m.SpinAxis.x, m.SpinAxis.y, m.SpinAxis.z, m.SpinSpeed };
+		for (int field = 0; field <= SPIN_SPEED; field++)
+			group[field * 4] = values[field];
+	}
+
+	// sorts the nodes into slots by depth after nodes were added; every node is recomputed next
+	void buildLayout()
+	{
+		vector<unsigned int> depths(parents.size());
+		vector<size_t> counts;
+		for (size_t i = 0; i < parents.size(); i++)
+		{
+			depths[i] = parents[i] == NO_PARENT ? 0 : depths[parents[i]] + 1;
+			if (depths[i] >= counts.size())
+				counts.resize(depths[i] + 1, 0);
+			counts[depths[i]]++;
+		}
+		levelStarts.assign(1, 0);
+		for (size_t level = 0; level < counts.size(); level++)
+			levelStarts.push_back(levelStarts.back() + (counts[level] + 3) / 4 * 4);
+
+		size_t slotCount = levelStarts.back();
+		unsigned int identitySlot = (unsigned int)slotCount;
+		parentSlots.assign(slotCount, identitySlot);
+		flags.assign(slotCount + 1, 0);
+		worlds.assign(slotCount + 1, glm::mat4(1.0f));
+		groupMotions.assign(slotCount / 4 * GROUP_FLOATS, 0.0f);
+		vector<size_t> next(levelStarts.begin(), levelStarts.end() - 1);
+		for (size_t i = 0; i < parents.size(); i++)
+		{
+			unsigned int slot = (unsigned int)next[depths[i]]++;
+			slots[i] = slot;
+			parentSlots[slot] = parents[i] == NO_PARENT ? identitySlot : slots[parents[i]];
+			flags[slot] = LOCAL_DIRTY | (isAnimated(motions[i]) ? ANIMATED : 0);
+			storeMotion(slot, motions[i]);
+		}
+		layoutDirty = false;
+	}
+
+	// recomputes the four slots of a group if any of them changed, the others come out the same
+	void updateGroup(size_t group, float t)
+	{
+		size_t first = group * 4;
+		bool any = false;
+		for (size_t slot = first; slot < first + 4; slot++)
+		{
+			unsigned char slotFlags = flags[slot];
+			bool changed = (slotFlags & (LOCAL_DIRTY | ANIMATED)) != 0 || (flags[parentSlots[slot]] & WORLD_CHANGED) != 0;
+			flags[slot] = (slotFlags & ANIMATED) | (changed ? WORLD_CHANGED : 0);
+			any = any || changed;
+		}
+		if (any)
+			composeGroup(first, t);
+	}
+
+#ifdef SCENE_GRAPH_SSE
+	// sine and cosine of four angles: reduction by pi/2 in three parts, then the minimax
+	// polynomials of the Cephes sinf/cosf on [-pi/4, pi/4], picked by quadrant
+	static void sinCos(__m128 x, __m128 &sine, __m128 &cosine)
+	{
+		__m128i quadrant = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.636619772f)));
+		__m128 j = _mm_cvtepi32_ps(quadrant);
+		__m128 r = _mm_sub_ps(x, _mm_mul_ps(j, _mm_set1_ps(1.5703125f)));
+		r = _mm_sub_ps(r, _mm_mul_ps(j, _mm_set1_ps(4.837512969970703125e-4f)));
+		r = _mm_sub_ps(r, _mm_mul_ps(j, _mm_set1_ps(7.549789948768648e-8f)));
+		__m128 r2 = _mm_mul_ps(r, r);
+		__m128 s = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(-1.9515295891e-4f), r2), _mm_set1_ps(8.3321608736e-3f));
+		s = _mm_add_ps(_mm_mul_ps(s, r2), _mm_set1_ps(-1.6666654611e-1f));
+		s = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(s, r2), r), r);
+		__m128 c = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.443315711809948e-5f), r2), _mm_set1_ps(-1.388731625493765e-3f));
+		c = _mm_add_ps(_mm_mul_ps(c, r2), _mm_set1_ps(4.166664568298827e-2f));
+		c = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(c, r2), r2), _mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(_mm_set1_ps(0.5f), r2)));
+		// quadrant 1 and 3 swap sine and cosine, 2 and 3 negate the sine, 1 and 2 the cosine
+		__m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+		__m128 sineSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(2)), 30));
+		__m128 cosineSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+		sine = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s)), sineSign);
+		cosine = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c)), cosineSign);
+	}
+
+	// four lanes of 3x3 matrices and vectors; a matrix is m[column][row] as in glm
+	struct Lanes3
+	{
+		__m128 x, y, z;
+	};
+
+	struct Lanes33
+	{
+		Lanes3 c[3];
+	};
+
+	// a * v, row by row
+	static Lanes3 transform(const Lanes33 &a, const Lanes3 &v)
+	{
+		Lanes3 r;
+		r.x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.c[0].x, v.x), _mm_mul_ps(a.c[1].x, v.y)), _mm_mul_ps(a.c[2].x, v.z));
+		r.y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.c[0].y, v.x), _mm_mul_ps(a.c[1].y, v.y)), _mm_mul_ps(a.c[2].y, v.z));
+		r.z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.c[0].z, v.x), _mm_mul_ps(a.c[1].z, v.y)), _mm_mul_ps(a.c[2].z, v.z));
+		return r;
+	}
+
+	static Lanes33 multiply(const Lanes33 &a, const Lanes33 &b)
+	{
+		Lanes33 r;
+		r.c[0] = transform(a, b.c[0]);
+		r.c[1] = transform(a, b.c[1]);
+		r.c[2] = transform(a, b.c[2]);
+		return r;
+	}
+
+	// rotation of four lanes around unit axes, the same matrix as axisRotation() builds
+	static Lanes33 axisRotations(const float *axis, __m128 angle)
+	{
+		__m128 x = _mm_loadu_ps(axis), y = _mm_loadu_ps(axis + 4), z = _mm_loadu_ps(axis + 8);
+		__m128 s, c;
+		sinCos(angle, s, c);
+		__m128 oneMinusC = _mm_sub_ps(_mm_set1_ps(1.0f), c);
+		__m128 tx = _mm_mul_ps(oneMinusC, x), ty = _mm_mul_ps(oneMinusC, y), tz = _mm_mul_ps(oneMinusC, z);
+		__m128 sx = _mm_mul_ps(s, x), sy = _mm_mul_ps(s, y), sz = _mm_mul_ps(s, z);
+		Lanes33 r;
+		r.c[0].x = _mm_add_ps(c, _mm_mul_ps(tx, x));
+		r.c[0].y = _mm_add_ps(_mm_mul_ps(tx, y), sz);
+		r.c[0].z = _mm_sub_ps(_mm_mul_ps(tx, z), sy);
+		r.c[1].x = _mm_sub_ps(_mm_mul_ps(ty, x), sz);
+		r.c[1].y = _mm_add_ps(c, _mm_mul_ps(ty, y));
+		r.c[1].z = _mm_add_ps(_mm_mul_ps(ty, z), sx);
+		r.c[2].x = _mm_add_ps(_mm_mul_ps(tz, x), sy);
+		r.c[2].y = _mm_sub_ps(_mm_mul_ps(tz, y), sx);
+		r.c[2].z = _mm_add_ps(c, _mm_mul_ps(tz, z));
+		return r;
+	}
+
+	// one column of the world matrices of four slots, from lanes back to a vec4 per slot
+	void storeColumn(size_t first, int column, const Lanes3 &v, __m128 w)
+	{
+		__m128 x = v.x, y = v.y, z = v.z;
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+		_mm_storeu_ps(&worlds[first][column][0], x);
+		_mm_storeu_ps(&worlds[first + 1][column][0], y);
+		_mm_storeu_ps(&worlds[first + 2][column][0], z);
+		_mm_storeu_ps(&worlds[first + 3][column][0], w);
+	}
+
+	void composeGroup(size_t first, float t)
+	{
+		const float *group = &groupMotions[first / 4 * GROUP_FLOATS];
+		__m128 time = _mm_set1_ps(t);
+		Lanes33 orbit = axisRotations(group + ORBIT_X * 4, _mm_mul_ps(_mm_loadu_ps(group + ORBIT_SPEED * 4), time));
+		Lanes33 spin = axisRotations(group + SPIN_X * 4, _mm_mul_ps(_mm_loadu_ps(group + SPIN_SPEED * 4), time));
+		Lanes3 offset = { _mm_loadu_ps(group + OFFSET_X * 4), _mm_loadu_ps(group + OFFSET_Y * 4), _mm_loadu_ps(group + OFFSET_Z * 4) };
+
+		// the parents' world matrices turned into lanes
+		const float *p0 = &worlds[parentSlots[first]][0][0], *p1 = &worlds[parentSlots[first + 1]][0][0];
+		const float *p2 = &worlds[parentSlots[first + 2]][0][0], *p3 = &worlds[parentSlots[first + 3]][0][0];
+		Lanes33 parent;
+		Lanes3 parentTranslation;
+		Lanes3 *columns[4] = { &parent.c[0], &parent.c[1], &parent.c[2], &parentTranslation };
+		for (int column = 0; column < 4; column++)
+		{
+			__m128 a = _mm_loadu_ps(p0 + 4 * column), b = _mm_loadu_ps(p1 + 4 * column);
+			__m128 c = _mm_loadu_ps(p2 + 4 * column), d = _mm_loadu_ps(p3 + 4 * column);
+			_MM_TRANSPOSE4_PS(a, b, c, d);
+			columns[column]->x = a;
+			columns[column]->y = b;
+			columns[column]->z = c;
+		}
+
+		Lanes33 rotation = multiply(parent, multiply(orbit, spin));
+		Lanes3 translation = transform(parent, transform(orbit, offset));
+		translation.x = _mm_add_ps(translation.x, parentTranslation.x);
+		translation.y = _mm_add_ps(translation.y, parentTranslation.y);
+		translation.z = _mm_add_ps(translation.z, parentTranslation.z);
+		storeColumn(first, 0, rotation.c[0], _mm_setzero_ps());
+		storeColumn(first, 1, rotation.c[1], _mm_setzero_ps());
+		storeColumn(first, 2, rotation.c[2], _mm_setzero_ps());
+		storeColumn(first, 3, translation, _mm_set1_ps(1.0f));
+	}
+#else
+	void composeGroup(size_t first, float t)
+	{
+		const float *group = &groupMotions[first / 4 * GROUP_FLOATS];
+		for (size_t lane = 0; lane < 4; lane++)
+		{
+			const float *m = group + lane;
+			glm::vec3 orbitAxis(m[ORBIT_X * 4], m[ORBIT_Y * 4], m[ORBIT_Z * 4]);
+			glm::vec3 offset(m[OFFSET_X * 4], m[OFFSET_Y * 4], m[OFFSET_Z * 4]);
+			glm::vec3 spinAxis(m[SPIN_X * 4], m[SPIN_Y * 4], m[SPIN_Z * 4]);
+			glm::mat3 orbit = axisRotation(orbitAxis, m[ORBIT_SPEED * 4] * t);
+			glm::mat3 rotation = orbit * axisRotation(spinAxis, m[SPIN_SPEED * 4] * t);
+			glm::vec3 translation = orbit * offset;
+			const glm::mat4 &p = worlds[parentSlots[first + lane]];
+			glm::mat3 parentRotation(p);
+			rotation = parentRotation * rotation;
+			translation = parentRotation * translation + glm::vec3(p[3]);
+			worlds[first + lane] = glm::mat4(glm::vec4(rotation[0], 0.0f), glm::vec4(rotation[1], 0.0f), glm::vec4(rotation[2], 0.0f), glm::vec4(translation, 1.0f));
+		}
+	}
+
+	// rotation around a unit axis, same as glm::rotate but without building a 4x4 matrix product
+	static glm::mat3 axisRotation(const glm::vec3 &axis, float angle)
+	{
+		float c = cos(angle);
+		float s = sin(angle);
+		glm::vec3 temp = (1.0f - c) * axis;
+		glm::mat3 r;
+		r[0][0] = c + temp[0] * axis[0];
+		r[0][1] = temp[0] * axis[1] + s * axis[2];
+		r[0][2] = temp[0] * axis[2] - s * axis[1];
+		r[1][0] = temp[1] * axis[0] - s * axis[2];
+		r[1][1] = c + temp[1] * axis[1];
+		r[1][2] = temp[1] * axis[2] + s * axis[0];
+		r[2][0] = temp[2] * axis[0] + s * axis[1];
+		r[2][1] = temp[2] * axis[1] - s * axis[0];
+		r[2][2] = c + temp[2] * axis[2];
+		return r;
+	}
+#endif
+};
+#endif
@@ -4,10 +4,93 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include "render_stats.h"
+#include "frame_data.h"
+#include "gl_state.h"
+
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+
+// Material samplers a mesh can bind, following the model loader's naming scheme
+// texture_diffuseN, texture_specularN, texture_normalN and texture_heightN with N = 1..MAX_SAMPLERS_PER_TYPE.
+// Shader resolves the location of every one of them after linking, so drawing a mesh needs no sampler names.
+enum Material_Sampler_Type {
+	SAMPLER_DIFFUSE,
+	SAMPLER_SPECULAR,
+	SAMPLER_NORMAL,
+	SAMPLER_HEIGHT,
+	SAMPLER_TYPE_COUNT
+};
+const unsigned int MAX_SAMPLERS_PER_TYPE = 4;
+const unsigned int MATERIAL_SAMPLER_COUNT = SAMPLER_TYPE_COUNT * MAX_SAMPLERS_PER_TYPE;
+
+// type prefix as used in the GLSL sampler names, indexed by Material_Sampler_Type
+inline const char *materialSamplerPrefix(unsigned int type)
+{
+	static const char *const prefixes[SAMPLER_TYPE_COUNT] = { "texture_diffuse", "texture_specular", "texture_normal", "texture_height" };
+	return prefixes[type];
+}
+
+// slot of the N-th (1-based) sampler of a type, the index into Shader's sampler location table
+inline unsigned int materialSamplerSlot(unsigned int type, unsigned int number)
+{
+	return type * MAX_SAMPLERS_PER_TYPE + number - 1;
+}
+
+// uniforms the vertex shaders decode packed mesh vertices with (see packed_vertex.h), -1 where
+// the program has none
+struct VertexDecodeLocations {
+	GLint Packed;
+	GLint PositionOffset;
+	GLint PositionScale;
+};
+
+// glUniform* overloads used by UniformHandle
+inline void setUniformValue(GLint location, bool value) { glUniform1i(location, (int)value); }
+inline void setUniformValue(GLint location, int value) { glUniform1i(location, value); }
+inline void setUniformValue(GLint location, float value) { glUniform1f(location, value); }
+inline void setUniformValue(GLint location, const glm::vec2 &value) { glUniform2fv(location, 1, &value[0]); }
+inline void setUniformValue(GLint location, const glm::vec3 &value) { glUniform3fv(location, 1, &value[0]); }
+inline void setUniformValue(GLint location, const glm::vec4 &value) { glUniform4fv(location, 1, &value[0]); }
+inline void setUniformValue(GLint location, const glm::mat2 &mat) { glUniformMatrix2fv(location, 1, GL_FALSE, &mat[0][0]); }
+inline void setUniformValue(GLint location, const glm::mat3 &mat) { glUniformMatrix3fv(location, 1, GL_FALSE, &mat[0][0]); }
+inline void setUniformValue(GLint location, const glm::mat4 &mat) { glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]); }
+
+// A uniform location resolved once, e.g. UniformHandle<glm::mat4> model = shader.Uniform<glm::mat4>("model");
+// Set() goes straight to glUniform* without any name lookup. Like glUniform* it acts on the program in use.
+template <typename T>
+class UniformHandle
+{
+public:
+	UniformHandle() : location(-1) {}
+	explicit UniformHandle(GLint location) : location(location) {}
+
+	void Set(const T &value) const
+	{
+		renderStats().UniformLookupsAvoided++;
+		setUniformValue(location, value);
+	}
+
+	// false if the program has no active uniform of that name; Set() is then a no-op like glUniform* with -1
+	bool Valid() const
+	{
+		return location >= 0;
+	}
+
+	GLint Location() const
+	{
+		return location;
+	}
+
+private:
+	GLint location;
+};
 
 class Shader
 {
@@ -89,6 +172,7 @@ public:
 			glAttachShader(ID, geometry);
 		glLinkProgram(ID);
 		checkCompileErrors(ID, "PROGRAM");
+		setupProgram();
 		// delete the shaders as they're linked into our program now and no longer necessery
 		glDeleteShader(vertex);
 		glDeleteShader(fragment);
@@ -96,72 +180,248 @@ public:
 			glDeleteShader(geometry);
 
 	}
+	// vertex-only program for transform feedback: nothing is rasterized, the given outputs of the
+	// vertex shader are captured interleaved, in this order, into the bound feedback buffer
+	// ------------------------------------------------------------------------
+	Shader(const char* vertexPath, const std::vector<const char*> &feedbackVaryings)
+	{
+		std::string vertexCode;
+		std::ifstream vShaderFile;
+		vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+		try
+		{
+			vShaderFile.open(vertexPath);
+			std::stringstream vShaderStream;
+			vShaderStream << vShaderFile.rdbuf();
+			vShaderFile.close();
+			vertexCode = vShaderStream.str();
+		}
+		catch (const std::ifstream::failure &)
+		{
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+		}
+		const char* vShaderCode = vertexCode.c_str();
+		unsigned int vertex = glCreateShader(GL_VERTEX_SHADER);
+		glShaderSource(vertex, 1, &vShaderCode, NULL);
+		glCompileShader(vertex);
+		checkCompileErrors(vertex, "VERTEX");
+		ID = glCreateProgram();
+		glAttachShader(ID, vertex);
+		glTransformFeedbackVaryings(ID, (GLsizei)feedbackVaryings.size(), feedbackVaryings.data(), GL_INTERLEAVED_ATTRIBS);
+		glLinkProgram(ID);
+		checkCompileErrors(ID, "PROGRAM");
+		setupProgram();
+		glDeleteShader(vertex);
+	}
 	// activate the shader
 	// ------------------------------------------------------------------------
-	void use()
+	void use() const
 	{
-		glUseProgram(ID);
+		glState().UseProgram(ID);
+	}
+	// uniform lookup
+	// ------------------------------------------------------------------------
+	// location of an active uniform, served from the table built after linking instead of asking the driver.
+	// returns -1 for names the program doesn't use, just like glGetUniformLocation.
+	GLint getUniformLocation(const char *name) const
+	{
+		std::vector<UniformInfo>::const_iterator it = std::lower_bound(uniforms->begin(), uniforms->end(), name, UniformInfo::Less());
+		if (it != uniforms->end() && std::strcmp(it->name.c_str(), name) == 0)
+			return it->location;
+		return -1;
+	}
+	// ------------------------------------------------------------------------
+	template <typename T>
+	UniformHandle<T> Uniform(const char *name) const
+	{
+		return UniformHandle<T>(getUniformLocation(name));
+	}
+	// ------------------------------------------------------------------------
+	// location of a material sampler by slot (see materialSamplerSlot), -1 if the program doesn't sample it
+	GLint SamplerLocation(unsigned int slot) const
+	{
+		renderStats().UniformLookupsAvoided++;
+		return samplerLocations[slot];
+	}
+	// ------------------------------------------------------------------------
+	const VertexDecodeLocations &VertexDecode() const
+	{
+		renderStats().UniformLookupsAvoided++;
+		return vertexDecode;
 	}
 	// utility uniform functions
 	// ------------------------------------------------------------------------
+	void setBool(const char *name, bool value) const
+	{
+		glUniform1i(getUniformLocation(name), (int)value);
+	}
 	void setBool(const std::string &name, bool value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		setBool(name.c_str(), value);
 	}
 	// ------------------------------------------------------------------------
+	void setInt(const char *name, int value) const
+	{
+		glUniform1i(getUniformLocation(name), value);
+	}
 	void setInt(const std::string &name, int value) const
 	{
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		setInt(name.c_str(), value);
 	}
 	// ------------------------------------------------------------------------
+	void setFloat(const char *name, float value) const
+	{
+		glUniform1f(getUniformLocation(name), value);
+	}
 	void setFloat(const std::string &name, float value) const
 	{
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		setFloat(name.c_str(), value);
 	}
 	// ------------------------------------------------------------------------
+	void setVec2(const char *name, const glm::vec2 &value) const
+	{
+		glUniform2fv(getUniformLocation(name), 1, &value[0]);
+	}
 	void setVec2(const std::string &name, const glm::vec2 &value) const
 	{
-		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		setVec2(name.c_str(), value);
 	}
 	void setVec2(const std::string &name, float x, float y) const
 	{
-		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+		glUniform2f(getUniformLocation(name.c_str()), x, y);
 	}
 	// ------------------------------------------------------------------------
+	void setVec3(const char *name, const glm::vec3 &value) const
+	{
+		glUniform3fv(getUniformLocation(name), 1, &value[0]);
+	}
 	void setVec3(const std::string &name, const glm::vec3 &value) const
 	{
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		setVec3(name.c_str(), value);
 	}
 	void setVec3(const std::string &name, float x, float y, float z) const
 	{
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		glUniform3f(getUniformLocation(name.c_str()), x, y, z);
 	}
 	// ------------------------------------------------------------------------
+	void setVec4(const char *name, const glm::vec4 &value) const
+	{
+		glUniform4fv(getUniformLocation(name), 1, &value[0]);
+	}
 	void setVec4(const std::string &name, const glm::vec4 &value) const
 	{
-		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+		setVec4(name.c_str(), value);
 	}
 	void setVec4(const std::string &name, float x, float y, float z, float w)
 	{
-		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+		glUniform4f(getUniformLocation(name.c_str()), x, y, z, w);
 	}
 	// ------------------------------------------------------------------------
+	void setMat2(const char *name, const glm::mat2 &mat) const
+	{
+		glUniformMatrix2fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
+	}
 	void setMat2(const std::string &name, const glm::mat2 &mat) const
 	{
-		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		setMat2(name.c_str(), mat);
 	}
 	// ------------------------------------------------------------------------
+	void setMat3(const char *name, const glm::mat3 &mat) const
+	{
+		glUniformMatrix3fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
+	}
 	void setMat3(const std::string &name, const glm::mat3 &mat) const
 	{
-		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		setMat3(name.c_str(), mat);
 	}
 	// ------------------------------------------------------------------------
+	void setMat4(const char *name, const glm::mat4 &mat) const
+	{
+		glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, &mat[0][0]);
+	}
 	void setMat4(const std::string &name, const glm::mat4 &mat) const
 	{
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+		setMat4(name.c_str(), mat);
 	}
 
 private:
+	struct UniformInfo
+	{
+		std::string name;
+		GLint location;
+
+		struct Less
+		{
+			bool operator()(const UniformInfo &a, const UniformInfo &b) const { return a.name < b.name; }
+			bool operator()(const UniformInfo &a, const char *b) const { return std::strcmp(a.name.c_str(), b) < 0; }
+		};
+	};
+	// active uniforms sorted by name; shared so that copies of the shader don't copy the table
+	std::shared_ptr<const std::vector<UniformInfo> > uniforms;
+	GLint samplerLocations[MATERIAL_SAMPLER_COUNT];
+	VertexDecodeLocations vertexDecode;
+
+	// everything that is read from a freshly linked program
+	// ------------------------------------------------------------------------
+	void setupProgram()
+	{
+		reflectUniforms();
+		resolveMaterialSamplers();
+		vertexDecode.Packed = getUniformLocation("packedVertices");
+		vertexDecode.PositionOffset = getUniformLocation("positionOffset");
+		vertexDecode.PositionScale = getUniformLocation("positionScale");
+		// connect the shared per-frame block, if the program reads it
+		GLuint frameDataIndex = glGetUniformBlockIndex(ID, "FrameData");
+		if (frameDataIndex != GL_INVALID_INDEX)
+			glUniformBlockBinding(ID, frameDataIndex, FRAME_DATA_BINDING);
+	}
+	// queries every active uniform of the linked program once
+	// ------------------------------------------------------------------------
+	void reflectUniforms()
+	{
+		std::shared_ptr<std::vector<UniformInfo> > table(new std::vector<UniformInfo>());
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<GLchar> buffer(maxLength > 0 ? maxLength : 1);
+		for (GLint i = 0; i < count; i++)
+		{
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(ID, (GLuint)i, (GLsizei)buffer.size(), &length, &size, &type, &buffer[0]);
+			UniformInfo info;
+			info.name.assign(&buffer[0], length);
+			info.location = glGetUniformLocation(ID, info.name.c_str());
+			// members of uniform blocks have no location
+			if (info.location < 0)
+				continue;
+			table->push_back(info);
+			// arrays are reported as "name[0]", make them reachable as plain "name" as well
+			if (info.name.size() > 3 && info.name.compare(info.name.size() - 3, 3, "[0]") == 0)
+			{
+				info.name.erase(info.name.size() - 3);
+				table->push_back(info);
+			}
+		}
+		std::sort(table->begin(), table->end(), UniformInfo::Less());
+		uniforms = table;
+	}
+
+	// looks up texture_diffuse1, texture_diffuse2, ... once so meshes can bind their textures by slot
+	// ------------------------------------------------------------------------
+	void resolveMaterialSamplers()
+	{
+		for (unsigned int type = 0; type < SAMPLER_TYPE_COUNT; type++)
+		{
+			for (unsigned int number = 1; number <= MAX_SAMPLERS_PER_TYPE; number++)
+			{
+				std::string name = materialSamplerPrefix(type) + std::to_string(number);
+				samplerLocations[materialSamplerSlot(type, number)] = getUniformLocation(name.c_str());
+			}
+		}
+	}
+
 	// utility function for checking shader compilation/linking errors.
 	// ------------------------------------------------------------------------
 	void checkCompileErrors(GLuint shader, std::string type)
@@ -1,9 +1,29 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 lightSpaceMatrix;
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    mat4 lightSpaceMatrix;
+    vec3 cameraPos;
+    float time;
+    vec3 lightPos;
+};
+
 uniform mat4 model;
 
+// set by meshes with packed vertices (packed_vertex.h): positions are fractions of the mesh box
+uniform bool packedVertices;
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+vec3 decodePosition(vec3 position)
+{
+    return packedVertices ? positionOffset + position * positionScale : position;
+}
+
 void main() {
-    gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+    gl_Position = lightSpaceMatrix * model * vec4(decodePosition(aPos), 1.0);
 }
\ No newline at end of file
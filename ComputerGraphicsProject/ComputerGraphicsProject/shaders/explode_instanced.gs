@@ -4,13 +4,13 @@ layout (triangle_strip, max_vertices = 3) out;
 
 in VS_OUT {
     vec2 texCoords;
+    float offset;
 } gs_in[];
 
 out vec2 TexCoords;
 
-uniform float offset;
-
-vec4 explode(vec4 position, vec3 normal)
+// the explode distance comes per instance, all three vertices of a triangle share it
+vec4 explode(vec4 position, vec3 normal, float offset)
 {
 	vec3 direction = normal * offset;
     return position + vec4(direction, 0.0);
@@ -25,14 +25,15 @@ vec3 GetNormal()
 
 void main() {
     vec3 normal = GetNormal();
+    float offset = gs_in[0].offset;
 
-    gl_Position = explode(gl_in[0].gl_Position, normal);
+    gl_Position = explode(gl_in[0].gl_Position, normal, offset);
     TexCoords = gs_in[0].texCoords;
     EmitVertex();
-    gl_Position = explode(gl_in[1].gl_Position, normal);
+    gl_Position = explode(gl_in[1].gl_Position, normal, offset);
     TexCoords = gs_in[1].texCoords;
     EmitVertex();
-    gl_Position = explode(gl_in[2].gl_Position, normal);
+    gl_Position = explode(gl_in[2].gl_Position, normal, offset);
     TexCoords = gs_in[2].texCoords;
     EmitVertex();
     EndPrimitive();
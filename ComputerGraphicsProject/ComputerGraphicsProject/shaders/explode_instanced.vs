@@ -0,0 +1,38 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 5) in mat4 aInstanceModel;
+layout (location = 9) in float aInstanceOffset;
+
+out VS_OUT {
+    vec2 texCoords;
+    float offset;
+} vs_out;
+
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    mat4 lightSpaceMatrix;
+    vec3 cameraPos;
+    float time;
+    vec3 lightPos;
+};
+
+// set by meshes with packed vertices (packed_vertex.h): positions are fractions of the mesh box
+uniform bool packedVertices;
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+vec3 decodePosition(vec3 position)
+{
+    return packedVertices ? positionOffset + position * positionScale : position;
+}
+
+void main()
+{
+    vs_out.texCoords = aTexCoords;
+    vs_out.offset = aInstanceOffset;
+    gl_Position = viewProjection * aInstanceModel * vec4(decodePosition(aPos), 1.0);
+}
\ No newline at end of file
@@ -4,7 +4,17 @@ in vec3 Position;
 
 out vec4 FragColor;
 
-uniform vec3 cameraPos;
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    mat4 lightSpaceMatrix;
+    vec3 cameraPos;
+    float time;
+    vec3 lightPos;
+};
+
 uniform samplerCube skybox;
 
 void main()
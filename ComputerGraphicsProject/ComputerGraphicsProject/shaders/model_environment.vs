@@ -5,13 +5,43 @@ layout (location = 1) in vec3 aNormal;
 out vec3 Normal;
 out vec3 Position;
 
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    mat4 lightSpaceMatrix;
+    vec3 cameraPos;
+    float time;
+    vec3 lightPos;
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+// set by meshes with packed vertices (packed_vertex.h): positions are fractions of the mesh box
+uniform bool packedVertices;
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+vec3 decodePosition(vec3 position)
+{
+    return packedVertices ? positionOffset + position * positionScale : position;
+}
+
+// packed normals are octahedral, xy of the unit octahedron folded onto its upper half
+vec3 decodeNormal(vec3 normal)
+{
+    if (!packedVertices)
+        return normal;
+    vec3 n = vec3(normal.xy, 1.0 - abs(normal.x) - abs(normal.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
 
 void main()
 {
-	Normal = mat3(transpose(inverse(model))) * aNormal;
-    Position = vec3(model * vec4(aPos, 1.0));
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+	Normal = mat3(transpose(inverse(model))) * decodeNormal(aNormal);
+    Position = vec3(model * vec4(decodePosition(aPos), 1.0));
+    gl_Position = viewProjection * model * vec4(decodePosition(aPos), 1.0);
 }
\ No newline at end of file
@@ -8,8 +8,17 @@ in VS_OUT {
 } fs_in;
 
 uniform sampler2D texture_diffuse1;
-uniform vec3 lightPos;
-uniform vec3 viewPos;
+
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    mat4 lightSpaceMatrix;
+    vec3 cameraPos;
+    float time;
+    vec3 lightPos;
+};
 
 void main()
 {           
@@ -22,7 +31,7 @@ void main()
     float diff = max(dot(lightDir, normal), 0.0);
     vec3 diffuse = diff * color;
     // specular
-    vec3 viewDir = normalize(viewPos - fs_in.FragPos);
+    vec3 viewDir = normalize(cameraPos - fs_in.FragPos);
     vec3 halfwayDir = normalize(lightDir + viewDir);  
     float spec = pow(max(dot(normal, halfwayDir), 0.0), 32.0);
     vec3 specular = spec * vec3(0.3); // assuming bright white light color
@@ -9,14 +9,44 @@ out VS_OUT {
     vec2 TexCoords;
 } vs_out;
 
+layout (std140) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    mat4 lightSpaceMatrix;
+    vec3 cameraPos;
+    float time;
+    vec3 lightPos;
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+// set by meshes with packed vertices (packed_vertex.h): positions are fractions of the mesh box
+uniform bool packedVertices;
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+vec3 decodePosition(vec3 position)
+{
+    return packedVertices ? positionOffset + position * positionScale : position;
+}
+
+// packed normals are octahedral, xy of the unit octahedron folded onto its upper half
+vec3 decodeNormal(vec3 normal)
+{
+    if (!packedVertices)
+        return normal;
+    vec3 n = vec3(normal.xy, 1.0 - abs(normal.x) - abs(normal.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
 
 void main()
 {
-	vs_out.FragPos = aPos;
-	vs_out.Normal = aNormal;
+	vs_out.FragPos = decodePosition(aPos);
+	vs_out.Normal = decodeNormal(aNormal);
 	vs_out.TexCoords = aTexCoords;
-	gl_Position = projection * view * model * vec4(aPos, 1.0);
+	gl_Position = viewProjection * model * vec4(decodePosition(aPos), 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,17 @@
+#version 330 core
+out vec4 FragColor;
+
+uniform sampler2D accumulation;
+uniform sampler2D weight;
+
+void main()
+{
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+	vec4 sum = texelFetch(accumulation, texel, 0);
+	// share of the background that still shows through all particles
+	float revealage = sum.a;
+	if (revealage >= 1.0)
+		discard;
+	vec3 average = sum.rgb / max(texelFetch(weight, texel, 0).r, 1e-5);
+	FragColor = vec4(average, 1.0 - revealage);
+}
\ No newline at end of file
@@ -0,0 +1,18 @@
+#version 330 core
+in vec2 TexCoord;
+in vec4 ParticleColor;
+// weighted blended order-independent transparency (McGuire and Bavoil 2013)
+layout (location = 0) out vec4 Accumulation;
+layout (location = 1) out float Weight;
+
+uniform sampler2D sprite;
+
+void main()
+{
+	vec4 color = texture(sprite, TexCoord) * ParticleColor;
+	// nearer and more opaque fragments count for more
+	float weight = clamp(pow(min(1.0, color.a * 10.0) + 0.01, 3.0) * 1e8 * pow(1.0 - gl_FragCoord.z * 0.9, 3.0), 1e-2, 3e3);
+	// rgb is summed, alpha is multiplied into the revealage by the blend function
+	Accumulation = vec4(color.rgb * color.a * weight, color.a);
+	Weight = color.a * weight;
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#version 330 core
+// one step of the GPU particle simulation, run with transform feedback (see ParticleGenerator)
+layout (location = 0) in vec4 aOffsetSize;
+layout (location = 1) in vec4 aColor;
+layout (location = 2) in vec4 aVelocityLife;
+
+out vec4 outOffsetSize;
+out vec4 outColor;
+out vec4 outVelocityLife;
+
+uniform float deltaTime;
+uniform vec3 acceleration;
+// the spawn window: spawnCount slots starting at spawnStart, wrapping around at capacity
+uniform int capacity;
+uniform int spawnStart;
+uniform int spawnCount;
+uniform int seed;
+
+uint hash(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// uniform random number in [0, 1)
+float random(inout uint state)
+{
+    state = hash(state);
+    return float(state >> 8) / 16777216.0;
+}
+
+void main()
+{
+    vec3 position = aOffsetSize.xyz;
+    float size = aOffsetSize.w;
+    vec4 color = aColor;
+    vec3 velocity = aVelocityLife.xyz;
+    float life = aVelocityLife.w;
+
+    // a dead particle inside the spawn window comes back with the same recipe as on the CPU
+    if (life <= 0.0 && (gl_VertexID - spawnStart + capacity) % capacity < spawnCount)
+    {
+        uint state = hash(uint(gl_VertexID)) ^ hash(uint(seed) + 0x9e3779b9u);
+        position = vec3(random(state), random(state), random(state)) * 2.0 - 1.0;
+        velocity = vec3(random(state), random(state), random(state)) * 2.0 - 1.0;
+        color = vec4(random(state), random(state), random(state), 1.0);
+        size = 0.05;
+        life = 1.0;
+    }
+
+    if (life > 0.0)
+    {
+        life -= deltaTime;
+        position += velocity * deltaTime + 0.5 * acceleration * deltaTime * deltaTime;
+        velocity += acceleration * deltaTime;
+        // size 0 makes the instance degenerate, so dead particles draw nothing
+        if (life <= 0.0)
+            size = 0.0;
+    }
+
+    outOffsetSize = vec4(position, size);
+    outColor = color;
+    outVelocityLife = vec4(velocity, life);
+}
\ No newline at end of file
@@ -0,0 +1,12 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec3 TexCoords;
+
+// one layer per planet, the layer index comes with the instance
+uniform sampler2DArray planetTextures;
+
+void main()
+{
+    FragColor = texture(planetTextures, TexCoords);
+}
\ No newline at end of file
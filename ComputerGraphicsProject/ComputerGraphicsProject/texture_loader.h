@@ -0,0 +1,283 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include "thread_pool.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+using namespace std;
+
+// Decodes image files on a thread pool while the GL thread keeps going.
+//
+// Load2D/LoadCubemap/LoadArray create the texture object right away and return its id, so meshes can
+// reference it immediately; the image data is decoded by the workers. Finish() has to be called
+// on the GL thread: it uploads every image as soon as its decode completes (staged through a
+// pixel buffer object) and returns once all requested textures are complete.
+class TextureLoader
+{
+public:
+	TextureLoader(ThreadPool &pool) : pool(pool), pending(0), stagingIndex(0)
+	{
+		staging[0] = staging[1] = 0;
+	}
+
+	~TextureLoader()
+	{
+		Finish();
+	}
+
+	// loads a 2D texture with mipmaps and repeat wrapping
+	unsigned int Load2D(const string &path)
+	{
+		unsigned int textureID;
+		glGenTextures(1, &textureID);
+		glBindTexture(GL_TEXTURE_2D, textureID);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		request(path, textureID, GL_TEXTURE_2D, GL_TEXTURE_2D);
+		return textureID;
+	}
+
+	// loads a cubemap texture from 6 individual texture faces
+	// order:
+	// +X (right)
+	// -X (left)
+	// +Y (top)
+	// -Y (bottom)
+	// +Z (front)
+	// -Z (back)
+	unsigned int LoadCubemap(const vector<string> &faces)
+	{
+		unsigned int textureID;
+		glGenTextures(1, &textureID);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+		for (unsigned int i = 0; i < faces.size(); i++)
+			request(faces[i], textureID, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i);
+		return textureID;
+	}
+
+	// loads the images as the layers of a 2D texture array with mipmaps and repeat wrapping.
+	// every image is converted to RGB and resampled to width x height on the worker that decodes it.
+	unsigned int LoadArray(const vector<string> &paths, int width, int height)
+	{
+		unsigned int textureID;
+		glGenTextures(1, &textureID);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, width, height, (GLsizei)paths.size(), 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		for (unsigned int i = 0; i < paths.size(); i++)
+			request(paths[i], textureID, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_2D_ARRAY, i, width, height);
+		// the mip chain is built once all layers are in
+		arrayMipmaps.push_back(textureID);
+		return textureID;
+	}
+
+	// uploads decoded images until every request has been handled
+	void Finish()
+	{
+		unique_lock<mutex> lock(doneMutex);
+		while (pending > 0)
+		{
+			decodeDone.wait(lock, [this] { return !done.empty(); });
+			DecodedImage image = done.front();
+			done.pop_front();
+			pending--;
+			// let the workers hand in more results while we talk to the driver
+			lock.unlock();
+			upload(image);
+			lock.lock();
+		}
+		for (size_t i = 0; i < arrayMipmaps.size(); i++)
+		{
+			glBindTexture(GL_TEXTURE_2D_ARRAY, arrayMipmaps[i]);
+			glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		}
+		arrayMipmaps.clear();
+		if (staging[0])
+		{
+			glDeleteBuffers(2, staging);
+			staging[0] = staging[1] = 0;
+		}
+	}
+
+private:
+	struct DecodedImage
+	{
+		string path;
+		unsigned int textureID;
+		GLenum target;     // GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP or GL_TEXTURE_2D_ARRAY, used for binding
+		GLenum face;       // image target passed to glTexImage2D
+		int layer;         // array layer, only for GL_TEXTURE_2D_ARRAY
+		int arrayWidth, arrayHeight; // size the image is resampled to, only for GL_TEXTURE_2D_ARRAY
+		int width, height, components;
+		unsigned char *data;
+	};
+
+	ThreadPool &pool;
+	mutex doneMutex;
+	condition_variable decodeDone;
+	deque<DecodedImage> done;
+	unsigned int pending;
+	GLuint staging[2];
+	unsigned int stagingIndex;
+	vector<unsigned int> arrayMipmaps;
+
+	void request(const string &path, unsigned int textureID, GLenum target, GLenum face, int layer = 0, int arrayWidth = 0, int arrayHeight = 0)
+	{
+		DecodedImage image;
+		image.path = path;
+		image.textureID = textureID;
+		image.target = target;
+		image.face = face;
+		image.layer = layer;
+		image.arrayWidth = arrayWidth;
+		image.arrayHeight = arrayHeight;
+		image.width = image.height = image.components = 0;
+		image.data = NULL;
+		{
+			lock_guard<mutex> lock(doneMutex);
+			pending++;
+		}
+		pool.Submit([this, image]() mutable {
+			if (image.target == GL_TEXTURE_2D_ARRAY)
+			{
+				// layers have to agree in format and size
+				image.data = stbi_load(image.path.c_str(), &image.width, &image.height, &image.components, 3);
+				image.components = 3;
+				if (image.data && (image.width != image.arrayWidth || image.height != image.arrayHeight))
+					resample(image, image.arrayWidth, image.arrayHeight);
+			}
+			else
+				image.data = stbi_load(image.path.c_str(), &image.width, &image.height, &image.components, 0);
+			// notify under the lock: once Finish() has seen the last image the loader may be destroyed
+			lock_guard<mutex> lock(doneMutex);
+			done.push_back(image);
+			decodeDone.notify_one();
+		});
+	}
+
+	void upload(DecodedImage &image)
+	{
+		if (!image.data)
+		{
+			std::cout << "Texture failed to load at path: " << image.path << std::endl;
+			return;
+		}
+
+		GLenum format = GL_RGB;
+		if (image.components == 1)
+			format = GL_RED;
+		else if (image.components == 3)
+			format = GL_RGB;
+		else if (image.components == 4)
+			format = GL_RGBA;
+
+		// copy into one of two alternating pixel buffers; orphaning the store lets the driver
+		// keep transferring the previous image while we fill the next one
+		if (!staging[0])
+			glGenBuffers(2, staging);
+		GLsizeiptr size = (GLsizeiptr)image.width * image.height * image.components;
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging[stagingIndex]);
+		stagingIndex = 1 - stagingIndex;
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+		void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		const void *pixels = (const void *)0;
+		if (mapped)
+		{
+			memcpy(mapped, image.data, size);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		}
+		else
+		{
+			// mapping failed, fall back to a plain client memory upload
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			pixels = image.data;
+		}
+
+		// decoded rows are tightly packed, which matters for RGB images whose width is not a multiple of 4
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glBindTexture(image.target, image.textureID);
+		if (image.target == GL_TEXTURE_2D_ARRAY)
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, image.layer, image.width, image.height, 1, format, GL_UNSIGNED_BYTE, pixels);
+		else
+			glTexImage2D(image.face, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, pixels);
+		if (image.target == GL_TEXTURE_2D)
+			glGenerateMipmap(GL_TEXTURE_2D);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		stbi_image_free(image.data);
+		image.data = NULL;
+	}
+
+	// bilinear resample of a decoded image, runs on the worker thread
+	static void resample(DecodedImage &image, int width, int height)
+	{
+		int components = image.components;
+		unsigned char *resized = (unsigned char *)malloc((size_t)width * height * components);
+		if (!resized)
+		{
+			stbi_image_free(image.data);
+			image.data = NULL;
+			return;
+		}
+		float scaleX = (float)image.width / width;
+		float scaleY = (float)image.height / height;
+		for (int y = 0; y < height; y++)
+		{
+			float sy = (y + 0.5f) * scaleY - 0.5f;
+			int y0 = sy < 0.0f ? 0 : (int)sy;
+			int y1 = y0 + 1 < image.height ? y0 + 1 : image.height - 1;
+			float fy = sy - y0 < 0.0f ? 0.0f : sy - y0;
+			for (int x = 0; x < width; x++)
+			{
+				float sx = (x + 0.5f) * scaleX - 0.5f;
+				int x0 = sx < 0.0f ? 0 : (int)sx;
+				int x1 = x0 + 1 < image.width ? x0 + 1 : image.width - 1;
+				float fx = sx - x0 < 0.0f ? 0.0f : sx - x0;
+				const unsigned char *p00 = image.data + ((size_t)y0 * image.width + x0) * components;
+				const unsigned char *p10 = image.data + ((size_t)y0 * image.width + x1) * components;
+				const unsigned char *p01 = image.data + ((size_t)y1 * image.width + x0) * components;
+				const unsigned char *p11 = image.data + ((size_t)y1 * image.width + x1) * components;
+				unsigned char *out = resized + ((size_t)y * width + x) * components;
+				for (int c = 0; c < components; c++)
+				{
+					float top = p00[c] + (p10[c] - p00[c]) * fx;
+					float bottom = p01[c] + (p11[c] - p01[c]) * fx;
+					out[c] = (unsigned char)(top + (bottom - top) * fy + 0.5f);
+				}
+			}
+		}
+		stbi_image_free(image.data);
+		// upload() releases this with stbi_image_free, which is plain free() as STBI_FREE isn't overridden
+		image.data = resized;
+		image.width = width;
+		image.height = height;
+	}
+
+	TextureLoader(const TextureLoader &);
+	TextureLoader &operator=(const TextureLoader &);
+};
+#endif
@@ -0,0 +1,137 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+using namespace std;
+
+// Fixed set of worker threads pulling jobs from a shared queue.
+// Jobs must not touch OpenGL: the GL context only lives on the main thread.
+class ThreadPool
+{
+public:
+	// threadCount 0 picks one worker per hardware thread
+	ThreadPool(unsigned int threadCount = 0) : stopping(false), busy(0)
+	{
+		if (threadCount == 0)
+			threadCount = thread::hardware_concurrency();
+		if (threadCount == 0)
+			threadCount = 2;
+		for (unsigned int i = 0; i < threadCount; i++)
+			workers.push_back(thread(&ThreadPool::workerLoop, this));
+	}
+
+	~ThreadPool()
+	{
+		{
+			lock_guard<mutex> lock(queueMutex);
+			stopping = true;
+		}
+		jobAvailable.notify_all();
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	unsigned int Size() const
+	{
+		return (unsigned int)workers.size();
+	}
+
+	void Submit(function<void()> job)
+	{
+		{
+			lock_guard<mutex> lock(queueMutex);
+			jobs.push_back(job);
+		}
+		jobAvailable.notify_one();
+	}
+
+	// blocks until the queue is empty and no job is running any more
+	void Wait()
+	{
+		unique_lock<mutex> lock(queueMutex);
+		allDone.wait(lock, [this] { return jobs.empty() && busy == 0; });
+	}
+
+	// Runs body(begin, end) over [0, count) in chunks of chunkSize and returns once every chunk is
+	// done. Chunks are claimed one at a time by the workers and the calling thread alike, so uneven
+	// chunks balance out. Only waits for its own chunks, unrelated jobs in the queue keep going.
+	template <typename Body>
+	void ParallelFor(size_t count, size_t chunkSize, Body body)
+	{
+		if (chunkSize == 0)
+			chunkSize = 1;
+		size_t chunks = (count + chunkSize - 1) / chunkSize;
+		if (chunks <= 1 || workers.empty())
+		{
+			if (count > 0)
+				body(0, count);
+			return;
+		}
+
+		atomic<size_t> nextChunk(0);
+		auto work = [&]() {
+			for (size_t chunk = nextChunk++; chunk < chunks; chunk = nextChunk++)
+				body(chunk * chunkSize, min(count, (chunk + 1) * chunkSize));
+		};
+		mutex doneMutex;
+		condition_variable done;
+		size_t helpers = min(workers.size(), chunks - 1);
+		size_t running = helpers;
+		for (size_t i = 0; i < helpers; i++)
+		{
+			Submit([&]() {
+				work();
+				lock_guard<mutex> lock(doneMutex);
+				if (--running == 0)
+					done.notify_one();
+			});
+		}
+		work();
+		unique_lock<mutex> lock(doneMutex);
+		done.wait(lock, [&] { return running == 0; });
+	}
+
+private:
+	vector<thread> workers;
+	deque<function<void()>> jobs;
+	mutex queueMutex;
+	condition_variable jobAvailable;
+	condition_variable allDone;
+	bool stopping;
+	unsigned int busy;
+
+	void workerLoop()
+	{
+		for (;;)
+		{
+			function<void()> job;
+			{
+				unique_lock<mutex> lock(queueMutex);
+				jobAvailable.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (jobs.empty())
+					return;
+				job = jobs.front();
+				jobs.pop_front();
+				busy++;
+			}
+			job();
+			{
+				lock_guard<mutex> lock(queueMutex);
+				busy--;
+				if (jobs.empty() && busy == 0)
+					allDone.notify_all();
+			}
+		}
+	}
+
+	ThreadPool(const ThreadPool &);
+	ThreadPool &operator=(const ThreadPool &);
+};
+#endif